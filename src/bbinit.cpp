@@ -19,28 +19,6 @@
 #include "bbinit.h"
 
 
-/**
- * @brief Our implementation of a xorshift generator as discovered by George
- * Marsaglia.
- * This specific implementation is not fully pseudorandom, but attempts to
- * create good magic number candidates by artifically increasing the number
- * of high bits.
- */
-static uint64_t mseed = 0, mstate = 0;
-uint64_t magicRNG() {
-    // Use "y" to achieve a larger number of high bits
-    uint64_t y = ((mstate << 57) | (mseed << 57)) >> 1;
-    mstate ^= mseed >> 17;
-    mstate ^= mstate << 3;
-
-    uint64_t temp = mseed;
-    mseed = mstate;
-    mstate = temp;
-
-    // But not too high, or they will overflow out once multiplied by the mask
-    return (y | (mseed ^ mstate)) >> 1;
-}
-
 // Shift amounts for Dumb7fill
 constexpr int NORTH_SOUTH_FILL = 8;
 constexpr int EAST_WEST_FILL = 1;
@@ -61,14 +39,54 @@ MagicInfo magicBishops[64];
 // The magic values for rooks, one for each square
 MagicInfo magicRooks[64];
 
+// Magic multipliers, found by trial and error with Tord Romstad's approach
+// (https://chessprogramming.wikispaces.com/Looking+for+Magics) and a xorshift
+// generator seeded with 2563762638929852183. They are stored here so that
+// startup does not need to repeat the search.
+constexpr uint64_t BISHOP_MAGICS[64] = {
+    0x3E40902222004210ULL, 0x38A0414C00A08000ULL, 0x3490044088280602ULL, 0x1604070200900202ULL,
+    0x3D82021100100000ULL, 0x2E81100290010100ULL, 0x7F82020120084202ULL, 0x6A81008041084020ULL,
+    0x3A80046002242100ULL, 0x3B01908491004200ULL, 0x3F00B02506082420ULL, 0x2B82280481100001ULL,
+    0x3780040504002403ULL, 0x1588008821080808ULL, 0x16B0040098041100ULL, 0x3900402202300400ULL,
+    0x5611032004411800ULL, 0x3708132001014E06ULL, 0x3D8802C040802080ULL, 0x3790801802024210ULL,
+    0x3EA2004420210480ULL, 0x3738400200622000ULL, 0x3F8100228A88A005ULL, 0x1B02004242221100ULL,
+    0x3E90040210459010ULL, 0x5FC12020100AB606ULL, 0x1F70501031040280ULL, 0x6BA0080001004008ULL,
+    0x2EA10100D4104002ULL, 0x1F1001020080A088ULL, 0x2F90A40005010881ULL, 0x3981110102124504ULL,
+    0x2F94244004A08300ULL, 0x1781115080889000ULL, 0x3FC2080202040020ULL, 0x3F80400808048201ULL,
+    0x6340010012010040ULL, 0x3E208B03024A008AULL, 0x2588122040040140ULL, 0x41B080808D020220ULL,
+    0x178AA8541045C004ULL, 0x3A94008824100980ULL, 0x0F900A0090010200ULL, 0x3D80004010400208ULL,
+    0x7580941810140601ULL, 0x3F84011002081102ULL, 0x66052428004D0604ULL, 0x2F8810812A041040ULL,
+    0x3680521004200000ULL, 0x5B80484404200208ULL, 0x3790002208120800ULL, 0x3EC0404104A80308ULL,
+    0x1B801090A0221100ULL, 0x3388400224410400ULL, 0x2BA0A06220812000ULL, 0x3D90440088820820ULL,
+    0x6F86022118082400ULL, 0x5BA0024C02080288ULL, 0x3F80040842024110ULL, 0x26C0000002104420ULL,
+    0x3F90100040104110ULL, 0x7E00004212141508ULL, 0x1880A060C2024040ULL, 0x3782021014010446ULL
+};
+
+constexpr uint64_t ROOK_MAGICS[64] = {
+    0x2880024000221880ULL, 0x3B80102001400484ULL, 0x1F80082002801001ULL, 0x1F80080110008580ULL,
+    0x7D80022400804801ULL, 0x3E80020080014400ULL, 0x3880408002000100ULL, 0x2E0000802C090042ULL,
+    0x3D08800C80400024ULL, 0x3DC2804000200080ULL, 0x3E8A002208401080ULL, 0x3D20040042010080ULL,
+    0x5B80800800040080ULL, 0x3F02808012001400ULL, 0x1F88804200010080ULL, 0x1F01000200B04100ULL,
+    0x3780004000200040ULL, 0x3B90004040002001ULL, 0x6150010100402000ULL, 0x3F88010100201000ULL,
+    0x3BC4110004080101ULL, 0x7880808004000200ULL, 0x1388040002880150ULL, 0x33A026000A40A104ULL,
+    0x3FA0400080002084ULL, 0x0E00200640045000ULL, 0x3600200100410010ULL, 0x0780100080080080ULL,
+    0x6F80080080800400ULL, 0x2540020080800400ULL, 0x7F81000100020004ULL, 0x3FA0008200010044ULL,
+    0x2E80002000400040ULL, 0x7C80200486804004ULL, 0x17B0801000802001ULL, 0x23C0801000800802ULL,
+    0x3790040080800800ULL, 0x1E82000802001004ULL, 0x6EC1000401000200ULL, 0x323880A042000104ULL,
+    0x1980804000208000ULL, 0x2F81008040050020ULL, 0x33900080200C8010ULL, 0x1A98018010048008ULL,
+    0x0784000800808004ULL, 0x1382008004008002ULL, 0x7C90010002008080ULL, 0x7B80008100420024ULL,
+    0x1780024002200240ULL, 0x1D80804000201880ULL, 0x2F860020401A8200ULL, 0x3A88220040081200ULL,
+    0x3F03020800100500ULL, 0x3B08800200040080ULL, 0x52A0082291100400ULL, 0x3602004924088200ULL,
+    0x0500201100800041ULL, 0x3F82130480400021ULL, 0x6FC600D081292042ULL, 0x3091041000082101ULL,
+    0x1F82000410200802ULL, 0x3B02000815902C06ULL, 0x77C2811090022814ULL, 0x3F8C082408810042ULL
+};
+
 // Lookup table for all squares in a line between the from and to squares
 uint64_t inBetweenSqs[64][64];
 
-uint64_t indexToMask64(int index, int nBits, uint64_t mask);
 uint64_t ratt(int sq, uint64_t block);
 uint64_t batt(int sq, uint64_t block);
 int magicMap(uint64_t masked, uint64_t magic, int nBits);
-uint64_t findMagic(int sq, int m, bool isBishop);
 
 
 // Initializes the 64x64 table, indexed by from and to square, of all
@@ -105,12 +123,7 @@ void initInBetweenTable() {
  * We use the "fancy" approach.
  * https://chessprogramming.wikispaces.com/Magic+Bitboards
  */
-void initMagicTables(uint64_t seed) {
-    // An arbitrarily chosen random number generator and seed
-    // The constant seed allows this process to be deterministic for optimization
-    // and debugging.
-    mstate = 74036198046ULL;
-    mseed = seed;
+void initMagicTables() {
     // Initialize the rook and bishop masks
     for (int i = 0; i < 64; i++) {
         // The relevant bits are everything except the edges
@@ -131,7 +144,11 @@ void initMagicTables(uint64_t seed) {
         uint64_t *tableStart = attackTable;
         magicBishops[i].table = tableStart + runningPtrLoc;
         magicBishops[i].mask = BISHOP_MASK[i];
-        magicBishops[i].magic = findMagic(i, NUM_BISHOP_BITS[i], true);
+#ifdef USE_PEXT
+        magicBishops[i].magic = 0;
+#else
+        magicBishops[i].magic = BISHOP_MAGICS[i];
+#endif
         magicBishops[i].shift = 64 - NUM_BISHOP_BITS[i];
         // We need 2^n array slots for a mask of n bits
         runningPtrLoc += 1 << NUM_BISHOP_BITS[i];
@@ -141,39 +158,51 @@ void initMagicTables(uint64_t seed) {
         uint64_t *tableStart = attackTable;
         magicRooks[i].table = tableStart + runningPtrLoc;
         magicRooks[i].mask = ROOK_MASK[i];
-        magicRooks[i].magic = findMagic(i, NUM_ROOK_BITS[i], false);
+#ifdef USE_PEXT
+        magicRooks[i].magic = 0;
+#else
+        magicRooks[i].magic = ROOK_MAGICS[i];
+#endif
         magicRooks[i].shift = 64 - NUM_ROOK_BITS[i];
         runningPtrLoc += 1 << NUM_ROOK_BITS[i];
     }
     // Set up the actual attack table, bishops first
     for (int sq = 0; sq < 64; sq++) {
-        int nBits = NUM_BISHOP_BITS[sq];
         uint64_t mask = BISHOP_MASK[sq];
-        // For each possible mask result
-        for (int i = 0; i < (1 << nBits); i++) {
+        // For each possible masked occupancy, enumerated with the
+        // carry-rippler trick
+        uint64_t occ = 0;
+        do {
             // Find the pointer of where to store the attack sets
             uint64_t *attTableLoc = magicBishops[sq].table;
-            // Find the actual masked bits from the mask index
-            uint64_t occ = indexToMask64(i, nBits, mask);
             // Get the attack set for this masked occupancy
             uint64_t attSet = batt(sq, occ);
             // Do the mapping to get the location in the attack table where we
             // store the attack set
-            int magicIndex = magicMap(occ, magicBishops[sq].magic, nBits);
+#ifdef USE_PEXT
+            int magicIndex = (int) _pext_u64(occ, mask);
+#else
+            int magicIndex = magicMap(occ, magicBishops[sq].magic, NUM_BISHOP_BITS[sq]);
+#endif
             attTableLoc[magicIndex] = attSet;
-        }
+            occ = (occ - mask) & mask;
+        } while (occ);
     }
     // Then rooks
     for (int sq = 0; sq < 64; sq++) {
-        int nBits = NUM_ROOK_BITS[sq];
         uint64_t mask = ROOK_MASK[sq];
-        for (int i = 0; i < (1 << nBits); i++) {
+        uint64_t occ = 0;
+        do {
             uint64_t *attTableLoc = magicRooks[sq].table;
-            uint64_t occ = indexToMask64(i, nBits, mask);
             uint64_t attSet = ratt(sq, occ);
-            int magicIndex = magicMap(occ, magicRooks[sq].magic, nBits);
+#ifdef USE_PEXT
+            int magicIndex = (int) _pext_u64(occ, mask);
+#else
+            int magicIndex = magicMap(occ, magicRooks[sq].magic, NUM_ROOK_BITS[sq]);
+#endif
             attTableLoc[magicIndex] = attSet;
-        }
+            occ = (occ - mask) & mask;
+        } while (occ);
     }
 }
 
@@ -218,25 +247,6 @@ uint64_t fillRayLeft(uint64_t rayPieces, uint64_t empty, int shift) {
 //------------------------------------------------------------------------------
 //-----------------------------MAGIC BITBOARDS----------------------------------
 //------------------------------------------------------------------------------
-// This code is adapted from Tord Romstad's approach to finding magics,
-// available online at https://chessprogramming.wikispaces.com/Looking+for+Magics
-
-// Maps an index from 0 from 2^nBits - 1 into one of the
-// 2^nBits possible masks
-uint64_t indexToMask64(int index, int nBits, uint64_t mask) {
-    uint64_t result = 0;
-    // For each bit in the mask
-    for (int i = 0; i < nBits; i++) {
-        int j = bitScanForward(mask);
-        mask &= mask - 1;
-        // If this bit should be set...
-        if (index & indexToBit(i))
-            // Set it at the same position in the result
-            result |= indexToBit(j);
-    }
-    return result;
-}
-
 // Gets rook attacks using Dumb7Fill methods
 uint64_t ratt(int sq, uint64_t block) {
     return fillRayRight(indexToBit(sq), ~block, NORTH_SOUTH_FILL) // south
@@ -257,66 +267,3 @@ uint64_t batt(int sq, uint64_t block) {
 inline int magicMap(uint64_t masked, uint64_t magic, int nBits) {
     return (int) ((masked * magic) >> (64 - nBits));
 }
-
-/**
- * @brief Finds a magic number for the given square using trial and error.
- * @param sq The square to find the magic for.
- * @param iBits The length of the desired index, in bits
- * @param isBishop True for bishop magics, false for rook magics
- * @param magicRNG A random number generator to get magic candidates
- */
-uint64_t findMagic(int sq, int iBits, bool isBishop) {
-    uint64_t mask, maskedBits[4096], attSet[4096], used[4096], magic;
-    bool failed;
-
-    mask = isBishop ? BISHOP_MASK[sq] : ROOK_MASK[sq];
-    int nBits = count(mask);
-    // For each possible masked occupancy, get the attack set corresponding to
-    // that square and occupancy
-    for (int i = 0; i < (1 << nBits); i++) {
-        maskedBits[i] = indexToMask64(i, nBits, mask);
-        attSet[i] = isBishop ? batt(sq, maskedBits[i]) : ratt(sq, maskedBits[i]);
-    }
-    // Try 100 mill iterations before giving up
-    for (int k = 0; k < 100000000; k++) {
-        // Get a random magic candidate
-        // We make this random 64-bit integer sparse by &-ing 3 random numbers
-        // Sparse numbers are beneficial to keep the multiplied bits from
-        // bleeding together and becoming garbage
-        magic = magicRNG() & magicRNG() & magicRNG();
-        // We want a large number of high bits to get a higher success rate,
-        // since mask * magic is shifted by 64 - n bits, leaving n bits at the
-        // end. Thus, anything but the top 12 bits (for rooks in the corners) or
-        // less (for bishops) is garbage. Having a large number of high bits
-        // when multiplying by the full mask gives a better spread of values
-        // with different partial masks.
-        if (count((mask * magic) & 0xFFF0000000000000ULL) < 10)
-            continue;
-
-        // Clear the used table
-        for (int i = 0; i < 4096; i++)
-            used[i] = 0;
-        // Calculate the packed bits for every possible mask using this magic
-        // and see if any fail
-        failed = false;
-        for (int i = 0; !failed && i < (1 << nBits); i++) {
-            int mappedIndex = magicMap(maskedBits[i], magic, iBits);
-            // No collision, mark the index as used for the given attack set
-            if (!used[mappedIndex])
-                used[mappedIndex] = attSet[i];
-            // Otherwise, check for a constructive collsion, where a different
-            // occupancy has the same attack set.
-            // If the collision is not constructive, then we failed.
-            else if (used[mappedIndex] != attSet[i])
-                failed = true;
-        }
-        // If there were no collisions in all 2^nBits mappings, we have found
-        // a valid magic
-        if (!failed)
-            return magic;
-    }
-
-    // Otherwise we failed :(
-    // (this should never happen)
-    return 0;
-}
@@ -21,6 +21,10 @@
 
 #include "common.h"
 
+#ifdef USE_PEXT
+#include <immintrin.h>
+#endif
+
 
 constexpr uint64_t FILE_A = 0x0101010101010101;
 constexpr uint64_t FILE_B = 0x0202020202020202;
@@ -136,6 +140,8 @@ constexpr int NUM_BISHOP_BITS[64] = {
  * @var mask The mask of relevant occupancy bits for this square
  * @var magic The magic 64-bit integer that maps the mask to the array index
  * @var shift The amount to shift by after multiplying mask by magic
+ * With USE_PEXT, the table is instead indexed by extracting the mask bits
+ * with PEXT, and magic and shift are unused.
  */
 struct MagicInfo {
     uint64_t *table;
@@ -144,7 +150,7 @@ struct MagicInfo {
     int shift;
 };
 
-void initMagicTables(uint64_t seed);
+void initMagicTables();
 void initInBetweenTable();
 
 #endif
@@ -17,6 +17,7 @@
 */
 
 #include <algorithm>
+#include <cassert>
 #include <cstring>
 #include <random>
 #include <string>
@@ -34,19 +35,104 @@ constexpr uint64_t BLACK_QSIDE_PASSTHROUGH_SQS = indexToBit(57) | indexToBit(58)
 // Zobrist hashing table and the start position key, both initialized at startup
 uint64_t zobristTable[794];
 static uint64_t startPosZobristKey = 0;
+static uint64_t startPosPawnZobristKey = 0;
+static uint64_t startPosMaterialKey = 0;
+
+// Cuckoo tables holding the Zobrist key difference made by every reversible
+// move, with two candidate slots for each key. These are used to detect when
+// a repetition can be reached in one move.
+static uint64_t cuckooKeys[8192];
+static Move cuckooMoves[8192];
+
+inline int cuckooH1(uint64_t key) {
+    return (int) (key & 0x1FFF);
+}
+
+inline int cuckooH2(uint64_t key) {
+    return (int) ((key >> 16) & 0x1FFF);
+}
+
+// Castling rights that remain after a piece moves from or to each square
+static uint8_t castlingRightsMask[64];
+
+inline uint8_t mailboxPiece(int color, int piece) {
+    return (uint8_t) (8 * color + piece);
+}
+
+// Material value of each piece as a packed score, the king has none
+#define E(mg, eg) ((Score) ((int32_t) (((uint32_t) eg) << 16) + ((int32_t) mg)))
+constexpr Score MATERIAL_SCORES[6] = {
+    E(PIECE_VALUES[MG][PAWNS], PIECE_VALUES[EG][PAWNS]),
+    E(PIECE_VALUES[MG][KNIGHTS], PIECE_VALUES[EG][KNIGHTS]),
+    E(PIECE_VALUES[MG][BISHOPS], PIECE_VALUES[EG][BISHOPS]),
+    E(PIECE_VALUES[MG][ROOKS], PIECE_VALUES[EG][ROOKS]),
+    E(PIECE_VALUES[MG][QUEENS], PIECE_VALUES[EG][QUEENS]),
+    E(0, 0)
+};
+#undef E
 
 void initZobristTable() {
     std::mt19937_64 rng (61280152908);
     for (int i = 0; i < 794; i++)
         zobristTable[i] = rng();
 
+    for (int sq = 0; sq < 64; sq++)
+        castlingRightsMask[sq] = WHITECASTLE | BLACKCASTLE;
+    castlingRightsMask[0] &= ~WHITEQSIDE;
+    castlingRightsMask[4] &= ~WHITECASTLE;
+    castlingRightsMask[7] &= ~WHITEKSIDE;
+    castlingRightsMask[56] &= ~BLACKQSIDE;
+    castlingRightsMask[60] &= ~BLACKCASTLE;
+    castlingRightsMask[63] &= ~BLACKKSIDE;
+
     Board b;
     int *mailbox = b.getMailbox();
     b.initZobristKey(mailbox);
     startPosZobristKey = b.getZobristKey();
+    startPosPawnZobristKey = b.getPawnZobristKey();
+    startPosMaterialKey = b.getMaterialKey();
     delete[] mailbox;
 }
 
+// Fills the cuckoo tables with every non-pawn move on an empty board. This must
+// be called after the magic and Zobrist tables are initialized.
+void initCuckooTables() {
+    Board b;
+    int count = 0;
+    for (int color = WHITE; color <= BLACK; color++) {
+        for (int piece = KNIGHTS; piece <= KINGS; piece++) {
+            for (int sq1 = 0; sq1 < 64; sq1++) {
+                uint64_t moves = (piece == KNIGHTS) ? b.getKnightSquares(sq1)
+                               : (piece == BISHOPS) ? b.getBishopSquares(sq1, 0)
+                               : (piece == ROOKS)   ? b.getRookSquares(sq1, 0)
+                               : (piece == QUEENS)  ? b.getQueenSquares(sq1, 0)
+                                                    : b.getKingSquares(sq1);
+                for (int sq2 = sq1 + 1; sq2 < 64; sq2++) {
+                    if (!(moves & indexToBit(sq2)))
+                        continue;
+
+                    Move m = encodeMove(sq1, sq2);
+                    uint64_t key = zobristTable[384*color + 64*piece + sq1]
+                                 ^ zobristTable[384*color + 64*piece + sq2]
+                                 ^ zobristTable[768];
+                    // Insert, kicking out any resident entry to its other slot
+                    int i = cuckooH1(key);
+                    while (true) {
+                        std::swap(cuckooKeys[i], key);
+                        std::swap(cuckooMoves[i], m);
+                        if (m == NULL_MOVE)
+                            break;
+                        i = (i == cuckooH1(key)) ? cuckooH2(key) : cuckooH1(key);
+                    }
+                    count++;
+                }
+            }
+        }
+    }
+    assert(count == 3668);
+    (void) count;
+}
+
 // Magic tables, initialized in bbinit.cpp
 extern uint64_t *attackTable;
 extern MagicInfo magicBishops[64];
@@ -55,6 +141,9 @@ extern MagicInfo magicRooks[64];
 // Precalculated bitboard tables
 extern uint64_t inBetweenSqs[64][64];
 
+// Piece square tables, initialized in eval.cpp
+extern Score PSQT[2][6][64];
+
 
 //------------------------------------------------------------------------------
 //--------------------------------Constructors----------------------------------
@@ -77,6 +166,8 @@ Board::Board() {
     pieces[BLACK][KINGS] = 0x1000000000000000; // black kings
 
     zobristKey = startPosZobristKey;
+    pawnZobristKey = startPosPawnZobristKey;
+    materialKey = startPosMaterialKey;
     epCaptureFile = NO_EP_POSSIBLE;
     playerToMove = WHITE;
     moveNumber = 1;
@@ -85,6 +176,8 @@ Board::Board() {
 
     kingSqs[WHITE] = 4;
     kingSqs[BLACK] = 60;
+
+    initIncrementalState();
 }
 
 // Create a board object from a mailbox of the current board state.
@@ -124,14 +217,44 @@ Board::Board(int *mailboxBoard, bool _whiteCanKCastle, bool _blackCanKCastle,
 
     kingSqs[WHITE] = bitScanForward(pieces[WHITE][KINGS]);
     kingSqs[BLACK] = bitScanForward(pieces[BLACK][KINGS]);
+
+    initIncrementalState();
 }
 
 Board::~Board() {}
 
 Board Board::staticCopy() const {
-    Board b;
-    std::memcpy(static_cast<void*>(&b), this, sizeof(Board));
-    return b;
+    return *this;
+}
+
+// Fills the mailbox and the piece square table and material sums from the
+// piece bitboards
+void Board::initIncrementalState() {
+    for (int i = 0; i < 64; i++)
+        mailbox[i] = NO_PIECE;
+    for (int color = WHITE; color <= BLACK; color++) {
+        psqtScore[color] = EVAL_ZERO;
+        materialScore[color] = EVAL_ZERO;
+        for (int pieceID = PAWNS; pieceID <= KINGS; pieceID++) {
+            uint64_t bitboard = pieces[color][pieceID];
+            while (bitboard) {
+                int sq = bitScanForward(bitboard);
+                bitboard &= bitboard - 1;
+                mailbox[sq] = mailboxPiece(color, pieceID);
+                psqtScore[color] += PSQT[color][pieceID][sq];
+                materialScore[color] += MATERIAL_SCORES[pieceID];
+            }
+        }
+    }
+}
+
+// Recomputes the incrementally updated state from scratch, for debug builds
+bool Board::checkIncrementalState() const {
+    Board b = *this;
+    b.initIncrementalState();
+    return std::memcmp(b.mailbox, mailbox, sizeof(mailbox)) == 0
+        && b.psqtScore[WHITE] == psqtScore[WHITE] && b.psqtScore[BLACK] == psqtScore[BLACK]
+        && b.materialScore[WHITE] == materialScore[WHITE] && b.materialScore[BLACK] == materialScore[BLACK];
 }
 
 
@@ -166,6 +289,10 @@ void Board::doMove(Move m, int color) {
             zobristKey ^= zobristTable[384*color + startSq];
             zobristKey ^= zobristTable[384*color + 64*promotionType + endSq];
             zobristKey ^= zobristTable[384*(color^1) + 64*captureType + endSq];
+            pawnZobristKey ^= zobristTable[384*color + startSq];
+            materialKey -= materialKeyUnit(color^1, captureType);
+            psqtScore[color^1] -= PSQT[color^1][captureType][endSq];
+            materialScore[color^1] -= MATERIAL_SCORES[captureType];
         }
         else {
             pieces[color][PAWNS] &= ~indexToBit(startSq);
@@ -176,7 +303,14 @@ void Board::doMove(Move m, int color) {
 
             zobristKey ^= zobristTable[384*color + startSq];
             zobristKey ^= zobristTable[384*color + 64*promotionType + endSq];
+            pawnZobristKey ^= zobristTable[384*color + startSq];
         }
+        materialKey -= materialKeyUnit(color, PAWNS);
+        materialKey += materialKeyUnit(color, promotionType);
+        psqtScore[color] += PSQT[color][promotionType][endSq] - PSQT[color][PAWNS][startSq];
+        materialScore[color] += MATERIAL_SCORES[promotionType] - MATERIAL_SCORES[PAWNS];
+        mailbox[startSq] = NO_PIECE;
+        mailbox[endSq] = mailboxPiece(color, promotionType);
         epCaptureFile = NO_EP_POSSIBLE;
         fiftyMoveCounter = 0;
     } // end promotion
@@ -195,6 +329,14 @@ void Board::doMove(Move m, int color) {
             zobristKey ^= zobristTable[384*color + startSq];
             zobristKey ^= zobristTable[384*color + endSq];
             zobristKey ^= zobristTable[384*(color^1) + capSq];
+            pawnZobristKey ^= zobristTable[384*color + startSq];
+            pawnZobristKey ^= zobristTable[384*color + endSq];
+            pawnZobristKey ^= zobristTable[384*(color^1) + capSq];
+            materialKey -= materialKeyUnit(color^1, PAWNS);
+            psqtScore[color] += PSQT[color][PAWNS][endSq] - PSQT[color][PAWNS][startSq];
+            psqtScore[color^1] -= PSQT[color^1][PAWNS][capSq];
+            materialScore[color^1] -= MATERIAL_SCORES[PAWNS];
+            mailbox[capSq] = NO_PIECE;
         }
         else {
             int captureType = getPieceOnSquare(color^1, endSq);
@@ -209,7 +351,19 @@ void Board::doMove(Move m, int color) {
             zobristKey ^= zobristTable[384*color + 64*pieceID + startSq];
             zobristKey ^= zobristTable[384*color + 64*pieceID + endSq];
             zobristKey ^= zobristTable[384*(color^1) + 64*captureType + endSq];
+            if (pieceID == PAWNS) {
+                pawnZobristKey ^= zobristTable[384*color + startSq];
+                pawnZobristKey ^= zobristTable[384*color + endSq];
+            }
+            if (captureType == PAWNS)
+                pawnZobristKey ^= zobristTable[384*(color^1) + endSq];
+            materialKey -= materialKeyUnit(color^1, captureType);
+            psqtScore[color] += PSQT[color][pieceID][endSq] - PSQT[color][pieceID][startSq];
+            psqtScore[color^1] -= PSQT[color^1][captureType][endSq];
+            materialScore[color^1] -= MATERIAL_SCORES[captureType];
         }
+        mailbox[startSq] = NO_PIECE;
+        mailbox[endSq] = mailboxPiece(color, pieceID);
         epCaptureFile = NO_EP_POSSIBLE;
         fiftyMoveCounter = 0;
     } // end capture
@@ -279,6 +433,14 @@ void Board::doMove(Move m, int color) {
                 zobristKey ^= zobristTable[384+64*ROOKS+56];
                 zobristKey ^= zobristTable[384+64*ROOKS+59];
             }
+            int rookStart = (endSq > startSq) ? startSq + 3 : startSq - 4;
+            int rookEnd = (endSq > startSq) ? startSq + 1 : startSq - 1;
+            mailbox[startSq] = NO_PIECE;
+            mailbox[endSq] = mailboxPiece(color, KINGS);
+            mailbox[rookStart] = NO_PIECE;
+            mailbox[rookEnd] = mailboxPiece(color, ROOKS);
+            psqtScore[color] += PSQT[color][KINGS][endSq] - PSQT[color][KINGS][startSq]
+                              + PSQT[color][ROOKS][rookEnd] - PSQT[color][ROOKS][rookStart];
             epCaptureFile = NO_EP_POSSIBLE;
             fiftyMoveCounter++;
         } // end castling
@@ -291,9 +453,15 @@ void Board::doMove(Move m, int color) {
 
             zobristKey ^= zobristTable[384*color + 64*pieceID + startSq];
             zobristKey ^= zobristTable[384*color + 64*pieceID + endSq];
+            mailbox[startSq] = NO_PIECE;
+            mailbox[endSq] = mailboxPiece(color, pieceID);
+            psqtScore[color] += PSQT[color][pieceID][endSq] - PSQT[color][pieceID][startSq];
 
             // check for en passant
             if (pieceID == PAWNS) {
+                pawnZobristKey ^= zobristTable[384*color + startSq];
+                pawnZobristKey ^= zobristTable[384*color + endSq];
+
                 if (getFlags(m) == MOVE_DOUBLE_PAWN)
                     epCaptureFile = startSq & 7;
                 else
@@ -342,6 +510,50 @@ void Board::doMove(Move m, int color) {
         moveNumber++;
     playerToMove = color^1;
     zobristKey ^= zobristTable[768];
+
+    assert(checkIncrementalState());
+}
+
+// Computes the Zobrist key of the position after move m, without making the
+// move. This allows the hash table bucket of the child position to be
+// prefetched while the move is still being made and checked for legality.
+// Hash moves have not been verified yet, so empty squares are tolerated.
+uint64_t Board::getZobristKeyAfter(Move m, int color) const {
+    int startSq = getStartSq(m);
+    int endSq = getEndSq(m);
+    int pieceID = getPieceOnSquare(color, startSq);
+    if (pieceID == -1)
+        return zobristKey;
+    uint64_t key = zobristKey ^ zobristTable[768];
+
+    key ^= zobristTable[384*color + 64*pieceID + startSq];
+    if (isPromotion(m))
+        key ^= zobristTable[384*color + 64*getPromotion(m) + endSq];
+    else
+        key ^= zobristTable[384*color + 64*pieceID + endSq];
+
+    if (isCapture(m)) {
+        if (isEP(m))
+            key ^= zobristTable[384*(color^1) + epVictimSquare(color^1, epCaptureFile)];
+        else {
+            int captureType = getPieceOnSquare(color^1, endSq);
+            if (captureType != -1)
+                key ^= zobristTable[384*(color^1) + 64*captureType + endSq];
+        }
+    }
+    else if (isCastle(m)) {
+        int rookStart = (endSq > startSq) ? startSq + 3 : startSq - 4;
+        int rookEnd = (endSq > startSq) ? startSq + 1 : startSq - 1;
+        key ^= zobristTable[384*color + 64*ROOKS + rookStart];
+        key ^= zobristTable[384*color + 64*ROOKS + rookEnd];
+    }
+
+    uint8_t newRights = castlingRights & castlingRightsMask[startSq] & castlingRightsMask[endSq];
+    key ^= zobristTable[769 + castlingRights] ^ zobristTable[769 + newRights];
+    uint16_t newEPFile = (getFlags(m) == MOVE_DOUBLE_PAWN) ? (startSq & 7) : NO_EP_POSSIBLE;
+    key ^= zobristTable[785 + epCaptureFile] ^ zobristTable[785 + newEPFile];
+
+    return key;
 }
 
 bool Board::doPseudoLegalMove(Move m, int color) {
@@ -352,24 +564,193 @@ bool Board::doPseudoLegalMove(Move m, int color) {
 
 // Do a hash move, which requires a few more checks in case of a Type-1 error.
 bool Board::doHashMove(Move m, int color) {
-    int pieceID = getPieceOnSquare(color, getStartSq(m));
-    // Check that the start square is not empty
+    return isPseudoLegal(m, color) && doPseudoLegalMove(m, color);
+}
+
+// Makes a move and records what is needed to unmake it in undo.
+void Board::makeMove(Move m, int color, UndoInfo &undo) {
+    undo.zobristKey = zobristKey;
+    undo.pawnZobristKey = pawnZobristKey;
+    undo.materialKey = materialKey;
+    undo.psqtScore[WHITE] = psqtScore[WHITE];
+    undo.psqtScore[BLACK] = psqtScore[BLACK];
+    undo.materialScore[WHITE] = materialScore[WHITE];
+    undo.materialScore[BLACK] = materialScore[BLACK];
+    undo.epCaptureFile = epCaptureFile;
+    undo.castlingRights = castlingRights;
+    undo.fiftyMoveCounter = fiftyMoveCounter;
+    undo.capturedPiece = !isCapture(m) ? -1
+                       : isEP(m)       ? PAWNS
+                                       : getPieceOnSquare(color^1, getEndSq(m));
+    doMove(m, color);
+}
+
+// Makes a pseudo-legal move. If it leaves the king in check, the move is
+// unmade again and false is returned.
+bool Board::makePseudoLegalMove(Move m, int color, UndoInfo &undo) {
+    makeMove(m, color, undo);
+    if (isInCheck(color)) {
+        unmakeMove(m, color, undo);
+        return false;
+    }
+    return true;
+}
+
+// Restores the board to the position before move m was made by color.
+void Board::unmakeMove(Move m, int color, const UndoInfo &undo) {
+    int startSq = getStartSq(m);
+    int endSq = getEndSq(m);
+    uint64_t startSingle = indexToBit(startSq);
+    uint64_t endSingle = indexToBit(endSq);
+
+    int pieceID = PAWNS;
+    if (isPromotion(m)) {
+        pieces[color][getPromotion(m)] &= ~endSingle;
+        pieces[color][PAWNS] |= startSingle;
+    }
+    else {
+        pieceID = mailbox[endSq] & 7;
+        pieces[color][pieceID] ^= startSingle | endSingle;
+    }
+    allPieces[color] ^= startSingle | endSingle;
+    mailbox[startSq] = mailboxPiece(color, pieceID);
+    mailbox[endSq] = NO_PIECE;
+
+    if (isCastle(m)) {
+        int rookStart = (endSq > startSq) ? startSq + 3 : startSq - 4;
+        int rookEnd = (endSq > startSq) ? startSq + 1 : startSq - 1;
+        uint64_t rookSqs = indexToBit(rookStart) | indexToBit(rookEnd);
+        pieces[color][ROOKS] ^= rookSqs;
+        allPieces[color] ^= rookSqs;
+        mailbox[rookStart] = mailboxPiece(color, ROOKS);
+        mailbox[rookEnd] = NO_PIECE;
+    }
+    else if (undo.capturedPiece != -1) {
+        int captureSq = isEP(m) ? epVictimSquare(color^1, undo.epCaptureFile) : endSq;
+        pieces[color^1][undo.capturedPiece] |= indexToBit(captureSq);
+        allPieces[color^1] |= indexToBit(captureSq);
+        mailbox[captureSq] = mailboxPiece(color^1, undo.capturedPiece);
+    }
+
+    if (pieceID == KINGS)
+        kingSqs[color] = startSq;
+
+    zobristKey = undo.zobristKey;
+    pawnZobristKey = undo.pawnZobristKey;
+    materialKey = undo.materialKey;
+    psqtScore[WHITE] = undo.psqtScore[WHITE];
+    psqtScore[BLACK] = undo.psqtScore[BLACK];
+    materialScore[WHITE] = undo.materialScore[WHITE];
+    materialScore[BLACK] = undo.materialScore[BLACK];
+    epCaptureFile = undo.epCaptureFile;
+    castlingRights = undo.castlingRights;
+    fiftyMoveCounter = undo.fiftyMoveCounter;
+    if (color == BLACK)
+        moveNumber--;
+    playerToMove = color;
+}
+
+// Checks that a move from the hash table is pseudo-legal, since a Type-1
+// error could give a move from a different position. Hash moves are made in
+// place, so the piece must be able to make the move with exactly the flags it
+// has, or unmaking it would corrupt the board.
+bool Board::isPseudoLegal(Move m, int color) const {
+    if (!isCapture(m))
+        return isPseudoLegalQuiet(m, color);
+
+    int startSq = getStartSq(m);
+    int endSq = getEndSq(m);
+    uint64_t endSingle = indexToBit(endSq);
+    int pieceID = getPieceOnSquare(color, startSq);
     if (pieceID == -1)
         return false;
 
-    // Check that the end square has correct occupancy
-    uint64_t otherPieces = allPieces[color^1];
+    uint64_t occ = getOccupancy();
+    if (isEP(m)) {
+        if (pieceID != PAWNS || epCaptureFile == NO_EP_POSSIBLE)
+            return false;
+        int epEndSq = epVictimSquare(color^1, epCaptureFile) + ((color == WHITE) ? 8 : -8);
+        uint64_t pawn = indexToBit(startSq);
+        return endSq == epEndSq
+            && (endSingle & ~occ)
+            && (endSingle & ((color == WHITE) ? getWPawnCaptures(pawn)
+                                              : getBPawnCaptures(pawn)));
+    }
+
+    // Check that an enemy piece other than the king is captured
+    if (!(allPieces[color^1] & endSingle) || (pieces[color^1][KINGS] & endSingle))
+        return false;
+
+    switch (pieceID) {
+        case PAWNS: {
+            uint64_t pawn = indexToBit(startSq);
+            uint64_t finalRank = (color == WHITE) ? RANK_8 : RANK_1;
+            if (isPromotion(m) != (bool) (endSingle & finalRank)
+             || (!isPromotion(m) && getFlags(m) != MOVE_CAPTURE))
+                return false;
+            return endSingle & ((color == WHITE) ? getWPawnCaptures(pawn)
+                                                 : getBPawnCaptures(pawn));
+        }
+        case KNIGHTS:
+            return getFlags(m) == MOVE_CAPTURE && (endSingle & getKnightSquares(startSq));
+        case BISHOPS:
+            return getFlags(m) == MOVE_CAPTURE && (endSingle & getBishopSquares(startSq, occ));
+        case ROOKS:
+            return getFlags(m) == MOVE_CAPTURE && (endSingle & getRookSquares(startSq, occ));
+        case QUEENS:
+            return getFlags(m) == MOVE_CAPTURE && (endSingle & getQueenSquares(startSq, occ));
+        default:
+            return getFlags(m) == MOVE_CAPTURE && (endSingle & getKingSquares(startSq));
+    }
+}
+
+// A stricter check for killers and counter moves, which come from other
+// positions: the piece on the start square must be able to make the quiet move
+// with exactly the flags it has.
+bool Board::isPseudoLegalQuiet(Move m, int color) const {
+    int startSq = getStartSq(m);
     uint64_t endSingle = indexToBit(getEndSq(m));
-    bool captureRoutes = (isCapture(m) && (otherPieces & endSingle))
-                      || (isCapture(m) && pieceID == PAWNS && (~otherPieces & endSingle));
-    uint64_t empty = ~getOccupancy();
-    if (!(captureRoutes || (!isCapture(m) && (empty & endSingle))))
+    int pieceID = getPieceOnSquare(color, startSq);
+    if (isCapture(m) || pieceID == -1 || (getOccupancy() & endSingle))
         return false;
-    // Check that the king is not captured
-    if (isCapture(m) && ((endSingle & pieces[WHITE][KINGS]) || (endSingle & pieces[BLACK][KINGS])))
+
+    if (isCastle(m)) {
+        MoveList castles;
+        (color == WHITE) ? addCastlesToList<WHITE>(castles)
+                         : addCastlesToList<BLACK>(castles);
+        for (unsigned int i = 0; i < castles.size(); i++) {
+            if (castles.get(i) == m)
+                return true;
+        }
         return false;
+    }
 
-    return doPseudoLegalMove(m, color);
+    uint64_t occ = getOccupancy();
+    switch (pieceID) {
+        case PAWNS: {
+            uint64_t pawn = indexToBit(startSq);
+            if (getFlags(m) == MOVE_DOUBLE_PAWN)
+                return endSingle & ((color == WHITE) ? getWPawnDoubleMoves(pawn)
+                                                     : getBPawnDoubleMoves(pawn));
+            uint64_t finalRank = (color == WHITE) ? RANK_8 : RANK_1;
+            if (isPromotion(m) != (bool) (endSingle & finalRank)
+             || (!isPromotion(m) && getFlags(m) != 0))
+                return false;
+            return endSingle & ((color == WHITE) ? getWPawnSingleMoves(pawn)
+                                                 : getBPawnSingleMoves(pawn));
+        }
+        // Pieces other than pawns have no special quiet moves besides castling
+        case KNIGHTS:
+            return getFlags(m) == 0 && (endSingle & getKnightSquares(startSq));
+        case BISHOPS:
+            return getFlags(m) == 0 && (endSingle & getBishopSquares(startSq, occ));
+        case ROOKS:
+            return getFlags(m) == 0 && (endSingle & getRookSquares(startSq, occ));
+        case QUEENS:
+            return getFlags(m) == 0 && (endSingle & getQueenSquares(startSq, occ));
+        default:
+            return getFlags(m) == 0 && (endSingle & getKingSquares(startSq));
+    }
 }
 
 // Handle null moves for null move pruning by switching the player to move.
@@ -447,19 +828,43 @@ PieceMoveList Board::getPieceMoveList(int color) const {
 // Get all legal moves and captures
 MoveList Board::getAllLegalMoves(int color) const {
     MoveList moves;
-    getAllPseudoLegalMoves(moves, color);
-
-    for (unsigned int i = 0; i < moves.size(); i++) {
-        Board b = staticCopy();
-        b.doMove(moves.get(i), color);
+    getLegalMoves(moves, color);
+    return moves;
+}
 
-        if (b.isInCheck(color)) {
-            moves.remove(i);
-            i--;
-        }
+//---------------------------------Legal Moves----------------------------------
+/* The legal move generators find the checkers and pinned pieces once, then
+ * restrict the destination bitboard of every piece with them, so a move that
+ * leaves the king in check is never added to the list. Moves come out in the
+ * same order as from the corresponding pseudo-legal generators.
+ */
+void Board::getLegalMoves(MoveList &moves, int color) const {
+    LegalMoveMasks masks;
+    getLegalMoveMasks(color, masks);
+    if (masks.checkers) {
+        addLegalCheckEscapesToList(moves, color, masks);
+        return;
     }
 
-    return moves;
+    addLegalKingMovesToList<MOVEGEN_CAPTURES>(moves, color);
+    (color == WHITE) ? addLegalPawnCapturesToList<WHITE>(moves, masks)
+                     : addLegalPawnCapturesToList<BLACK>(moves, masks);
+    addLegalPieceMovesToList<MOVEGEN_CAPTURES>(moves, color, masks);
+
+    (color == WHITE) ? addLegalCastlesToList<WHITE>(moves)
+                     : addLegalCastlesToList<BLACK>(moves);
+    addLegalPieceMovesToList<MOVEGEN_QUIETS>(moves, color, masks);
+    (color == WHITE) ? addLegalPawnMovesToList<WHITE>(moves, masks)
+                     : addLegalPawnMovesToList<BLACK>(moves, masks);
+    addLegalKingMovesToList<MOVEGEN_QUIETS>(moves, color);
+}
+
+// Generate all legal moves out of check. This can only be used if we know the
+// side to move is in check.
+void Board::getLegalCheckEscapes(MoveList &escapes, int color) const {
+    LegalMoveMasks masks;
+    getLegalMoveMasks(color, masks);
+    addLegalCheckEscapesToList(escapes, color, masks);
 }
 
 //------------------------------Pseudo-legal Moves------------------------------
@@ -485,11 +890,13 @@ void Board::getAllPseudoLegalMoves(MoveList &legalMoves, int color) const {
  * King moves
  */
 void Board::getPseudoLegalQuiets(MoveList &quiets, int color) const {
-    addCastlesToList(quiets, color);
+    (color == WHITE) ? addCastlesToList<WHITE>(quiets)
+                     : addCastlesToList<BLACK>(quiets);
 
     addPieceMovesToList<MOVEGEN_QUIETS>(quiets, color);
 
-    addPawnMovesToList(quiets, color);
+    (color == WHITE) ? addPawnMovesToList<WHITE>(quiets)
+                     : addPawnMovesToList<BLACK>(quiets);
 
     uint64_t kingMoves = getKingSquares(kingSqs[color]);
     addMovesToList<MOVEGEN_QUIETS>(quiets, kingSqs[color], kingMoves);
@@ -511,7 +918,8 @@ void Board::getPseudoLegalCaptures(MoveList &captures, int color, bool includePr
     uint64_t kingMoves = getKingSquares(kingSqs[color]);
     addMovesToList<MOVEGEN_CAPTURES>(captures, kingSqs[color], kingMoves, otherPieces);
 
-    addPawnCapturesToList(captures, color, otherPieces, includePromotions);
+    (color == WHITE) ? addPawnCapturesToList<WHITE>(captures, otherPieces, includePromotions)
+                     : addPawnCapturesToList<BLACK>(captures, otherPieces, includePromotions);
 
     addPieceMovesToList<MOVEGEN_CAPTURES>(captures, color, otherPieces);
 }
@@ -722,7 +1130,8 @@ void Board::getPseudoLegalCheckEscapes(MoveList &escapes, int color) const {
         return;
     }
 
-    addPawnCapturesToList(escapes, color, otherPieces, true);
+    (color == WHITE) ? addPawnCapturesToList<WHITE>(escapes, otherPieces, true)
+                     : addPawnCapturesToList<BLACK>(escapes, otherPieces, true);
 
     uint64_t occ = getOccupancy();
     // If bishops, rooks, or queens, get bitboard of attack path so we
@@ -742,7 +1151,8 @@ void Board::getPseudoLegalCheckEscapes(MoveList &escapes, int color) const {
     uint64_t kingMoves = getKingSquares(kingSqs[color]);
     addMovesToList<MOVEGEN_CAPTURES>(escapes, kingSqs[color], kingMoves, allPieces[color^1]);
 
-    addPawnMovesToList(escapes, color);
+    (color == WHITE) ? addPawnMovesToList<WHITE>(escapes)
+                     : addPawnMovesToList<BLACK>(escapes);
     uint64_t knights = pieces[color][KNIGHTS];
     while (knights) {
         int stSq = bitScanForward(knights);
@@ -787,7 +1197,8 @@ void Board::getPseudoLegalCheckEscapes(MoveList &escapes, int color) const {
 //------------------------------------------------------------------------------
 // We can do pawns in parallel, since the start square of a pawn move is
 // determined by its end square.
-void Board::addPawnMovesToList(MoveList &quiets, int color) const {
+template <int color>
+void Board::addPawnMovesToList(MoveList &quiets) const {
     uint64_t pawns = pieces[color][PAWNS];
     uint64_t finalRank = (color == WHITE) ? RANK_8 : RANK_1;
     int sqDiff = (color == WHITE) ? -8 : 8;
@@ -825,7 +1236,8 @@ void Board::addPawnMovesToList(MoveList &quiets, int color) const {
 // For pawn captures, we can use a similar approach, but we must consider
 // left-hand and right-hand captures separately so we can tell which
 // pawn is doing the capturing.
-void Board::addPawnCapturesToList(MoveList &captures, int color, uint64_t otherPieces, bool includePromotions) const {
+template <int color>
+void Board::addPawnCapturesToList(MoveList &captures, uint64_t otherPieces, bool includePromotions) const {
     uint64_t pawns = pieces[color][PAWNS];
     uint64_t finalRank = (color == WHITE) ? RANK_8 : RANK_1;
     int leftDiff = (color == WHITE) ? -7 : 9;
@@ -975,7 +1387,8 @@ void Board::addPromotionsToList(MoveList &moves, int stSq, int endSq) const {
     moves.add(mb);
 }
 
-void Board::addCastlesToList(MoveList &moves, int color) const {
+template <int color>
+void Board::addCastlesToList(MoveList &moves) const {
     // Add all possible castles
     if (color == WHITE) {
         // If castling rights still exist, squares in between king and rook are
@@ -1023,6 +1436,233 @@ void Board::addCastlesToList(MoveList &moves, int color) const {
 }
 
 
+//------------------------------------------------------------------------------
+//------------------------Legal Move Generation Helpers-------------------------
+//------------------------------------------------------------------------------
+// The destination squares that keep the king safe for a non-king piece
+inline uint64_t legalEndSqs(const LegalMoveMasks &masks, int stSq) {
+    return (masks.pinned & indexToBit(stSq)) ? (masks.targets & masks.pinRays[stSq])
+                                             : masks.targets;
+}
+
+void Board::getLegalMoveMasks(int color, LegalMoveMasks &masks) const {
+    int kingSq = kingSqs[color];
+    masks.checkers = getAttackMap(color^1, kingSq);
+    // In double check only the king can move
+    if (masks.checkers == 0)
+        masks.targets = ~0ULL;
+    else if (count(masks.checkers) == 1)
+        masks.targets = masks.checkers | inBetweenSqs[kingSq][bitScanForward(masks.checkers)];
+    else
+        masks.targets = 0;
+
+    // Pinners are found the same way as in getPinnedMap(), but the ray of
+    // each pin is kept as well
+    uint64_t blockers = allPieces[color];
+    uint64_t occ = getOccupancy();
+    uint64_t pinners = (getRookXRays(kingSq, occ, blockers)
+                        & (pieces[color^1][ROOKS] | pieces[color^1][QUEENS]))
+                     | (getBishopXRays(kingSq, occ, blockers)
+                        & (pieces[color^1][BISHOPS] | pieces[color^1][QUEENS]));
+    masks.pinned = 0;
+    while (pinners) {
+        int sq = bitScanForward(pinners);
+        pinners &= pinners - 1;
+        int pinnedSq = bitScanForward(inBetweenSqs[sq][kingSq] & blockers);
+        masks.pinned |= indexToBit(pinnedSq);
+        masks.pinRays[pinnedSq] = inBetweenSqs[sq][kingSq] | indexToBit(sq);
+    }
+}
+
+// Check escapes are generated in the same order as getPseudoLegalCheckEscapes()
+void Board::addLegalCheckEscapesToList(MoveList &escapes, int color, const LegalMoveMasks &masks) const {
+    if (masks.targets == 0) {
+        addLegalKingMovesToList<MOVEGEN_CAPTURES>(escapes, color);
+        addLegalKingMovesToList<MOVEGEN_QUIETS>(escapes, color);
+        return;
+    }
+
+    (color == WHITE) ? addLegalPawnCapturesToList<WHITE>(escapes, masks)
+                     : addLegalPawnCapturesToList<BLACK>(escapes, masks);
+    addLegalPieceMovesToList<MOVEGEN_CAPTURES>(escapes, color, masks);
+    addLegalKingMovesToList<MOVEGEN_CAPTURES>(escapes, color);
+
+    // Quiet moves can only block a slider
+    (color == WHITE) ? addLegalPawnMovesToList<WHITE>(escapes, masks)
+                     : addLegalPawnMovesToList<BLACK>(escapes, masks);
+    addLegalPieceMovesToList<MOVEGEN_QUIETS>(escapes, color, masks);
+    addLegalKingMovesToList<MOVEGEN_QUIETS>(escapes, color);
+}
+
+template <int color>
+void Board::addLegalPawnMovesToList(MoveList &quiets, const LegalMoveMasks &masks) const {
+    uint64_t pawns = pieces[color][PAWNS];
+    uint64_t finalRank = (color == WHITE) ? RANK_8 : RANK_1;
+    int sqDiff = (color == WHITE) ? -8 : 8;
+
+    uint64_t pLegal = (color == WHITE) ? getWPawnSingleMoves(pawns)
+                                       : getBPawnSingleMoves(pawns);
+    pLegal &= masks.targets;
+    uint64_t promotions = pLegal & finalRank;
+    pLegal ^= promotions;
+
+    while (promotions) {
+        int endSq = bitScanForward(promotions);
+        promotions &= promotions - 1;
+        int stSq = endSq + sqDiff;
+
+        if (legalEndSqs(masks, stSq) & indexToBit(endSq))
+            addPromotionsToList<MOVEGEN_QUIETS>(quiets, stSq, endSq);
+    }
+    while (pLegal) {
+        int endsq = bitScanForward(pLegal);
+        pLegal &= pLegal - 1;
+        if (legalEndSqs(masks, endsq+sqDiff) & indexToBit(endsq))
+            quiets.add(encodeMove(endsq+sqDiff, endsq));
+    }
+
+    pLegal = (color == WHITE) ? getWPawnDoubleMoves(pawns)
+                              : getBPawnDoubleMoves(pawns);
+    pLegal &= masks.targets;
+    while (pLegal) {
+        int endsq = bitScanForward(pLegal);
+        pLegal &= pLegal - 1;
+        if (legalEndSqs(masks, endsq+2*sqDiff) & indexToBit(endsq)) {
+            Move m = encodeMove(endsq+2*sqDiff, endsq);
+            m = setFlags(m, MOVE_DOUBLE_PAWN);
+            quiets.add(m);
+        }
+    }
+}
+
+// Promotions are always included
+template <int color>
+void Board::addLegalPawnCapturesToList(MoveList &captures, const LegalMoveMasks &masks) const {
+    uint64_t pawns = pieces[color][PAWNS];
+    uint64_t victims = allPieces[color^1] & masks.targets;
+    uint64_t finalRank = (color == WHITE) ? RANK_8 : RANK_1;
+    int diffs[2] = {(color == WHITE) ? -7 : 9, (color == WHITE) ? -9 : 7};
+
+    for (int side = 0; side < 2; side++) {
+        int diff = diffs[side];
+        uint64_t legal = (side == 0) ? ((color == WHITE) ? getWPawnLeftCaptures(pawns)
+                                                         : getBPawnLeftCaptures(pawns))
+                                     : ((color == WHITE) ? getWPawnRightCaptures(pawns)
+                                                         : getBPawnRightCaptures(pawns));
+        legal &= victims;
+        uint64_t promotions = legal & finalRank;
+        legal ^= promotions;
+
+        while (promotions) {
+            int endSq = bitScanForward(promotions);
+            promotions &= promotions-1;
+
+            if (legalEndSqs(masks, endSq+diff) & indexToBit(endSq))
+                addPromotionsToList<MOVEGEN_CAPTURES>(captures, endSq+diff, endSq);
+        }
+        while (legal) {
+            int endsq = bitScanForward(legal);
+            legal &= legal-1;
+            if (legalEndSqs(masks, endsq+diff) & indexToBit(endsq)) {
+                Move m = encodeMove(endsq+diff, endsq);
+                m = setCapture(m, true);
+                captures.add(m);
+            }
+        }
+    }
+
+    // En passant removes two pieces from the rank, so it is rare and awkward
+    // enough to just try on a copy
+    if (epCaptureFile != NO_EP_POSSIBLE) {
+        int victimSq = epVictimSquare(color^1, epCaptureFile);
+        int rankDiff = (color == WHITE) ? 8 : -8;
+        MoveList epCaptures;
+        if ((indexToBit(victimSq) << 1) & NOTA & pieces[color][PAWNS])
+            epCaptures.add(setFlags(encodeMove(victimSq+1, victimSq+rankDiff), MOVE_EP));
+        if ((indexToBit(victimSq) >> 1) & NOTH & pieces[color][PAWNS])
+            epCaptures.add(setFlags(encodeMove(victimSq-1, victimSq+rankDiff), MOVE_EP));
+
+        for (unsigned int i = 0; i < epCaptures.size(); i++) {
+            Board copy = staticCopy();
+            if (copy.doPseudoLegalMove(epCaptures.get(i), color))
+                captures.add(epCaptures.get(i));
+        }
+    }
+}
+
+template <bool isCapture>
+void Board::addLegalPieceMovesToList(MoveList &moves, int color, const LegalMoveMasks &masks) const {
+    uint64_t otherPieces = allPieces[color^1];
+    // A pinned knight can never move
+    uint64_t knights = pieces[color][KNIGHTS] & ~masks.pinned;
+    while (knights) {
+        int stSq = bitScanForward(knights);
+        knights &= knights-1;
+        uint64_t nSq = getKnightSquares(stSq);
+
+        addMovesToList<isCapture>(moves, stSq, nSq & masks.targets, otherPieces);
+    }
+
+    uint64_t occ = getOccupancy();
+    uint64_t bishops = pieces[color][BISHOPS];
+    while (bishops) {
+        int stSq = bitScanForward(bishops);
+        bishops &= bishops-1;
+        uint64_t bSq = getBishopSquares(stSq, occ);
+
+        addMovesToList<isCapture>(moves, stSq, bSq & legalEndSqs(masks, stSq), otherPieces);
+    }
+
+    uint64_t rooks = pieces[color][ROOKS];
+    while (rooks) {
+        int stSq = bitScanForward(rooks);
+        rooks &= rooks-1;
+        uint64_t rSq = getRookSquares(stSq, occ);
+
+        addMovesToList<isCapture>(moves, stSq, rSq & legalEndSqs(masks, stSq), otherPieces);
+    }
+
+    uint64_t queens = pieces[color][QUEENS];
+    while (queens) {
+        int stSq = bitScanForward(queens);
+        queens &= queens-1;
+        uint64_t qSq = getQueenSquares(stSq, occ);
+
+        addMovesToList<isCapture>(moves, stSq, qSq & legalEndSqs(masks, stSq), otherPieces);
+    }
+}
+
+// The king cannot move to an attacked square, including along the ray of a
+// slider it is moving away from
+template <bool isCapture>
+void Board::addLegalKingMovesToList(MoveList &moves, int color) const {
+    int kingSq = kingSqs[color];
+    uint64_t occ = getOccupancy() ^ indexToBit(kingSq);
+    uint64_t kingMoves = getKingSquares(kingSq)
+                       & ((isCapture) ? allPieces[color^1] : ~getOccupancy());
+    uint64_t safeSqs = 0;
+    while (kingMoves) {
+        int endSq = bitScanForward(kingMoves);
+        kingMoves &= kingMoves-1;
+        if (!(getAttackMap(endSq, occ) & allPieces[color^1]))
+            safeSqs |= indexToBit(endSq);
+    }
+
+    addMovesToList<isCapture>(moves, kingSq, safeSqs, allPieces[color^1]);
+}
+
+// The pseudo-legal castles have already checked the start and passed through
+// squares, so only the king's destination is left
+template <int color>
+void Board::addLegalCastlesToList(MoveList &moves) const {
+    MoveList castles;
+    addCastlesToList<color>(castles);
+    for (unsigned int i = 0; i < castles.size(); i++) {
+        if (!getAttackMap(color^1, getEndSq(castles.get(i))))
+            moves.add(castles.get(i));
+    }
+}
+
 //------------------------------------------------------------------------------
 //-----------------------Useful bitboard info generators:-----------------------
 //------------------------------attack maps, etc.-------------------------------
@@ -1067,11 +1707,9 @@ uint64_t Board::getAttackMap(int sq, uint64_t occ) const {
 
 // Returns the piece with given color on the given square, if any
 int Board::getPieceOnSquare(int color, int sq) const {
-    uint64_t endSingle = indexToBit(sq);
-    for (int pieceID = 0; pieceID <= 5; pieceID++) {
-        if (pieces[color][pieceID] & endSingle)
-            return pieceID;
-    }
+    // An empty square has a color field of 2, so it never matches
+    if ((mailbox[sq] >> 3) == color)
+        return mailbox[sq] & 7;
     // If used for captures, the default of an empty square indicates an
     // en passant (and hopefully not an error).
     return -1;
@@ -1226,6 +1864,20 @@ bool Board::isInsufficientMaterial() const {
     return false;
 }
 
+// Check whether the difference between this position's Zobrist key and another
+// is made by a single reversible move that is not blocked on the board.
+bool Board::isReversibleMoveKey(uint64_t keyDiff) const {
+    int i = cuckooH1(keyDiff);
+    if (cuckooKeys[i] != keyDiff) {
+        i = cuckooH2(keyDiff);
+        if (cuckooKeys[i] != keyDiff)
+            return false;
+    }
+
+    Move m = cuckooMoves[i];
+    return !(inBetweenSqs[getStartSq(m)][getEndSq(m)] & getOccupancy());
+}
+
 void Board::getCheckMaps(int color, uint64_t *checkMaps) const {
     int kingSq = kingSqs[color];
     uint64_t occ = getOccupancy();
@@ -1403,18 +2055,26 @@ uint64_t Board::getKnightSquares(int single) const {
 
 uint64_t Board::getBishopSquares(int single, uint64_t occ) const {
     uint64_t *attTableLoc = magicBishops[single].table;
+#ifdef USE_PEXT
+    return attTableLoc[_pext_u64(occ, magicBishops[single].mask)];
+#else
     occ &= magicBishops[single].mask;
     occ *= magicBishops[single].magic;
     occ >>= magicBishops[single].shift;
     return attTableLoc[occ];
+#endif
 }
 
 uint64_t Board::getRookSquares(int single, uint64_t occ) const {
     uint64_t *attTableLoc = magicRooks[single].table;
+#ifdef USE_PEXT
+    return attTableLoc[_pext_u64(occ, magicRooks[single].mask)];
+#else
     occ &= magicRooks[single].mask;
     occ *= magicRooks[single].magic;
     occ >>= magicRooks[single].shift;
     return attTableLoc[occ];
+#endif
 }
 
 uint64_t Board::getQueenSquares(int single, uint64_t occ) const {
@@ -1492,21 +2152,7 @@ int Board::getKingSq(int color) const {
 int *Board::getMailbox() const {
     int *result = new int[64];
     for (int i = 0; i < 64; i++) {
-        result[i] = -1;
-    }
-    for (int i = 0; i < 6; i++) {
-        uint64_t bitboard = pieces[WHITE][i];
-        while (bitboard) {
-            result[bitScanForward(bitboard)] = i;
-            bitboard &= bitboard - 1;
-        }
-    }
-    for (int i = 0; i < 6; i++) {
-        uint64_t bitboard = pieces[BLACK][i];
-        while (bitboard) {
-            result[bitScanForward(bitboard)] = 6 + i;
-            bitboard &= bitboard - 1;
-        }
+        result[i] = (mailbox[i] == NO_PIECE) ? -1 : 6 * (mailbox[i] >> 3) + (mailbox[i] & 7);
     }
     return result;
 }
@@ -1515,11 +2161,33 @@ uint64_t Board::getZobristKey() const {
     return zobristKey;
 }
 
-void Board::initZobristKey(int *mailbox) {
+uint64_t Board::getPawnZobristKey() const {
+    return pawnZobristKey;
+}
+
+uint64_t Board::getMaterialKey() const {
+    return materialKey;
+}
+
+Score Board::getPsqtScore(int color) const {
+    return psqtScore[color];
+}
+
+Score Board::getMaterialScore(int color) const {
+    return materialScore[color];
+}
+
+void Board::initZobristKey(int *mailboxBoard) {
     zobristKey = 0;
+    pawnZobristKey = 0;
+    materialKey = 0;
     for (int i = 0; i < 64; i++) {
-        if (mailbox[i] != -1) {
-            zobristKey ^= zobristTable[mailbox[i] * 64 + i];
+        if (mailboxBoard[i] != -1) {
+            zobristKey ^= zobristTable[mailboxBoard[i] * 64 + i];
+            if (mailboxBoard[i] % 6 == PAWNS)
+                pawnZobristKey ^= zobristTable[mailboxBoard[i] * 64 + i];
+            if (mailboxBoard[i] % 6 != KINGS)
+                materialKey += materialKeyUnit(mailboxBoard[i] / 6, mailboxBoard[i] % 6);
         }
     }
     if (playerToMove == BLACK)
@@ -31,6 +31,14 @@ constexpr uint8_t BLACKCASTLE = 0xC;
 
 constexpr uint16_t NO_EP_POSSIBLE = 0x8;
 
+// The material key packs the count of each non-king piece type into 4 bits
+constexpr uint64_t materialKeyUnit(int color, int piece) {
+    return 1ULL << (4 * (5 * color + piece));
+}
+
+// Value of an empty square in the board's mailbox
+constexpr uint8_t NO_PIECE = 16;
+
 constexpr bool MOVEGEN_CAPTURES = true;
 constexpr bool MOVEGEN_QUIETS = false;
 
@@ -68,7 +76,37 @@ struct PieceMoveList {
     PieceMoveInfo get(int i) { return arrayList[i]; }
 };
 
+// The check and pin information a legal move generator needs, computed once
+// per position for the side to move
+struct LegalMoveMasks {
+    // Enemy pieces giving check
+    uint64_t checkers;
+    // Squares a non-king move must land on: everything when not in check,
+    // otherwise the checker and the squares between it and the king
+    uint64_t targets;
+    uint64_t pinned;
+    // For each pinned piece, the squares between its king and pinner,
+    // including the pinner
+    uint64_t pinRays[64];
+};
+
 void initZobristTable();
+void initCuckooTables();
+
+// The state that cannot be recovered from a move when it is unmade. This is
+// filled by makeMove on the caller's stack frame, one record per ply.
+struct UndoInfo {
+    uint64_t zobristKey;
+    uint64_t pawnZobristKey;
+    uint64_t materialKey;
+    Score psqtScore[2];
+    Score materialScore[2];
+    uint16_t epCaptureFile;
+    uint8_t castlingRights;
+    uint8_t fiftyMoveCounter;
+    // The type of the captured piece, or -1 if the move was not a capture
+    int capturedPiece;
+};
 
 
 /**
@@ -87,11 +125,18 @@ public:
     void doMove(Move m, int color);
     bool doPseudoLegalMove(Move m, int color);
     bool doHashMove(Move m, int color);
+    void makeMove(Move m, int color, UndoInfo &undo);
+    bool makePseudoLegalMove(Move m, int color, UndoInfo &undo);
+    void unmakeMove(Move m, int color, const UndoInfo &undo);
+    bool isPseudoLegal(Move m, int color) const;
+    bool isPseudoLegalQuiet(Move m, int color) const;
     void doNullMove();
     void undoNullMove(uint16_t _epCaptureFile);
 
     PieceMoveList getPieceMoveList(int color) const;
     MoveList getAllLegalMoves(int color) const;
+    void getLegalMoves(MoveList &moves, int color) const;
+    void getLegalCheckEscapes(MoveList &escapes, int color) const;
     void getAllPseudoLegalMoves(MoveList &legalMoves, int color) const;
     void getPseudoLegalQuiets(MoveList &quiets, int color) const;
     void getPseudoLegalCaptures(MoveList &captures, int color, bool includePromotions) const;
@@ -113,6 +158,7 @@ public:
     bool isInCheck(int color) const;
     bool isDraw() const;
     bool isInsufficientMaterial() const;
+    bool isReversibleMoveKey(uint64_t keyDiff) const;
     void getCheckMaps(int color, uint64_t *checkMaps) const;
 
     // Useful for turning off some pruning late endgame
@@ -129,6 +175,8 @@ public:
     uint64_t getBPawnCaptures(uint64_t pawns) const;
     uint64_t getKnightSquares(int single) const;
     uint64_t getBishopSquares(int single, uint64_t occ) const;
+    uint64_t getRookSquares(int single, uint64_t occ) const;
+    uint64_t getQueenSquares(int single, uint64_t occ) const;
     uint64_t getKingSquares(int single) const;
 
     // Getter methods
@@ -147,8 +195,13 @@ public:
     int getKingSq(int color) const;
     int *getMailbox() const;
     uint64_t getZobristKey() const;
+    uint64_t getZobristKeyAfter(Move m, int color) const;
+    uint64_t getPawnZobristKey() const;
+    uint64_t getMaterialKey() const;
+    Score getPsqtScore(int color) const;
+    Score getMaterialScore(int color) const;
 
-    void initZobristKey(int *mailbox);
+    void initZobristKey(int *mailboxBoard);
 
 private:
     // Bitboards for all white or all black pieces
@@ -156,8 +209,18 @@ private:
     // 12 bitboards, one for each of the 12 piece types, indexed by the
     // constants given in common.h
     uint64_t pieces[2][6];
+    // The piece on each square, stored as 8 * color + piece, or NO_PIECE
+    uint8_t mailbox[64];
     // Zobrist key for hash table use
     uint64_t zobristKey;
+    // Zobrist key of only the pawns, for the pawn hash table
+    uint64_t pawnZobristKey;
+    // Piece counts, for the material hash table
+    uint64_t materialKey;
+    // Incrementally updated piece square table and material sums, which are
+    // read directly by the evaluation
+    Score psqtScore[2];
+    Score materialScore[2];
     // 8 if cannot en passant, if en passant is possible, the file of the
     // pawn being captured is stored here (0-7)
     uint16_t epCaptureFile;
@@ -177,15 +240,35 @@ private:
     // Precomputed tables
     int kingSqs[2];
 
-    void addPawnMovesToList(MoveList &quiets, int color) const;
-    void addPawnCapturesToList(MoveList &captures, int color, uint64_t otherPieces, bool includePromotions) const;
+    void initIncrementalState();
+    bool checkIncrementalState() const;
+
+    template <int color>
+    void addPawnMovesToList(MoveList &quiets) const;
+    template <int color>
+    void addPawnCapturesToList(MoveList &captures, uint64_t otherPieces, bool includePromotions) const;
     template <bool isCapture>
     void addPieceMovesToList(MoveList &moves, int color, uint64_t otherPieces = 0) const;
     template <bool isCapture>
     void addMovesToList(MoveList &moves, int stSq, uint64_t allEndSqs, uint64_t otherPieces = 0) const;
     template <bool isCapture>
     void addPromotionsToList(MoveList &moves, int stSq, int endSq) const;
-    void addCastlesToList(MoveList &moves, int color) const;
+    template <int color>
+    void addCastlesToList(MoveList &moves) const;
+
+    // Legal move generation helpers
+    void getLegalMoveMasks(int color, LegalMoveMasks &masks) const;
+    void addLegalCheckEscapesToList(MoveList &escapes, int color, const LegalMoveMasks &masks) const;
+    template <int color>
+    void addLegalPawnMovesToList(MoveList &quiets, const LegalMoveMasks &masks) const;
+    template <int color>
+    void addLegalPawnCapturesToList(MoveList &captures, const LegalMoveMasks &masks) const;
+    template <bool isCapture>
+    void addLegalPieceMovesToList(MoveList &moves, int color, const LegalMoveMasks &masks) const;
+    template <bool isCapture>
+    void addLegalKingMovesToList(MoveList &moves, int color) const;
+    template <int color>
+    void addLegalCastlesToList(MoveList &moves) const;
 
     // Move generation
     // Takes into account blocking for sliders, but otherwise leaves
@@ -199,8 +282,6 @@ private:
     uint64_t getBPawnLeftCaptures(uint64_t pawns) const;
     uint64_t getWPawnRightCaptures(uint64_t pawns) const;
     uint64_t getBPawnRightCaptures(uint64_t pawns) const;
-    uint64_t getRookSquares(int single, uint64_t occ) const;
-    uint64_t getQueenSquares(int single, uint64_t occ) const;
     uint64_t getOccupancy() const;
     int epVictimSquare(int victimColor, uint16_t file) const;
 };
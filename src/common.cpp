@@ -17,6 +17,15 @@
 */
 
 #include <cassert>
+#include <cstdlib>
+#include <thread>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include "common.h"
 
@@ -44,6 +53,25 @@ uint64_t getTimeElapsed(ChessTime startTime) {
     return (uint64_t) timeSpan.count() + 1;
 }
 
+void *alignedMalloc(size_t alignment, size_t size) {
+#if defined(_WIN32)
+    return _aligned_malloc(size, alignment);
+#else
+    void *ptr;
+    if (posix_memalign(&ptr, alignment, size))
+        return nullptr;
+    return ptr;
+#endif
+}
+
+void alignedFree(void *ptr) {
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
 std::string moveToString(Move m) {
     char startFile = 'a' + (getStartSq(m) & 7);
     char startRank = '1' + (getStartSq(m) >> 3);
@@ -53,3 +81,18 @@ std::string moveToString(Move m) {
     if (getPromotion(m)) moveStr += " nbrq"[getPromotion(m)];
     return moveStr;
 }
+
+// Binds the calling thread to a single logical CPU, chosen by thread ID
+void pinToCPU(int threadID) {
+#ifdef __linux__
+    int numCPUs = (int) std::thread::hardware_concurrency();
+    if (numCPUs <= 0)
+        return;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(threadID % numCPUs, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+#else
+    (void) threadID;
+#endif
+}
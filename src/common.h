@@ -19,6 +19,7 @@
 #ifndef __COMMON_H__
 #define __COMMON_H__
 
+#include <cstddef>
 #include <cstdint>
 #include <chrono>
 #include <string>
@@ -46,6 +47,13 @@ typedef std::chrono::high_resolution_clock::time_point ChessTime;
 
 uint64_t getTimeElapsed(ChessTime startTime);
 
+// Memory allocation aligned to the given power of two, such as a cache line
+void *alignedMalloc(size_t alignment, size_t size);
+void alignedFree(void *ptr);
+
+// Binds the calling thread to a logical CPU, the same one for the same ID
+void pinToCPU(int threadID);
+
 // Bitboard methods
 int bitScanForward(uint64_t bb);
 int bitScanReverse(uint64_t bb);
@@ -74,6 +82,7 @@ typedef uint16_t Move;
 
 constexpr Move NULL_MOVE = 0;
 constexpr uint16_t MOVE_DOUBLE_PAWN = 0x1;
+constexpr uint16_t MOVE_CAPTURE = 0x4;
 constexpr uint16_t MOVE_EP = 0x5;
 constexpr uint16_t MOVE_PROMO_N = 0x8;
 constexpr uint16_t MOVE_PROMO_B = 0x9;
@@ -186,4 +195,8 @@ public:
 typedef SearchArrayList<Move> MoveList;
 typedef SearchArrayList<int16_t> ScoreList;
 
+// Eval scores are packed into an unsigned 32-bit integer during calculations
+// (the SWAR technique)
+typedef uint32_t Score;
+
 #endif
\ No newline at end of file
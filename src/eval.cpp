@@ -26,6 +26,9 @@
 #include "eval.h"
 #include "uci.h"
 
+// Piece square tables, also used by Board to keep incremental sums
+Score PSQT[2][6][64];
+
 namespace {
 
 constexpr uint64_t KING_ZONE_DEFENDER[2] = {HALF[WHITE] | RANK_5, RANK_4 | HALF[BLACK]};
@@ -37,7 +40,6 @@ constexpr uint64_t KING_DEFENSE_ZONE[8] = {
     FILE_D | FILE_E, KSIDE ^ FILE_E, KSIDE ^ FILE_E, KSIDE ^ FILE_E
 };
 
-Score PSQT[2][6][64];
 Score MOBILITY[5][28];
 char manhattanDistance[64][64], kingDistance[64][64];
 
@@ -193,75 +195,82 @@ void setKingSafetyScale(int s) {
 }
 
 
+Eval::Eval() {
+    pawnHash = new PawnHashEntry[PAWN_HASH_SIZE];
+    // Give each entry a key that cannot index to its own slot, so that empty
+    // entries never produce a hit
+    for (int i = 0; i < PAWN_HASH_SIZE; i++)
+        pawnHash[i].pawnKey = ~((uint64_t) i);
+
+    materialHash = new MaterialHashEntry[MATERIAL_HASH_SIZE];
+    // A key with all counts set to 15 cannot occur in a real position
+    for (int i = 0; i < MATERIAL_HASH_SIZE; i++)
+        materialHash[i].materialKey = ~0ULL;
+}
+
+Eval::~Eval() {
+    delete[] pawnHash;
+    delete[] materialHash;
+}
+
 /*
  * Evaluates the current board position in hundredths of pawns. White is
  * positive and black is negative in traditional negamax format.
  */
 template <bool debug>
 int Eval::evaluate(Board &b) {
-    int material[2][2] = {{0, 0}, {0, 0}};
-    int egFactorMaterial = 0;
-    // Copy necessary values from Board and precompute the number of each piece on the board as well as material totals
+    bool isExact;
+    return evaluate<debug, false>(b, -INFTY, INFTY, isExact);
+}
+
+/*
+ * A lazy evaluation for the search. If material, piece square tables and the
+ * cached pawn structure put the score more than LAZY_EVAL_MARGIN outside the
+ * window (alpha, beta), given from white's point of view, that partial score
+ * is returned and isExact is set to false.
+ */
+int Eval::evaluate(Board &b, int alpha, int beta, bool &isExact) {
+    return evaluate<false, true>(b, alpha, beta, isExact);
+}
+
+template <bool debug, bool lazy>
+int Eval::evaluate(Board &b, int alpha, int beta, bool &isExact) {
+    isExact = true;
+    // Copy necessary values from Board
     for (int color = WHITE; color <= BLACK; color++) {
-        for (int pieceID = PAWNS; pieceID <= KINGS; pieceID++) {
+        for (int pieceID = PAWNS; pieceID <= KINGS; pieceID++)
             pieces[color][pieceID] = b.getPieces(color, pieceID);
-            pieceCounts[color][pieceID] = count(pieces[color][pieceID]);
-            if (pieceID != KINGS) {
-                material[MG][color] += PIECE_VALUES[MG][pieceID] * pieceCounts[color][pieceID];
-                material[EG][color] += PIECE_VALUES[EG][pieceID] * pieceCounts[color][pieceID];
-                egFactorMaterial += EG_FACTOR_PIECE_VALS[pieceID] * pieceCounts[color][pieceID];
-            }
-        }
     }
     allPieces[WHITE] = b.getAllPieces(WHITE);
     allPieces[BLACK] = b.getAllPieces(BLACK);
     playerToMove = b.getPlayerToMove();
     int kingSq[2] = {b.getKingSq(WHITE), b.getKingSq(BLACK)};
 
-    // Compute endgame factor which is between 0 and EG_FACTOR_RES, inclusive
-    int egFactor = EG_FACTOR_RES - (egFactorMaterial - EG_FACTOR_ALPHA) * EG_FACTOR_RES / EG_FACTOR_BETA;
-    egFactor = std::max(0, std::min(EG_FACTOR_RES, egFactor));
+    // Piece counts and the endgame factor depend only on the material
+    // signature, so they come from the material hash table. Material totals
+    // are kept incrementally by the board.
+    MaterialHashEntry *materialEntry = probeMaterialHash(b.getMaterialKey());
+    pieceCounts = materialEntry->pieceCounts;
+    int material[2][2] = {{decEvalMg(b.getMaterialScore(WHITE)), decEvalMg(b.getMaterialScore(BLACK))},
+                          {decEvalEg(b.getMaterialScore(WHITE)), decEvalEg(b.getMaterialScore(BLACK))}};
+    int egFactor = materialEntry->egFactor;
 
     // Check for special endgames
-    if (egFactor == EG_FACTOR_RES) {
-        int endgameScore = checkEndgameCases();
-        if (endgameScore != -INFTY)
-            return endgameScore;
-    }
-
-    // Precompute eval info, such as attack maps
-    PieceMoveList pmlWhite = b.getPieceMoveList(WHITE);
-    PieceMoveList pmlBlack = b.getPieceMoveList(BLACK);
+    if (materialEntry->endgameFunction != nullptr)
+        return (this->*(materialEntry->endgameFunction))();
 
     ei.clear();
 
-    // Get the overall attack maps
+    // Pawn attacks are also needed for the pawn hash table
     ei.attackMaps[WHITE][PAWNS] = b.getWPawnCaptures(pieces[WHITE][PAWNS]);
     ei.attackMaps[BLACK][PAWNS] = b.getBPawnCaptures(pieces[BLACK][PAWNS]);
-    for (unsigned int i = 0; i < pmlWhite.size(); i++) {
-        uint64_t legal = pmlWhite.get(i).legal;
-        ei.doubleAttackMaps[WHITE] |= legal & (ei.fullAttackMaps[WHITE] | ei.attackMaps[WHITE][PAWNS]);
-        ei.attackMaps[WHITE][pmlWhite.get(i).pieceID] |= legal;
-        ei.fullAttackMaps[WHITE] |= legal;
-    }
-    for (unsigned int i = 0; i < pmlBlack.size(); i++) {
-        uint64_t legal = pmlBlack.get(i).legal;
-        ei.doubleAttackMaps[BLACK] |= legal & (ei.fullAttackMaps[BLACK] | ei.attackMaps[BLACK][PAWNS]);
-        ei.attackMaps[BLACK][pmlBlack.get(i).pieceID] |= legal;
-        ei.fullAttackMaps[BLACK] |= legal;
-    }
 
     ei.rammedPawns[WHITE] = pieces[WHITE][PAWNS] & (pieces[BLACK][PAWNS] >> 8);
     ei.rammedPawns[BLACK] = pieces[BLACK][PAWNS] & (pieces[WHITE][PAWNS] << 8);
 
-    uint64_t openFiles = pieces[WHITE][PAWNS] | pieces[BLACK][PAWNS];
-    openFiles |= openFiles >> 8;
-    openFiles |= openFiles >> 16;
-    openFiles |= openFiles >> 32;
-    openFiles |= openFiles << 8;
-    openFiles |= openFiles << 16;
-    openFiles |= openFiles << 32;
-    ei.openFiles = ~openFiles;
+    // Get pawn structure information from the pawn hash table
+    PawnHashEntry *pawnEntry = probePawnHash(b.getPawnZobristKey());
+    ei.openFiles = pawnEntry->openFiles;
 
 
     //---------------------------Material terms---------------------------------
@@ -294,19 +303,7 @@ int Eval::evaluate(Board &b) {
 
 
     // Material imbalance evaluation
-    int imbalanceValue[2] = {0, 0};
-
-    // Own-opp imbalance terms
-    // Gain OWN_OPP_IMBALANCE[][ownID][oppID] centipawns for each ownID piece
-    // you have and each oppID piece the opponent has
-    for (int ownID = KNIGHTS; ownID <= QUEENS; ownID++) {
-        for (int oppID = PAWNS; oppID < ownID; oppID++) {
-            imbalanceValue[MG] += OWN_OPP_IMBALANCE[MG][ownID][oppID] * pieceCounts[WHITE][ownID] * pieceCounts[BLACK][oppID];
-            imbalanceValue[EG] += OWN_OPP_IMBALANCE[EG][ownID][oppID] * pieceCounts[WHITE][ownID] * pieceCounts[BLACK][oppID];
-            imbalanceValue[MG] -= OWN_OPP_IMBALANCE[MG][ownID][oppID] * pieceCounts[BLACK][ownID] * pieceCounts[WHITE][oppID];
-            imbalanceValue[EG] -= OWN_OPP_IMBALANCE[EG][ownID][oppID] * pieceCounts[BLACK][ownID] * pieceCounts[WHITE][oppID];
-        }
-    }
+    const int *imbalanceValue = materialEntry->imbalance;
 
     valueMg += imbalanceValue[MG] * scaleMaterial / DEFAULT_EVAL_SCALE;
     valueEg += imbalanceValue[EG] * scaleMaterial / DEFAULT_EVAL_SCALE;
@@ -325,18 +322,45 @@ int Eval::evaluate(Board &b) {
 
 
     //----------------------------Positional terms------------------------------
-    // Pawn piece square tables
-    Score psqtScores[2] = {EVAL_ZERO, EVAL_ZERO};
-    for (int color = WHITE; color <= BLACK; color++) {
-        uint64_t bitboard = pieces[color][PAWNS];
-        while (bitboard) {
-            int sq = bitScanForward(bitboard);
-            bitboard &= bitboard - 1;
-            psqtScores[color] += PSQT[color][PAWNS][sq];
+    // Piece square tables, kept incrementally by the board
+    Score psqtScores[2] = {b.getPsqtScore(WHITE), b.getPsqtScore(BLACK)};
+
+
+    //------------------------------Lazy exit-----------------------------------
+    // Everything so far is cheap. The remaining terms need attack maps, so
+    // skip them if the score is already far outside the window.
+    if (lazy) {
+        int partialMg = valueMg + decEvalMg(psqtScores[WHITE]) - decEvalMg(psqtScores[BLACK])
+                      + decEvalMg(pawnEntry->score[WHITE]) - decEvalMg(pawnEntry->score[BLACK]);
+        int partialEg = valueEg + decEvalEg(psqtScores[WHITE]) - decEvalEg(psqtScores[BLACK])
+                      + decEvalEg(pawnEntry->score[WHITE]) - decEvalEg(pawnEntry->score[BLACK]);
+        int partialEval = (partialMg * (EG_FACTOR_RES - egFactor) + partialEg * egFactor) / EG_FACTOR_RES;
+        if (partialEval - LAZY_EVAL_MARGIN >= beta || partialEval + LAZY_EVAL_MARGIN <= alpha) {
+            isExact = false;
+            return partialEval;
         }
     }
 
 
+    // Precompute eval info, such as attack maps
+    PieceMoveList pmlWhite = b.getPieceMoveList(WHITE);
+    PieceMoveList pmlBlack = b.getPieceMoveList(BLACK);
+
+    // Get the overall attack maps
+    for (unsigned int i = 0; i < pmlWhite.size(); i++) {
+        uint64_t legal = pmlWhite.get(i).legal;
+        ei.doubleAttackMaps[WHITE] |= legal & (ei.fullAttackMaps[WHITE] | ei.attackMaps[WHITE][PAWNS]);
+        ei.attackMaps[WHITE][pmlWhite.get(i).pieceID] |= legal;
+        ei.fullAttackMaps[WHITE] |= legal;
+    }
+    for (unsigned int i = 0; i < pmlBlack.size(); i++) {
+        uint64_t legal = pmlBlack.get(i).legal;
+        ei.doubleAttackMaps[BLACK] |= legal & (ei.fullAttackMaps[BLACK] | ei.attackMaps[BLACK][PAWNS]);
+        ei.attackMaps[BLACK][pmlBlack.get(i).pieceID] |= legal;
+        ei.fullAttackMaps[BLACK] |= legal;
+    }
+
+
     //--------------------------------Space-------------------------------------
     uint64_t allPawns = pieces[WHITE][PAWNS] | pieces[BLACK][PAWNS];
     int openFileCount = count(ei.openFiles & 0xFF);
@@ -383,10 +407,6 @@ int Eval::evaluate(Board &b) {
     uint64_t kingNeighborhood[2] = {b.getKingSquares(kingSq[WHITE]),
                                     b.getKingSquares(kingSq[BLACK])};
 
-    // Calculate king piece square table scores
-    psqtScores[WHITE] += PSQT[WHITE][KINGS][kingSq[WHITE]];
-    psqtScores[BLACK] += PSQT[BLACK][KINGS][kingSq[BLACK]];
-
     int ksValue[2] = {0, 0};
 
     // All king safety terms are midgame only, so don't calculate them in the endgame
@@ -453,16 +473,8 @@ int Eval::evaluate(Board &b) {
 
 
     // Get all squares attackable by pawns in the future
-    // Used for outposts and backwards pawns
-    uint64_t wPawnFrontSpan = pieces[WHITE][PAWNS] << 8;
-    uint64_t bPawnFrontSpan = pieces[BLACK][PAWNS] >> 8;
-    for (int i = 0; i < 5; i++) {
-        wPawnFrontSpan |= wPawnFrontSpan << 8;
-        bPawnFrontSpan |= bPawnFrontSpan >> 8;
-    }
-    uint64_t pawnStopAtt[2];
-    pawnStopAtt[WHITE] = ((wPawnFrontSpan >> 1) & NOTH) | ((wPawnFrontSpan << 1) & NOTA);
-    pawnStopAtt[BLACK] = ((bPawnFrontSpan >> 1) & NOTH) | ((bPawnFrontSpan << 1) & NOTA);
+    // Used for outposts
+    const uint64_t *pawnStopAtt = pawnEntry->pawnStopAtt;
 
 
     //-------------------------Minor Pieces and Mobility------------------------
@@ -522,7 +534,6 @@ int Eval::evaluate(Board &b) {
             uint64_t bit = indexToBit(knightSq);
             uint64_t mobilityMap = pml.get(i).legal & mobilitySafeSqs;
 
-            psqtScores[color] += PSQT[color][KNIGHTS][knightSq];
             mobilityScore[color] += MOBILITY[KNIGHTS-1][count(mobilityMap)]
                                  + EXTENDED_CENTER_VAL * count(mobilityMap & EXTENDED_CENTER_SQS)
                                  + CENTER_BONUS * count(mobilityMap & CENTER_SQS);
@@ -547,7 +558,6 @@ int Eval::evaluate(Board &b) {
             uint64_t bit = indexToBit(bishopSq);
             uint64_t mobilityMap = pml.get(i).legal & mobilitySafeSqs;
 
-            psqtScores[color] += PSQT[color][BISHOPS][bishopSq];
             mobilityScore[color] += MOBILITY[BISHOPS-1][count(mobilityMap)]
                                  + EXTENDED_CENTER_VAL * count(mobilityMap & EXTENDED_CENTER_SQS)
                                  + CENTER_BONUS * count(mobilityMap & CENTER_SQS);
@@ -577,7 +587,6 @@ int Eval::evaluate(Board &b) {
             int rank = rookSq >> 3;
             uint64_t mobilityMap = pml.get(i).legal & mobilitySafeSqs;
 
-            psqtScores[color] += PSQT[color][ROOKS][rookSq];
             mobilityScore[color] += MOBILITY[ROOKS-1][count(mobilityMap)]
                                  + EXTENDED_CENTER_VAL * count(mobilityMap & EXTENDED_CENTER_SQS)
                                  + CENTER_BONUS * count(mobilityMap & CENTER_SQS);
@@ -599,7 +608,6 @@ int Eval::evaluate(Board &b) {
             int queenSq = pml.get(i).startSq;
             uint64_t mobilityMap = pml.get(i).legal & mobilitySafeSqs & queenMobilitySafeSqs;
 
-            psqtScores[color] += PSQT[color][QUEENS][queenSq];
             mobilityScore[color] += MOBILITY[QUEENS-1][count(mobilityMap)];
 
             // Penalty if an enemy knight can safely threaten our queen on the next move
@@ -681,36 +689,20 @@ int Eval::evaluate(Board &b) {
 
 
     //----------------------------Pawn structure--------------------------------
-    Score whitePawnScore = EVAL_ZERO, blackPawnScore = EVAL_ZERO;
+    // Pawn-only terms come from the pawn hash table. Penalties for pawns on
+    // semi-open files only apply when the opponent has major pieces.
+    Score whitePawnScore = pawnEntry->score[WHITE], blackPawnScore = pawnEntry->score[BLACK];
+    if (pieces[BLACK][QUEENS] | pieces[BLACK][ROOKS])
+        whitePawnScore += pawnEntry->semiopenScore[WHITE];
+    if (pieces[WHITE][QUEENS] | pieces[WHITE][ROOKS])
+        blackPawnScore += pawnEntry->semiopenScore[BLACK];
 
     // Passed pawns
-    uint64_t wPassedBlocker = pieces[BLACK][PAWNS] >> 8;
-    uint64_t bPassedBlocker = pieces[WHITE][PAWNS] << 8;
-    // If opposing pawns are on the same or an adjacent file on a pawn's front
-    // span, then the pawn is not passed
-    wPassedBlocker |= ((wPassedBlocker >> 1) & NOTH) | ((wPassedBlocker << 1) & NOTA);
-    bPassedBlocker |= ((bPassedBlocker >> 1) & NOTH) | ((bPassedBlocker << 1) & NOTA);
-    // Include own pawns as blockers to prevent doubled pawns from both being
-    // scored as passers
-    wPassedBlocker |= (pieces[WHITE][PAWNS] >> 8);
-    bPassedBlocker |= (pieces[BLACK][PAWNS] << 8);
-    // Find opposing pawn front spans
-    for(int i = 0; i < 4; i++) {
-        wPassedBlocker |= (wPassedBlocker >> 8);
-        bPassedBlocker |= (bPassedBlocker << 8);
-    }
-    // Passers are pawns outside the opposing pawn front span
-    uint64_t wPassedPawns = pieces[WHITE][PAWNS] & ~wPassedBlocker;
-    uint64_t bPassedPawns = pieces[BLACK][PAWNS] & ~bPassedBlocker;
-
-    uint64_t wPasserTemp = wPassedPawns;
+    uint64_t wPasserTemp = pawnEntry->passedPawns[WHITE];
     while (wPasserTemp) {
         int passerSq = bitScanForward(wPasserTemp);
         wPasserTemp &= wPasserTemp - 1;
-        int file = passerSq & 7;
         int rank = passerSq >> 3;
-        whitePawnScore += PASSER_BONUS[rank];
-        whitePawnScore += PASSER_FILE_BONUS[file];
 
         // Non-linear bonus based on rank
         int rFactor = (rank-1) * (rank-2) / 2;
@@ -753,14 +745,11 @@ int Eval::evaluate(Board &b) {
             whitePawnScore += OPP_KING_DIST * (int) kingDistance[passerSq+8][kingSq[BLACK]] * rFactor;
         }
     }
-    uint64_t bPasserTemp = bPassedPawns;
+    uint64_t bPasserTemp = pawnEntry->passedPawns[BLACK];
     while (bPasserTemp) {
         int passerSq = bitScanForward(bPasserTemp);
         bPasserTemp &= bPasserTemp - 1;
-        int file = passerSq & 7;
         int rank = 7 - (passerSq >> 3);
-        blackPawnScore += PASSER_BONUS[rank];
-        blackPawnScore += PASSER_FILE_BONUS[file];
 
         int rFactor = (rank-1) * (rank-2) / 2;
         if (rFactor) {
@@ -796,6 +785,186 @@ int Eval::evaluate(Board &b) {
         }
     }
 
+    
+    valueMg += decEvalMg(whitePawnScore) - decEvalMg(blackPawnScore);
+    valueEg += decEvalEg(whitePawnScore) - decEvalEg(blackPawnScore);
+
+    if (debug) {
+        evalDebugStats.whitePawnScore = whitePawnScore;
+        evalDebugStats.blackPawnScore = blackPawnScore;
+    }
+
+
+    // King-pawn tropism
+    int kingPawnTropism = 0;
+    if (egFactor > 0) {
+        uint64_t pawnBits = pieces[WHITE][PAWNS] | pieces[BLACK][PAWNS];
+        int pawnWeight = 0;
+
+        int wTropismTotal = 0, bTropismTotal = 0;
+        while (pawnBits) {
+            int pawnSq = bitScanForward(pawnBits);
+            pawnBits &= pawnBits - 1;
+
+            wTropismTotal += (int)manhattanDistance[pawnSq][kingSq[WHITE]];
+            bTropismTotal += (int)manhattanDistance[pawnSq][kingSq[BLACK]];
+            pawnWeight++;
+        }
+
+        if (pawnWeight)
+            kingPawnTropism = (bTropismTotal - wTropismTotal) / pawnWeight;
+
+        valueEg += KING_TROPISM_VALUE * kingPawnTropism;
+    }
+
+
+    // Adjust endgame eval based on the probability of converting the advantage to a win
+    if (egFactor > 0) {
+        // Asymmetry: greater asymmetry means less locked position, more potential passers
+        int pawnAsymmetry = pawnEntry->pawnAsymmetry;
+        // King opposition distance: when kings are farther apart by file, there is a
+        // lower chance of the defending king keeping the attacking king from penetrating
+        int oppositionDistance = std::abs((kingSq[WHITE] & 7)  - (kingSq[BLACK] & 7))
+                               - std::abs((kingSq[WHITE] >> 3) - (kingSq[BLACK] >> 3));
+
+        int egWinAdjustment = PAWN_ASYMMETRY_BONUS * pawnAsymmetry
+                            + PAWN_COUNT_BONUS * (pieceCounts[WHITE][PAWNS] + pieceCounts[BLACK][PAWNS])
+                            + KING_OPPOSITION_DISTANCE_BONUS * oppositionDistance
+                            + ENDGAME_BASE;
+        // Cap the penalty at reducing to a score of 0
+        if (valueEg > 0)
+            valueEg = std::max(0, valueEg + egWinAdjustment);
+        else if (valueEg < 0)
+            valueEg = std::min(0, valueEg - egWinAdjustment);
+    }
+
+
+    if (debug) {
+        evalDebugStats.totalMg = valueMg;
+        evalDebugStats.totalEg = valueEg;
+    }
+
+    int totalEval = (valueMg * (EG_FACTOR_RES - egFactor) + valueEg * egFactor) / EG_FACTOR_RES;
+
+    // Scale factors
+    int scaleFactor = MAX_SCALE_FACTOR;
+    // Opposite colored bishops
+    if (egFactor > 3 * EG_FACTOR_RES / 4) {
+        if (pieceCounts[WHITE][BISHOPS] == 1
+         && pieceCounts[BLACK][BISHOPS] == 1
+         && (((pieces[WHITE][BISHOPS] & LIGHT) && (pieces[BLACK][BISHOPS] & DARK))
+          || ((pieces[WHITE][BISHOPS] & DARK) && (pieces[BLACK][BISHOPS] & LIGHT)))) {
+            if ((b.getNonPawnMaterial(WHITE) == pieces[WHITE][BISHOPS])
+             && (b.getNonPawnMaterial(BLACK) == pieces[BLACK][BISHOPS]))
+                scaleFactor = OPPOSITE_BISHOP_SCALING[0];
+            else
+                scaleFactor = OPPOSITE_BISHOP_SCALING[1];
+        }
+    }
+    // Reduce eval for lack of pawns
+    for (int color = WHITE; color <= BLACK; color++) {
+        if (material[MG][color] - material[MG][color^1] > 0
+         && material[MG][color] - material[MG][color^1] <= PIECE_VALUES[MG][KNIGHTS]
+         && pieceCounts[color][PAWNS] <= 1
+         && totalEval * (1 - 2 * color) > 0) {
+            if (pieceCounts[color][PAWNS] == 0) {
+                if (material[MG][color] < PIECE_VALUES[MG][BISHOPS] + 50)
+                    scaleFactor = PAWNLESS_SCALING[0];
+                else if (material[MG][color^1] <= PIECE_VALUES[MG][BISHOPS])
+                    scaleFactor = PAWNLESS_SCALING[1];
+                else
+                    scaleFactor = PAWNLESS_SCALING[2];
+            }
+            else if (scaleFactor != OPPOSITE_BISHOP_SCALING[0])
+                scaleFactor = PAWNLESS_SCALING[3];
+        }
+    }
+
+    if (scaleFactor < MAX_SCALE_FACTOR)
+        totalEval = totalEval * scaleFactor / MAX_SCALE_FACTOR;
+
+
+    if (debug) {
+        evalDebugStats.totalEval = totalEval;
+        evalDebugStats.print();
+    }
+
+    return totalEval;
+}
+
+// Explicitly instantiate templates
+template int Eval::evaluate<true>(Board &b);
+template int Eval::evaluate<false>(Board &b);
+template int Eval::evaluate<true, false>(Board &b, int alpha, int beta, bool &isExact);
+template int Eval::evaluate<false, false>(Board &b, int alpha, int beta, bool &isExact);
+template int Eval::evaluate<false, true>(Board &b, int alpha, int beta, bool &isExact);
+
+// Looks up the pawn structure terms for the current position in the pawn hash
+// table, computing and storing them on a miss. Requires the pawn attack maps in
+// ei to be set.
+PawnHashEntry *Eval::probePawnHash(uint64_t pawnKey) {
+    PawnHashEntry *entry = &pawnHash[pawnKey & (PAWN_HASH_SIZE - 1)];
+    if (entry->pawnKey == pawnKey)
+        return entry;
+
+    uint64_t openFiles = pieces[WHITE][PAWNS] | pieces[BLACK][PAWNS];
+    openFiles |= openFiles >> 8;
+    openFiles |= openFiles >> 16;
+    openFiles |= openFiles >> 32;
+    openFiles |= openFiles << 8;
+    openFiles |= openFiles << 16;
+    openFiles |= openFiles << 32;
+
+    // Get all squares attackable by pawns in the future
+    // Used for outposts and backward pawns
+    uint64_t wPawnFrontSpan = pieces[WHITE][PAWNS] << 8;
+    uint64_t bPawnFrontSpan = pieces[BLACK][PAWNS] >> 8;
+    for (int i = 0; i < 5; i++) {
+        wPawnFrontSpan |= wPawnFrontSpan << 8;
+        bPawnFrontSpan |= bPawnFrontSpan >> 8;
+    }
+    uint64_t pawnStopAtt[2];
+    pawnStopAtt[WHITE] = ((wPawnFrontSpan >> 1) & NOTH) | ((wPawnFrontSpan << 1) & NOTA);
+    pawnStopAtt[BLACK] = ((bPawnFrontSpan >> 1) & NOTH) | ((bPawnFrontSpan << 1) & NOTA);
+
+    Score whitePawnScore = EVAL_ZERO, blackPawnScore = EVAL_ZERO;
+    Score whiteSemiopenScore = 0, blackSemiopenScore = 0;
+
+    // Passed pawns
+    uint64_t wPassedBlocker = pieces[BLACK][PAWNS] >> 8;
+    uint64_t bPassedBlocker = pieces[WHITE][PAWNS] << 8;
+    // If opposing pawns are on the same or an adjacent file on a pawn's front
+    // span, then the pawn is not passed
+    wPassedBlocker |= ((wPassedBlocker >> 1) & NOTH) | ((wPassedBlocker << 1) & NOTA);
+    bPassedBlocker |= ((bPassedBlocker >> 1) & NOTH) | ((bPassedBlocker << 1) & NOTA);
+    // Include own pawns as blockers to prevent doubled pawns from both being
+    // scored as passers
+    wPassedBlocker |= (pieces[WHITE][PAWNS] >> 8);
+    bPassedBlocker |= (pieces[BLACK][PAWNS] << 8);
+    // Find opposing pawn front spans
+    for(int i = 0; i < 4; i++) {
+        wPassedBlocker |= (wPassedBlocker >> 8);
+        bPassedBlocker |= (bPassedBlocker << 8);
+    }
+    // Passers are pawns outside the opposing pawn front span
+    uint64_t wPassedPawns = pieces[WHITE][PAWNS] & ~wPassedBlocker;
+    uint64_t bPassedPawns = pieces[BLACK][PAWNS] & ~bPassedBlocker;
+
+    uint64_t wPasserTemp = wPassedPawns;
+    while (wPasserTemp) {
+        int passerSq = bitScanForward(wPasserTemp);
+        wPasserTemp &= wPasserTemp - 1;
+        whitePawnScore += PASSER_BONUS[passerSq >> 3];
+        whitePawnScore += PASSER_FILE_BONUS[passerSq & 7];
+    }
+    uint64_t bPasserTemp = bPassedPawns;
+    while (bPasserTemp) {
+        int passerSq = bitScanForward(bPasserTemp);
+        bPasserTemp &= bPasserTemp - 1;
+        blackPawnScore += PASSER_BONUS[7 - (passerSq >> 3)];
+        blackPawnScore += PASSER_FILE_BONUS[passerSq & 7];
+    }
+
     // Doubled pawns
     whitePawnScore += DOUBLED_PENALTY * count(pieces[WHITE][PAWNS] & (pieces[WHITE][PAWNS] << 8));
     blackPawnScore += DOUBLED_PENALTY * count(pieces[BLACK][PAWNS] & (pieces[BLACK][PAWNS] >> 8));
@@ -835,13 +1004,13 @@ int Eval::evaluate(Board &b) {
     for (int f = 0; f < 8; f++) {
         if (wIsolated & indexToBit(f)) {
             whitePawnScore += ISOLATED_PENALTY * wPawnCtByFile[f];
-            if (!(FILES[f] & pieces[BLACK][PAWNS]) && (pieces[BLACK][QUEENS] | pieces[BLACK][ROOKS]))
-                whitePawnScore += ISOLATED_SEMIOPEN_PENALTY * wPawnCtByFile[f];
+            if (!(FILES[f] & pieces[BLACK][PAWNS]))
+                whiteSemiopenScore += ISOLATED_SEMIOPEN_PENALTY * wPawnCtByFile[f];
         }
         if (bIsolated & indexToBit(f)) {
             blackPawnScore += ISOLATED_PENALTY * bPawnCtByFile[f];
-            if (!(FILES[f] & pieces[WHITE][PAWNS]) && (pieces[WHITE][QUEENS] | pieces[WHITE][ROOKS]))
-                blackPawnScore += ISOLATED_SEMIOPEN_PENALTY * bPawnCtByFile[f];
+            if (!(FILES[f] & pieces[WHITE][PAWNS]))
+                blackSemiopenScore += ISOLATED_SEMIOPEN_PENALTY * bPawnCtByFile[f];
         }
     }
 
@@ -864,18 +1033,16 @@ int Eval::evaluate(Board &b) {
         int pawnSq = bitScanForward(wBackwardsTemp);
         wBackwardsTemp &= wBackwardsTemp - 1;
         int f = pawnSq & 7;
-        if (!(FILES[f] & pieces[BLACK][PAWNS]) && (pieces[BLACK][QUEENS] | pieces[BLACK][ROOKS])) {
-            whitePawnScore += BACKWARD_SEMIOPEN_PENALTY;
-        }
+        if (!(FILES[f] & pieces[BLACK][PAWNS]))
+            whiteSemiopenScore += BACKWARD_SEMIOPEN_PENALTY;
     }
     uint64_t bBackwardsTemp = bBackwards;
     while (bBackwardsTemp) {
         int pawnSq = bitScanForward(bBackwardsTemp);
         bBackwardsTemp &= bBackwardsTemp - 1;
         int f = pawnSq & 7;
-        if (!(FILES[f] & pieces[WHITE][PAWNS]) && (pieces[WHITE][QUEENS] | pieces[WHITE][ROOKS])) {
-            blackPawnScore += BACKWARD_SEMIOPEN_PENALTY;
-        }
+        if (!(FILES[f] & pieces[WHITE][PAWNS]))
+            blackSemiopenScore += BACKWARD_SEMIOPEN_PENALTY;
     }
 
     // Undefended pawns
@@ -933,127 +1100,32 @@ int Eval::evaluate(Board &b) {
         if (!(FILES[f] & pieces[WHITE][PAWNS]))
             blackPawnScore += bonus;
     }
-    
-    valueMg += decEvalMg(whitePawnScore) - decEvalMg(blackPawnScore);
-    valueEg += decEvalEg(whitePawnScore) - decEvalEg(blackPawnScore);
-
-    if (debug) {
-        evalDebugStats.whitePawnScore = whitePawnScore;
-        evalDebugStats.blackPawnScore = blackPawnScore;
-    }
-
-
-    // King-pawn tropism
-    int kingPawnTropism = 0;
-    if (egFactor > 0) {
-        uint64_t pawnBits = pieces[WHITE][PAWNS] | pieces[BLACK][PAWNS];
-        int pawnWeight = 0;
-
-        int wTropismTotal = 0, bTropismTotal = 0;
-        while (pawnBits) {
-            int pawnSq = bitScanForward(pawnBits);
-            pawnBits &= pawnBits - 1;
-
-            wTropismTotal += (int)manhattanDistance[pawnSq][kingSq[WHITE]];
-            bTropismTotal += (int)manhattanDistance[pawnSq][kingSq[BLACK]];
-            pawnWeight++;
-        }
-
-        if (pawnWeight)
-            kingPawnTropism = (bTropismTotal - wTropismTotal) / pawnWeight;
-
-        valueEg += KING_TROPISM_VALUE * kingPawnTropism;
-    }
-
-
-    // Adjust endgame eval based on the probability of converting the advantage to a win
-    if (egFactor > 0) {
-        uint64_t wPawnAsymmetry = pieces[WHITE][PAWNS];
-        wPawnAsymmetry |= wPawnAsymmetry >> 8;
-        wPawnAsymmetry |= wPawnAsymmetry >> 16;
-        wPawnAsymmetry |= wPawnAsymmetry >> 32;
-        wPawnAsymmetry &= 0xFF;
-        uint64_t bPawnAsymmetry = pieces[BLACK][PAWNS];
-        bPawnAsymmetry |= bPawnAsymmetry >> 8;
-        bPawnAsymmetry |= bPawnAsymmetry >> 16;
-        bPawnAsymmetry |= bPawnAsymmetry >> 32;
-        bPawnAsymmetry &= 0xFF;
-        // Asymmetry: greater asymmetry means less locked position, more potential passers
-        int pawnAsymmetry = count((wPawnAsymmetry & ~bPawnAsymmetry) | (~wPawnAsymmetry & bPawnAsymmetry));
-        // King opposition distance: when kings are farther apart by file, there is a
-        // lower chance of the defending king keeping the attacking king from penetrating
-        int oppositionDistance = std::abs((kingSq[WHITE] & 7)  - (kingSq[BLACK] & 7))
-                               - std::abs((kingSq[WHITE] >> 3) - (kingSq[BLACK] >> 3));
-
-        int egWinAdjustment = PAWN_ASYMMETRY_BONUS * pawnAsymmetry
-                            + PAWN_COUNT_BONUS * (pieceCounts[WHITE][PAWNS] + pieceCounts[BLACK][PAWNS])
-                            + KING_OPPOSITION_DISTANCE_BONUS * oppositionDistance
-                            + ENDGAME_BASE;
-        // Cap the penalty at reducing to a score of 0
-        if (valueEg > 0)
-            valueEg = std::max(0, valueEg + egWinAdjustment);
-        else if (valueEg < 0)
-            valueEg = std::min(0, valueEg - egWinAdjustment);
-    }
-
-
-    if (debug) {
-        evalDebugStats.totalMg = valueMg;
-        evalDebugStats.totalEg = valueEg;
-    }
-
-    int totalEval = (valueMg * (EG_FACTOR_RES - egFactor) + valueEg * egFactor) / EG_FACTOR_RES;
-
-    // Scale factors
-    int scaleFactor = MAX_SCALE_FACTOR;
-    // Opposite colored bishops
-    if (egFactor > 3 * EG_FACTOR_RES / 4) {
-        if (pieceCounts[WHITE][BISHOPS] == 1
-         && pieceCounts[BLACK][BISHOPS] == 1
-         && (((pieces[WHITE][BISHOPS] & LIGHT) && (pieces[BLACK][BISHOPS] & DARK))
-          || ((pieces[WHITE][BISHOPS] & DARK) && (pieces[BLACK][BISHOPS] & LIGHT)))) {
-            if ((b.getNonPawnMaterial(WHITE) == pieces[WHITE][BISHOPS])
-             && (b.getNonPawnMaterial(BLACK) == pieces[BLACK][BISHOPS]))
-                scaleFactor = OPPOSITE_BISHOP_SCALING[0];
-            else
-                scaleFactor = OPPOSITE_BISHOP_SCALING[1];
-        }
-    }
-    // Reduce eval for lack of pawns
-    for (int color = WHITE; color <= BLACK; color++) {
-        if (material[MG][color] - material[MG][color^1] > 0
-         && material[MG][color] - material[MG][color^1] <= PIECE_VALUES[MG][KNIGHTS]
-         && pieceCounts[color][PAWNS] <= 1
-         && totalEval * (1 - 2 * color) > 0) {
-            if (pieceCounts[color][PAWNS] == 0) {
-                if (material[MG][color] < PIECE_VALUES[MG][BISHOPS] + 50)
-                    scaleFactor = PAWNLESS_SCALING[0];
-                else if (material[MG][color^1] <= PIECE_VALUES[MG][BISHOPS])
-                    scaleFactor = PAWNLESS_SCALING[1];
-                else
-                    scaleFactor = PAWNLESS_SCALING[2];
-            }
-            else if (scaleFactor != OPPOSITE_BISHOP_SCALING[0])
-                scaleFactor = PAWNLESS_SCALING[3];
-        }
-    }
-
-    if (scaleFactor < MAX_SCALE_FACTOR)
-        totalEval = totalEval * scaleFactor / MAX_SCALE_FACTOR;
 
-
-    if (debug) {
-        evalDebugStats.totalEval = totalEval;
-        evalDebugStats.print();
-    }
-
-    return totalEval;
+    uint64_t wPawnAsymmetry = pieces[WHITE][PAWNS];
+    wPawnAsymmetry |= wPawnAsymmetry >> 8;
+    wPawnAsymmetry |= wPawnAsymmetry >> 16;
+    wPawnAsymmetry |= wPawnAsymmetry >> 32;
+    wPawnAsymmetry &= 0xFF;
+    uint64_t bPawnAsymmetry = pieces[BLACK][PAWNS];
+    bPawnAsymmetry |= bPawnAsymmetry >> 8;
+    bPawnAsymmetry |= bPawnAsymmetry >> 16;
+    bPawnAsymmetry |= bPawnAsymmetry >> 32;
+    bPawnAsymmetry &= 0xFF;
+
+    entry->pawnKey = pawnKey;
+    entry->score[WHITE] = whitePawnScore;
+    entry->score[BLACK] = blackPawnScore;
+    entry->semiopenScore[WHITE] = whiteSemiopenScore;
+    entry->semiopenScore[BLACK] = blackSemiopenScore;
+    entry->pawnAsymmetry = count((wPawnAsymmetry & ~bPawnAsymmetry) | (~wPawnAsymmetry & bPawnAsymmetry));
+    entry->passedPawns[WHITE] = wPassedPawns;
+    entry->passedPawns[BLACK] = bPassedPawns;
+    entry->pawnStopAtt[WHITE] = pawnStopAtt[WHITE];
+    entry->pawnStopAtt[BLACK] = pawnStopAtt[BLACK];
+    entry->openFiles = ~openFiles;
+    return entry;
 }
 
-// Explicitly instantiate templates
-template int Eval::evaluate<true>(Board &b);
-template int Eval::evaluate<false>(Board &b);
-
 // King safety, based on the number of opponent pieces near the king
 // The lookup table approach is inspired by Ed Schroder's Rebel chess engine,
 // and by Stockfish
@@ -1180,143 +1252,209 @@ int Eval::getKingSafety(Board &b, PieceMoveList &attackers, uint64_t kingSqs, in
     return std::min(kingSafetyPts * kingSafetyPts / KS_ARRAY_FACTOR, 600) + kingPressure;
 }
 
-// Check special endgame cases: where help mate is possible (detecting this
-// is delegated to search), but forced mate is not, or where a simple
-// forced mate is possible.
-int Eval::checkEndgameCases() {
-    int numWPieces = count(allPieces[WHITE]) - 1;
-    int numBPieces = count(allPieces[BLACK]) - 1;
-    int numPieces = numWPieces + numBPieces;
+// Looks up the material terms for the current position in the material hash
+// table, computing and storing them on a miss.
+MaterialHashEntry *Eval::probeMaterialHash(uint64_t materialKey) {
+    MaterialHashEntry *entry = &materialHash[(materialKey * 0x9E3779B97F4A7C15ULL) >> 51];
+    if (entry->materialKey == materialKey)
+        return entry;
 
-    // Rook or queen + anything else vs. lone king is a forced win
-    if (numBPieces == 0 && (pieces[WHITE][ROOKS] || pieces[WHITE][QUEENS])) {
-        return scoreSimpleKnownWin(WHITE);
+    entry->materialKey = materialKey;
+    int (*counts)[6] = entry->pieceCounts;
+    int egFactorMaterial = 0;
+    for (int color = WHITE; color <= BLACK; color++) {
+        for (int pieceID = PAWNS; pieceID <= QUEENS; pieceID++) {
+            counts[color][pieceID] = (int) ((materialKey >> (4 * (5 * color + pieceID))) & 0xF);
+            egFactorMaterial += EG_FACTOR_PIECE_VALS[pieceID] * counts[color][pieceID];
+        }
+        counts[color][KINGS] = 1;
     }
-    if (numWPieces == 0 && (pieces[BLACK][ROOKS] || pieces[BLACK][QUEENS])) {
-        return scoreSimpleKnownWin(BLACK);
+
+    // Compute endgame factor which is between 0 and EG_FACTOR_RES, inclusive
+    int egFactor = EG_FACTOR_RES - (egFactorMaterial - EG_FACTOR_ALPHA) * EG_FACTOR_RES / EG_FACTOR_BETA;
+    entry->egFactor = std::max(0, std::min(EG_FACTOR_RES, egFactor));
+
+    // Own-opp imbalance terms
+    // Gain OWN_OPP_IMBALANCE[][ownID][oppID] centipawns for each ownID piece
+    // you have and each oppID piece the opponent has
+    entry->imbalance[MG] = entry->imbalance[EG] = 0;
+    for (int ownID = KNIGHTS; ownID <= QUEENS; ownID++) {
+        for (int oppID = PAWNS; oppID < ownID; oppID++) {
+            entry->imbalance[MG] += OWN_OPP_IMBALANCE[MG][ownID][oppID] * counts[WHITE][ownID] * counts[BLACK][oppID];
+            entry->imbalance[EG] += OWN_OPP_IMBALANCE[EG][ownID][oppID] * counts[WHITE][ownID] * counts[BLACK][oppID];
+            entry->imbalance[MG] -= OWN_OPP_IMBALANCE[MG][ownID][oppID] * counts[BLACK][ownID] * counts[WHITE][oppID];
+            entry->imbalance[EG] -= OWN_OPP_IMBALANCE[EG][ownID][oppID] * counts[BLACK][ownID] * counts[WHITE][oppID];
+        }
     }
 
+    // Check special endgame cases: where help mate is possible (detecting this
+    // is delegated to search), but forced mate is not, or where a simple
+    // forced mate is possible.
+    entry->endgameFunction = nullptr;
+    if (entry->egFactor < EG_FACTOR_RES)
+        return entry;
+
+    int numWPieces = 0, numBPieces = 0;
+    for (int pieceID = PAWNS; pieceID <= QUEENS; pieceID++) {
+        numWPieces += counts[WHITE][pieceID];
+        numBPieces += counts[BLACK][pieceID];
+    }
+    int numPieces = numWPieces + numBPieces;
+
+    // Rook or queen + anything else vs. lone king is a forced win
+    if (numBPieces == 0 && (counts[WHITE][ROOKS] || counts[WHITE][QUEENS]))
+        entry->endgameFunction = &Eval::scoreKXK<WHITE>;
+    else if (numWPieces == 0 && (counts[BLACK][ROOKS] || counts[BLACK][QUEENS]))
+        entry->endgameFunction = &Eval::scoreKXK<BLACK>;
+
     // TODO detect when KPvK is drawn
-    if (numPieces == 1) {
-        if (pieces[WHITE][PAWNS]) {
-            int wPawn = bitScanForward(pieces[WHITE][PAWNS]);
-            int r = (wPawn >> 3);
-            return 3 * PIECE_VALUES[EG][PAWNS] / 2 + 5 * (r - 1) * (r - 2);
-        }
-        if (pieces[BLACK][PAWNS]) {
-            int bPawn = bitScanForward(pieces[BLACK][PAWNS]);
-            int r = 7 - (bPawn >> 3);
-            return -3 * PIECE_VALUES[EG][PAWNS] / 2 - 5 * (r - 1) * (r - 2);
-        }
+    else if (numPieces == 1) {
+        if (counts[WHITE][PAWNS])
+            entry->endgameFunction = &Eval::scoreKPK<WHITE>;
+        else if (counts[BLACK][PAWNS])
+            entry->endgameFunction = &Eval::scoreKPK<BLACK>;
     }
 
     else if (numPieces == 2) {
         // If white has one piece, the other must be black's
         if (numWPieces == 1) {
-            // If each side has one minor piece, then draw
-            if ((pieces[WHITE][KNIGHTS] | pieces[WHITE][BISHOPS])
-             && (pieces[BLACK][KNIGHTS] | pieces[BLACK][BISHOPS]))
-                return 0;
-            // If each side has a rook, then draw
-            if (pieces[WHITE][ROOKS] && pieces[BLACK][ROOKS])
-                return 0;
-            // If each side has a queen, then draw
-            if (pieces[WHITE][QUEENS] && pieces[BLACK][QUEENS])
-                return 0;
+            int wMinors = counts[WHITE][KNIGHTS] + counts[WHITE][BISHOPS];
+            int bMinors = counts[BLACK][KNIGHTS] + counts[BLACK][BISHOPS];
+            // Draw if each side has one minor piece, one rook, or one queen
+            if ((wMinors && bMinors)
+             || (counts[WHITE][ROOKS] && counts[BLACK][ROOKS])
+             || (counts[WHITE][QUEENS] && counts[BLACK][QUEENS]))
+                entry->endgameFunction = &Eval::scoreDraw;
         }
         // Otherwise, one side has both pieces
-        else {
-            // Pawn + anything is a win
-            // TODO bishop can block losing king's path to queen square
-            if (pieces[WHITE][PAWNS]) {
-                int value = KNOWN_WIN / 2;
-                int wKingSq = bitScanForward(pieces[WHITE][KINGS]);
-                int bKingSq = bitScanForward(pieces[BLACK][KINGS]);
-                int wPawnSq = bitScanForward(pieces[WHITE][PAWNS]);
-                int wf = wPawnSq & 7;
-                int wr = wPawnSq >> 3;
-                if (pieces[WHITE][BISHOPS]
-                 && ((wf == 0 && (pieces[WHITE][BISHOPS] & DARK))
-                  || (wf == 7 && (pieces[WHITE][BISHOPS] & LIGHT)))) {
-                    int wDist = std::max(7 - (wKingSq >> 3), std::abs((wKingSq & 7) - wf));
-                    int bDist = std::max(7 - (bKingSq >> 3), std::abs((bKingSq & 7) - wf));
-                    int wQueenDist = std::min(7-wr, 5) + 1;
-                    if (playerToMove == BLACK)
-                        bDist--;
-                    if (bDist < std::min(wDist, wQueenDist))
-                        return 0;
-                }
+        // Pawn + anything is a win
+        else if (counts[WHITE][PAWNS])
+            entry->endgameFunction = &Eval::scoreKPXK<WHITE>;
+        else if (counts[BLACK][PAWNS])
+            entry->endgameFunction = &Eval::scoreKPXK<BLACK>;
+        // Two knights is a draw
+        else if (counts[WHITE][KNIGHTS] == 2 || counts[BLACK][KNIGHTS] == 2)
+            entry->endgameFunction = &Eval::scoreDraw;
+        // Two bishops is a win
+        else if (counts[WHITE][BISHOPS] == 2)
+            entry->endgameFunction = &Eval::scoreKXK<WHITE>;
+        else if (counts[BLACK][BISHOPS] == 2)
+            entry->endgameFunction = &Eval::scoreKXK<BLACK>;
+        // Mating with knight and bishop
+        else if (counts[WHITE][KNIGHTS] && counts[WHITE][BISHOPS])
+            entry->endgameFunction = &Eval::scoreKBNK<WHITE>;
+        else if (counts[BLACK][KNIGHTS] && counts[BLACK][BISHOPS])
+            entry->endgameFunction = &Eval::scoreKBNK<BLACK>;
+    }
 
-                value += 8 * wr * wr;
-                value += scoreCornerDistance(WHITE, wKingSq, bKingSq);
-                return value;
-            }
-            if (pieces[BLACK][PAWNS]) {
-                int value = -KNOWN_WIN / 2;
-                int wKingSq = bitScanForward(pieces[WHITE][KINGS]);
-                int bKingSq = bitScanForward(pieces[BLACK][KINGS]);
-                int bPawnSq = bitScanForward(pieces[BLACK][PAWNS]);
-                int bf = bPawnSq & 7;
-                int br = bPawnSq >> 3;
-                if (pieces[BLACK][BISHOPS]
-                 && ((bf == 0 && (pieces[BLACK][BISHOPS] & LIGHT))
-                  || (bf == 7 && (pieces[BLACK][BISHOPS] & DARK)))) {
-                    int wDist = std::max((wKingSq >> 3), std::abs((wKingSq & 7) - bf));
-                    int bDist = std::max((bKingSq >> 3), std::abs((bKingSq & 7) - bf));
-                    int bQueenDist = std::min(br, 5) + 1;
-                    if (playerToMove == WHITE)
-                        wDist--;
-                    if (wDist < std::min(bDist, bQueenDist))
-                        return 0;
-                }
+    return entry;
+}
 
-                value -= 8 * br * br;
-                value += scoreCornerDistance(WHITE, wKingSq, bKingSq);
-                return value;
-            }
-            // Two knights is a draw
-            if (count(pieces[WHITE][KNIGHTS]) == 2 || count(pieces[BLACK][KNIGHTS]) == 2)
+//------------------------------Special endgames--------------------------------
+int Eval::scoreDraw() {
+    return 0;
+}
+
+// Enough material to force mate by driving the opposing king to a corner
+template <int winningColor>
+int Eval::scoreKXK() {
+    return scoreSimpleKnownWin(winningColor);
+}
+
+// King and pawn vs. king
+template <int winningColor>
+int Eval::scoreKPK() {
+    if (winningColor == WHITE) {
+        int wPawn = bitScanForward(pieces[WHITE][PAWNS]);
+        int r = (wPawn >> 3);
+        return 3 * PIECE_VALUES[EG][PAWNS] / 2 + 5 * (r - 1) * (r - 2);
+    }
+    else {
+        int bPawn = bitScanForward(pieces[BLACK][PAWNS]);
+        int r = 7 - (bPawn >> 3);
+        return -3 * PIECE_VALUES[EG][PAWNS] / 2 - 5 * (r - 1) * (r - 2);
+    }
+}
+
+// King, pawn, and one other piece or pawn vs. king
+// TODO bishop can block losing king's path to queen square
+template <int winningColor>
+int Eval::scoreKPXK() {
+    int wKingSq = bitScanForward(pieces[WHITE][KINGS]);
+    int bKingSq = bitScanForward(pieces[BLACK][KINGS]);
+    if (winningColor == WHITE) {
+        int value = KNOWN_WIN / 2;
+        int wPawnSq = bitScanForward(pieces[WHITE][PAWNS]);
+        int wf = wPawnSq & 7;
+        int wr = wPawnSq >> 3;
+        if (pieces[WHITE][BISHOPS]
+         && ((wf == 0 && (pieces[WHITE][BISHOPS] & DARK))
+          || (wf == 7 && (pieces[WHITE][BISHOPS] & LIGHT)))) {
+            int wDist = std::max(7 - (wKingSq >> 3), std::abs((wKingSq & 7) - wf));
+            int bDist = std::max(7 - (bKingSq >> 3), std::abs((bKingSq & 7) - wf));
+            int wQueenDist = std::min(7-wr, 5) + 1;
+            if (playerToMove == BLACK)
+                bDist--;
+            if (bDist < std::min(wDist, wQueenDist))
                 return 0;
-            // Two bishops is a win
-            if (count(pieces[WHITE][BISHOPS]) == 2)
-                return scoreSimpleKnownWin(WHITE);
-            if (count(pieces[BLACK][BISHOPS]) == 2)
-                return scoreSimpleKnownWin(BLACK);
-
-            // Mating with knight and bishop
-            if (pieces[WHITE][KNIGHTS] && pieces[WHITE][BISHOPS]) {
-                int value = KNOWN_WIN;
-                int wKingSq = bitScanForward(pieces[WHITE][KINGS]);
-                int bKingSq = bitScanForward(pieces[BLACK][KINGS]);
-                value += scoreCornerDistance(WHITE, wKingSq, bKingSq);
-
-                // Light squared corners are H1 (7) and A8 (56)
-                if (pieces[WHITE][BISHOPS] & LIGHT)
-                    value -= 20 * (int)std::min(manhattanDistance[bKingSq][7], manhattanDistance[bKingSq][56]);
-                // Dark squared corners are A1 (0) and H8 (63)
-                else
-                    value -= 20 * (int)std::min(manhattanDistance[bKingSq][0], manhattanDistance[bKingSq][63]);
-                return value;
-            }
-            if (pieces[BLACK][KNIGHTS] && pieces[BLACK][BISHOPS]) {
-                int value = -KNOWN_WIN;
-                int wKingSq = bitScanForward(pieces[WHITE][KINGS]);
-                int bKingSq = bitScanForward(pieces[BLACK][KINGS]);
-                value += scoreCornerDistance(BLACK, wKingSq, bKingSq);
-
-                // Light squared corners are H1 (7) and A8 (56)
-                if (pieces[BLACK][BISHOPS] & LIGHT)
-                    value += 20 * (int)std::min(manhattanDistance[wKingSq][7], manhattanDistance[wKingSq][56]);
-                // Dark squared corners are A1 (0) and H8 (63)
-                else
-                    value += 20 * (int)std::min(manhattanDistance[wKingSq][0], manhattanDistance[wKingSq][63]);
-                return value;
-            }
         }
+
+        value += 8 * wr * wr;
+        value += scoreCornerDistance(WHITE, wKingSq, bKingSq);
+        return value;
     }
+    else {
+        int value = -KNOWN_WIN / 2;
+        int bPawnSq = bitScanForward(pieces[BLACK][PAWNS]);
+        int bf = bPawnSq & 7;
+        int br = bPawnSq >> 3;
+        if (pieces[BLACK][BISHOPS]
+         && ((bf == 0 && (pieces[BLACK][BISHOPS] & LIGHT))
+          || (bf == 7 && (pieces[BLACK][BISHOPS] & DARK)))) {
+            int wDist = std::max((wKingSq >> 3), std::abs((wKingSq & 7) - bf));
+            int bDist = std::max((bKingSq >> 3), std::abs((bKingSq & 7) - bf));
+            int bQueenDist = std::min(br, 5) + 1;
+            if (playerToMove == WHITE)
+                wDist--;
+            if (wDist < std::min(bDist, bQueenDist))
+                return 0;
+        }
 
-    // If not an endgame case, return -INFTY
-    return -INFTY;
+        value -= 8 * br * br;
+        value += scoreCornerDistance(WHITE, wKingSq, bKingSq);
+        return value;
+    }
+}
+
+// Mating with knight and bishop
+template <int winningColor>
+int Eval::scoreKBNK() {
+    int wKingSq = bitScanForward(pieces[WHITE][KINGS]);
+    int bKingSq = bitScanForward(pieces[BLACK][KINGS]);
+    if (winningColor == WHITE) {
+        int value = KNOWN_WIN;
+        value += scoreCornerDistance(WHITE, wKingSq, bKingSq);
+
+        // Light squared corners are H1 (7) and A8 (56)
+        if (pieces[WHITE][BISHOPS] & LIGHT)
+            value -= 20 * (int)std::min(manhattanDistance[bKingSq][7], manhattanDistance[bKingSq][56]);
+        // Dark squared corners are A1 (0) and H8 (63)
+        else
+            value -= 20 * (int)std::min(manhattanDistance[bKingSq][0], manhattanDistance[bKingSq][63]);
+        return value;
+    }
+    else {
+        int value = -KNOWN_WIN;
+        value += scoreCornerDistance(BLACK, wKingSq, bKingSq);
+
+        // Light squared corners are H1 (7) and A8 (56)
+        if (pieces[BLACK][BISHOPS] & LIGHT)
+            value += 20 * (int)std::min(manhattanDistance[wKingSq][7], manhattanDistance[wKingSq][56]);
+        // Dark squared corners are A1 (0) and H8 (63)
+        else
+            value += 20 * (int)std::min(manhattanDistance[wKingSq][0], manhattanDistance[wKingSq][63]);
+        return value;
+    }
 }
 
 // A function for scoring the most basic mating cases, when it is only necessary
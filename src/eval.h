@@ -42,21 +42,81 @@ struct EvalInfo {
     }
 };
 
+// Evaluation terms that depend only on the pawn structure, cached in a
+// per-thread pawn hash table.
+struct PawnHashEntry {
+    uint64_t pawnKey;
+    // Pawn structure score and pawn piece square table score for each side
+    Score score[2];
+    // Penalties for isolated and backward pawns on semi-open files, which
+    // only apply if the opponent has rooks or queens
+    Score semiopenScore[2];
+    int pawnAsymmetry;
+    uint64_t passedPawns[2];
+    uint64_t pawnStopAtt[2];
+    uint64_t openFiles;
+};
+
+// Number of entries in each thread's pawn hash table, must be a power of two
+constexpr int PAWN_HASH_SIZE = 1 << 14;
+
+class Eval;
+// Evaluation function for a special endgame, selected by material signature
+typedef int (Eval::*EndgameFunction)();
+
+// Evaluation terms that depend only on the number of each piece, cached in a
+// per-thread material hash table.
+struct MaterialHashEntry {
+    uint64_t materialKey;
+    int pieceCounts[2][6];
+    // Material imbalance for white, indexed by [MG/EG]
+    int imbalance[2];
+    int egFactor;
+    // Specialized evaluation for known endgames, or nullptr if there is none
+    EndgameFunction endgameFunction;
+};
+
+// Number of entries in each thread's material hash table, must be a power of two
+constexpr int MATERIAL_HASH_SIZE = 1 << 13;
+
+// How far the cheap terms of a lazy evaluation must be outside the window for
+// the rest of the evaluation to be skipped
+constexpr int LAZY_EVAL_MARGIN = 400;
+
 class Eval {
 public:
+    Eval();
+    ~Eval();
+    Eval(const Eval &other) = delete;
+    Eval& operator=(const Eval &other) = delete;
+
     template <bool debug = false> int evaluate(Board &b);
+    int evaluate(Board &b, int alpha, int beta, bool &isExact);
 
 private:
+    PawnHashEntry *pawnHash;
+    MaterialHashEntry *materialHash;
     EvalInfo ei;
     uint64_t pieces[2][6];
     uint64_t allPieces[2];
-    int pieceCounts[2][6];
+    const int (*pieceCounts)[6];
     int playerToMove;
 
+    template <bool debug, bool lazy>
+    int evaluate(Board &b, int alpha, int beta, bool &isExact);
+
     // Eval helpers
     template <int attackingColor>
     int getKingSafety(Board &b, PieceMoveList &attackers, uint64_t kingSqs, int pawnScore, int kingFile);
-    int checkEndgameCases();
+    PawnHashEntry *probePawnHash(uint64_t pawnKey);
+    MaterialHashEntry *probeMaterialHash(uint64_t materialKey);
+
+    // Special endgame evaluators
+    int scoreDraw();
+    template <int winningColor> int scoreKXK();
+    template <int winningColor> int scoreKPK();
+    template <int winningColor> int scoreKPXK();
+    template <int winningColor> int scoreKBNK();
     int scoreSimpleKnownWin(int winningColor);
     int scoreCornerDistance(int winningColor, int wKingSq, int bKingSq);
 };
@@ -67,10 +127,6 @@ constexpr int EG_FACTOR_ALPHA = 2010;
 constexpr int EG_FACTOR_BETA = 6410;
 constexpr int EG_FACTOR_RES = 1000;
 
-// Eval scores are packed into an unsigned 32-bit integer during calculations
-// (the SWAR technique)
-typedef uint32_t Score;
-
 // Encodes 16-bit midgame and endgame evaluation scores into a single int
 #define E(mg, eg) ((Score) ((int32_t) (((uint32_t) eg) << 16) + ((int32_t) mg)))
 
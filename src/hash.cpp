@@ -16,72 +16,236 @@
     along with Laser.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
 #include "hash.h"
 
-Hash::Hash(uint64_t MB) {
-    init(MB);
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Fold the entry data into the 32-bit key check so that torn entries are detected
+inline uint32_t foldEntry(uint64_t data) {
+    return (uint32_t) data ^ (uint32_t) (data >> 32);
+}
+
+inline uint64_t packEntry(const HashEntry &entry) {
+    uint64_t data;
+    std::memcpy(&data, &entry, sizeof(data));
+    return data;
+}
+
+inline HashEntry unpackEntry(uint64_t data) {
+    HashEntry entry;
+    std::memcpy(&entry, &data, sizeof(entry));
+    return entry;
+}
+
+// The Zobrist key of the starting position changes whenever the keys do
+inline uint64_t zobristCheck() {
+    return Board().getZobristKey();
+}
+
+#ifdef __linux__
+constexpr uint64_t HUGE_PAGE_2MB = 1ULL << 21;
+constexpr uint64_t HUGE_PAGE_1GB = 1ULL << 30;
+
+// Tries to map the table with explicitly reserved (hugetlbfs) pages
+void *mapHugePages(uint64_t bytes, uint64_t pageBytes) {
+#ifdef MAP_HUGETLB
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+    flags |= (pageBytes == HUGE_PAGE_1GB ? 30 : 21) << MAP_HUGE_SHIFT;
+#endif
+    void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return (ptr == MAP_FAILED) ? NULL : ptr;
+#else
+    (void) bytes;
+    (void) pageBytes;
+    return NULL;
+#endif
+}
+
+// Transparent huge pages are only used for madvise regions if the kernel
+// setting is not "never"
+bool transparentHugePagesEnabled() {
+    std::ifstream setting("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string line;
+    if (!std::getline(setting, line))
+        return false;
+    return line.find("[never]") == std::string::npos;
+}
+#endif
+
+} // namespace
+
+Hash::Hash(uint64_t MB) : mappedFile(NULL) {
+    init(MB, 1, false);
 }
 
 Hash::~Hash() {
-    free(table);
+    release();
 }
 
 // Adds key and move into the hashtable. This function assumes that the key has
 // been checked with get and is not in the table.
 void Hash::add(Board &b, int score, Move move, int eval, int depth, uint8_t nodeType) {
     uint64_t h = b.getZobristKey();
-    uint64_t index = h & (size-1);
-    HashNode *node = table + index;
-
-    // Decide whether to replace the entry
-    // A more recent update to the same position should always be chosen
-    if (node->slot1.zobristKey == b.getZobristKey())
-        node->slot1.setEntry(b, score, move, eval, depth, nodeType, age);
-
-    else if (node->slot2.zobristKey == b.getZobristKey())
-        node->slot2.setEntry(b, score, move, eval, depth, nodeType, age);
-
-    // Replace an entry from a previous search space, or the lowest depth
-    // entry with the new entry if the new entry's depth is high enough
-    else {
-        HashEntry *toReplace = &(node->slot1);
-        int score1 = 16 * ((int) ((uint8_t) (age - (node->slot1.ageNodeType >> 2))))
-            + depth - node->slot1.depth;
-        int score2 = 16 * ((int) ((uint8_t) (age - (node->slot2.ageNodeType >> 2))))
-            + depth - node->slot2.depth;
-        if (score1 < score2)
-            toReplace = &(node->slot2);
-        // The node must be from a newer search space or a sufficiently high depth
-        if (score1 >= -2 || score2 >= -2)
-            toReplace->setEntry(b, score, move, eval, depth, nodeType, age);
+    uint32_t keyCheck = (uint32_t) (h >> 32);
+    HashNode *node = table + (h & (size-1));
+
+    int replaceIndex = 0;
+    int bestReplaceScore = -INFTY;
+    for (int i = 0; i < HASH_NODE_ENTRIES; i++) {
+        uint64_t data = node->data[i];
+        // A more recent update to the same position should always be chosen
+        if ((node->check[i] ^ foldEntry(data)) == keyCheck) {
+            replaceIndex = i;
+            bestReplaceScore = 0;
+            break;
+        }
+
+        // Otherwise, prefer replacing an entry from a previous search space,
+        // or the lowest depth entry
+        HashEntry entry = unpackEntry(data);
+        int replaceScore = 16 * ((int) ((uint8_t) (age - entry.getAge()))) + depth - entry.depth;
+        if (replaceScore > bestReplaceScore) {
+            replaceIndex = i;
+            bestReplaceScore = replaceScore;
+        }
+    }
+
+    // The node must be from a newer search space or a sufficiently high depth
+    if (bestReplaceScore >= -2) {
+        uint64_t data = packEntry(HashEntry(score, move, eval, depth, nodeType, age));
+        node->data[replaceIndex] = data;
+        node->check[replaceIndex] = keyCheck ^ foldEntry(data);
     }
 }
 
-// Get the hash entry, if any, associated with a board b.
-HashEntry *Hash::get(Board &b) {
+// Get the hash entry, if any, associated with a board b. The entry is copied
+// out of the table so that it cannot change while it is being used.
+bool Hash::get(Board &b, HashEntry &entry) const {
     uint64_t h = b.getZobristKey();
-    uint64_t index = h & (size-1);
-    HashNode *node = table + index;
+    uint32_t keyCheck = (uint32_t) (h >> 32);
+    const HashNode *node = table + (h & (size-1));
+
+    for (int i = 0; i < HASH_NODE_ENTRIES; i++) {
+        uint64_t data = node->data[i];
+        // Zeroed data is an empty slot
+        if (data && (node->check[i] ^ foldEntry(data)) == keyCheck) {
+            entry = unpackEntry(data);
+            return true;
+        }
+    }
 
-    if (node->slot1.zobristKey == b.getZobristKey())
-        return &(node->slot1);
-    else if (node->slot2.zobristKey == b.getZobristKey())
-        return &(node->slot2);
+    return false;
+}
 
-    return nullptr;
+// Starts loading the bucket for a key into cache ahead of a probe
+void Hash::prefetch(uint64_t key) const {
+    __builtin_prefetch(table + (key & (size-1)));
 }
 
 uint64_t Hash::getSize() const {
-    return (2 * size);
+    return (HASH_NODE_ENTRIES * size);
+}
+
+// Returns the size in bytes of the memory pages backing the table
+uint64_t Hash::getPageSize() const {
+    return pageSize;
 }
 
-void Hash::setSize(uint64_t MB) {
-    free(table);
-    init(MB);
+void Hash::setSize(uint64_t MB, int numThreads, bool pinThreads) {
+    release();
+    init(MB, numThreads, pinThreads);
 }
 
-void Hash::init(uint64_t MB) {
+// Writes the table to a file, so that a later session can continue with it
+bool Hash::save(const std::string &path) const {
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (file == NULL)
+        return false;
+
+    HashFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = HASH_FILE_MAGIC;
+    header.version = HASH_FILE_VERSION;
+    header.nodeBytes = sizeof(HashNode);
+    header.nodeEntries = HASH_NODE_ENTRIES;
+    header.size = size;
+    header.zobristCheck = zobristCheck();
+    header.age = age;
+
+    bool success = std::fwrite(&header, sizeof(header), 1, file) == 1
+                && std::fwrite(table, sizeof(HashNode), size, file) == size;
+    return (std::fclose(file) == 0) && success;
+}
+
+// Replaces the table with one saved by save(). The table takes the size of
+// the file. On Linux the file is mapped copy-on-write, so that a large table
+// is paged in as it is probed instead of being read up front, and the file
+// itself is never modified. On failure the current table is kept.
+bool Hash::load(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    HashFileHeader header;
+    if (!file.read((char *) &header, sizeof(header)))
+        return false;
+    if (header.magic != HASH_FILE_MAGIC || header.version != HASH_FILE_VERSION
+     || header.nodeBytes != sizeof(HashNode) || header.nodeEntries != HASH_NODE_ENTRIES
+     || header.zobristCheck != zobristCheck()
+     || header.size == 0 || (header.size & (header.size - 1)))
+        return false;
+    file.seekg(0, std::ios::end);
+    uint64_t bytes = sizeof(HashFileHeader) + header.size * sizeof(HashNode);
+    if ((uint64_t) file.tellg() != bytes)
+        return false;
+
+#ifdef __linux__
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    void *data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    release();
+    mappedFile = data;
+    table = (HashNode *) ((char *) data + sizeof(HashFileHeader));
+    allocation = HASH_ALLOC_FILE;
+    allocatedBytes = bytes;
+    pageSize = 4096;
+#else
+    HashNode *loaded = (HashNode *) alignedMalloc(sizeof(HashNode), header.size * sizeof(HashNode));
+    file.seekg(sizeof(HashFileHeader));
+    if (!file.read((char *) loaded, header.size * sizeof(HashNode))) {
+        alignedFree(loaded);
+        return false;
+    }
+
+    release();
+    table = loaded;
+    allocation = HASH_ALLOC_ALIGNED;
+    allocatedBytes = header.size * sizeof(HashNode);
+    pageSize = 4096;
+#endif
+
+    size = header.size;
+    age = header.age;
+    return true;
+}
+
+void Hash::init(uint64_t MB, int numThreads, bool pinThreads) {
     // Convert to bytes
     uint64_t bytes = MB << 20;
     // Calculate how many array slots we can use
@@ -92,25 +256,106 @@ void Hash::init(uint64_t MB) {
         size <<= 1;
     size >>= 1;
 
-    table = (HashNode *) calloc(size,  sizeof(HashNode));
-    clear();
+    allocate(size * sizeof(HashNode));
+    clear(numThreads, pinThreads);
+}
+
+// Allocates the table, preferring 1 GB or 2 MB huge pages where available to
+// reduce TLB misses on probes. Physical pages are not placed until they are
+// first written, which happens in the parallel clear.
+void Hash::allocate(uint64_t bytes) {
+#ifdef __linux__
+    // Explicit huge pages must be requested in whole pages
+    if (bytes >= HUGE_PAGE_1GB) {
+        table = (HashNode *) mapHugePages(bytes, HUGE_PAGE_1GB);
+        if (table != NULL) {
+            allocation = HASH_ALLOC_MMAP;
+            allocatedBytes = bytes;
+            pageSize = HUGE_PAGE_1GB;
+            return;
+        }
+    }
+
+    uint64_t hugeBytes = (bytes + HUGE_PAGE_2MB - 1) & ~(HUGE_PAGE_2MB - 1);
+    table = (HashNode *) mapHugePages(hugeBytes, HUGE_PAGE_2MB);
+    if (table != NULL) {
+        allocation = HASH_ALLOC_MMAP;
+        allocatedBytes = hugeBytes;
+        pageSize = HUGE_PAGE_2MB;
+        return;
+    }
+
+    // Fall back to transparent huge pages, which require 2 MB alignment
+    if (bytes >= HUGE_PAGE_2MB) {
+        table = (HashNode *) alignedMalloc(HUGE_PAGE_2MB, bytes);
+        allocation = HASH_ALLOC_ALIGNED;
+        allocatedBytes = bytes;
+        pageSize = 4096;
+#ifdef MADV_HUGEPAGE
+        if (madvise(table, bytes, MADV_HUGEPAGE) == 0 && transparentHugePagesEnabled())
+            pageSize = HUGE_PAGE_2MB;
+#endif
+        return;
+    }
+#endif
+
+    table = (HashNode *) alignedMalloc(sizeof(HashNode), bytes);
+    allocation = HASH_ALLOC_ALIGNED;
+    allocatedBytes = bytes;
+    pageSize = 4096;
+}
+
+void Hash::release() {
+#ifdef __linux__
+    if (allocation == HASH_ALLOC_MMAP) {
+        munmap(table, allocatedBytes);
+        return;
+    }
+    if (allocation == HASH_ALLOC_FILE) {
+        munmap(mappedFile, allocatedBytes);
+        return;
+    }
+#endif
+    alignedFree(table);
 }
 
 void Hash::incrementAge() {
     age++;
 }
 
-void Hash::clear() {
-    std::memset(static_cast<void*>(table), 0, size * sizeof(HashNode));
+// Zeroes the table with one thread per search thread. Pages are placed on the
+// NUMA node of the thread that first touches them, so when the search threads
+// are pinned, each clearing thread is pinned to the CPU of the search thread
+// with the same ID. The table is then spread across the nodes the search runs
+// on when it is allocated. Unpinned threads leave the placement to the OS.
+void Hash::clear(int numThreads, bool pinThreads) {
+    uint64_t chunk = size / numThreads;
+    std::vector<std::thread> threads;
+    // Unpinned, the calling thread clears the first chunk itself
+    for (int i = pinThreads ? 0 : 1; i < numThreads; i++) {
+        HashNode *start = table + i * chunk;
+        uint64_t nodes = (i == numThreads - 1) ? size - i * chunk : chunk;
+        threads.push_back(std::thread([start, nodes, i, pinThreads] {
+            if (pinThreads)
+                pinToCPU(i);
+            std::memset(static_cast<void*>(start), 0, nodes * sizeof(HashNode));
+        }));
+    }
+    if (!pinThreads)
+        std::memset(static_cast<void*>(table), 0, (numThreads == 1 ? size : chunk) * sizeof(HashNode));
+    for (unsigned int i = 0; i < threads.size(); i++)
+        threads[i].join();
     age = 0;
 }
 
 int Hash::estimateHashfull() const {
     int used = 0;
-    // This will never go out of bounds since a 1 MB table has 32768 slots
-    for (int i = 0; i < 500; i++) {
-        used += ((table + i)->slot1.ageNodeType >> 2) == age;
-        used += ((table + i)->slot2.ageNodeType >> 2) == age;
+    // This will never go out of bounds since a 1 MB table has 16384 buckets
+    for (int i = 0; i < 200; i++) {
+        for (int j = 0; j < HASH_NODE_ENTRIES; j++) {
+            uint64_t data = (table + i)->data[j];
+            used += data && unpackEntry(data).getAge() == age;
+        }
     }
     return used;
 }
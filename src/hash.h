@@ -19,6 +19,8 @@
 #ifndef __HASH_H__
 #define __HASH_H__
 
+#include <string>
+
 #include "board.h"
 #include "common.h"
 
@@ -28,10 +30,10 @@ constexpr uint8_t ALL_NODE = 2;
 constexpr uint8_t NO_NODE_INFO = 3;
 
 
-// Struct storing hashed search information and corresponding hash key.
-// Size: 16 bytes
+// Struct storing hashed search information. The entry is packed into a single
+// 64-bit word so that it can be stored and validated locklessly.
+// Size: 8 bytes
 struct HashEntry {
-    uint64_t zobristKey;
     int16_t score;
     Move move;
     int16_t eval;
@@ -41,33 +43,75 @@ struct HashEntry {
     HashEntry() = default;
     ~HashEntry() = default;
 
-    void setEntry(Board &b, int _score, Move _move, int _eval, int _depth, uint8_t _nodeType, uint8_t _age) {
-        zobristKey = b.getZobristKey();
+    HashEntry(int _score, Move _move, int _eval, int _depth, uint8_t _nodeType, uint8_t _age) {
         score = (int16_t) _score;
         move = _move;
         eval = (int16_t) _eval;
         depth = (int8_t) _depth;
         ageNodeType = (_age << 2) | _nodeType;
     }
+
+    uint8_t getAge() const { return ageNodeType >> 2; }
+    uint8_t getNodeType() const { return ageNodeType & 0x3; }
 };
 
-// This contains each of the hash table entries, in a two-bucket system.
-class HashNode {
-public:
-    HashEntry slot1;
-    HashEntry slot2;
+static_assert(sizeof(HashEntry) == 8, "HashEntry must pack into 64 bits");
+
+constexpr int HASH_NODE_ENTRIES = 5;
+
+// Each hash table bucket fills exactly one cache line and holds five entries.
+// Only the upper 32 bits of the Zobrist key are stored, since the lower bits
+// are implied by the bucket index. The stored key is XORed with both halves
+// of the entry data, so that an entry torn by simultaneous writes from
+// different threads fails validation instead of returning corrupted data.
+struct alignas(64) HashNode {
+    uint64_t data[HASH_NODE_ENTRIES];
+    uint32_t check[HASH_NODE_ENTRIES];
+    uint32_t padding;
+};
+
+static_assert(sizeof(HashNode) == 64, "HashNode must be one cache line");
 
-    HashNode() {}
-    ~HashNode() {}
+// How the table memory was obtained, so that it can be released correctly
+enum HashAllocation {
+    HASH_ALLOC_ALIGNED, HASH_ALLOC_MMAP, HASH_ALLOC_FILE
 };
 
+constexpr uint32_t HASH_FILE_MAGIC = 0x4854544C; // "LTTH"
+constexpr uint32_t HASH_FILE_VERSION = 1;
+
+// Header of a saved table. The buckets follow directly, so that they stay
+// cache line aligned when the file is mapped.
+// Size: 64 bytes
+struct HashFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nodeBytes;
+    uint32_t nodeEntries;
+    // Number of buckets
+    uint64_t size;
+    // Detects tables saved by a build with different Zobrist keys
+    uint64_t zobristCheck;
+    uint8_t age;
+    uint8_t padding[31];
+};
+
+static_assert(sizeof(HashFileHeader) == sizeof(HashNode), "HashFileHeader must be one bucket");
+
 class Hash {
 private:
     HashNode *table;
     uint64_t size;
     uint8_t age;
+    HashAllocation allocation;
+    uint64_t allocatedBytes;
+    uint64_t pageSize;
+    // Start of the file mapping for a loaded table, which includes the header
+    void *mappedFile;
 
-    void init(uint64_t MB);
+    void init(uint64_t MB, int numThreads, bool pinThreads);
+    void allocate(uint64_t bytes);
+    void release();
 
 public:
     Hash(uint64_t MB);
@@ -76,14 +120,19 @@ public:
     ~Hash();
 
     void add(Board &b, int score, Move move, int eval, int depth, uint8_t nodeType);
-    HashEntry *get(Board &b);
+    bool get(Board &b, HashEntry &entry) const;
+    void prefetch(uint64_t key) const;
 
     uint64_t getSize() const;
-    void setSize(uint64_t MB);
+    uint64_t getPageSize() const;
+    void setSize(uint64_t MB, int numThreads, bool pinThreads = false);
+
+    bool save(const std::string &path) const;
+    bool load(const std::string &path);
 
     void incrementAge();
 
-    void clear();
+    void clear(int numThreads, bool pinThreads = false);
     int estimateHashfull() const;
 };
 
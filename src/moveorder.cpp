@@ -27,23 +27,26 @@ constexpr int16_t SCORE_LOSING_CAPTURE = -(1 << 14);
 
 
 MoveOrder::MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams,
-    SearchStackInfo *_ssi, Move _hashed, MoveList _legalMoves) {
-	b = _b;
-	color = _color;
-	depth = _depth;
-	searchParams = _searchParams;
+    SearchStackInfo *_ssi, Move _hashed, bool _isInCheck, MoveList &_legalMoves)
+    : legalMoves(_legalMoves) {
+    b = _b;
+    color = _color;
+    depth = _depth;
+    searchParams = _searchParams;
     ssi = _ssi;
     mgStage = STAGE_NONE;
     scoreSize = 0;
     quietStart = 0;
     index = 0;
     hashed = _hashed;
-    legalMoves = _legalMoves;
+    isInCheck = _isInCheck;
+    numRefutations = 0;
     captureMargin = 0;
 }
 
 MoveOrder::MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams,
-    SearchStackInfo *_ssi, Move _hashed, MoveList _legalMoves, int _captureMargin) {
+    SearchStackInfo *_ssi, Move _hashed, MoveList &_legalMoves, int _captureMargin)
+    : legalMoves(_legalMoves) {
     b = _b;
     color = _color;
     depth = _depth;
@@ -54,11 +57,14 @@ MoveOrder::MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searc
     quietStart = 0;
     index = 0;
     hashed = _hashed;
-    legalMoves = _legalMoves;
+    isInCheck = false;
+    numRefutations = 0;
     captureMargin = _captureMargin;
 }
 
-MoveOrder::MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams) {
+MoveOrder::MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams,
+    MoveList &_legalMoves)
+    : legalMoves(_legalMoves) {
     b = _b;
     color = _color;
     depth = _depth;
@@ -69,6 +75,8 @@ MoveOrder::MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searc
     quietStart = 0;
     index = 0;
     hashed = NULL_MOVE;
+    isInCheck = false;
+    numRefutations = 0;
 }
 
 // Returns true if there are still moves remaining, false if we have
@@ -80,11 +88,13 @@ void MoveOrder::generateMoves() {
             if (hashed != NULL_MOVE) {
                 mgStage = STAGE_HASH_MOVE;
 
-                // Remove the hash move from the list, since it has already been tried
-                for (unsigned int i = 0; i < legalMoves.size(); i++) {
-                    if (legalMoves.get(i) == hashed) {
-                        legalMoves.remove(i);
-                        break;
+                // Remove the hash move from the evasions, since it has already been tried
+                if (isInCheck) {
+                    for (unsigned int i = 0; i < legalMoves.size(); i++) {
+                        if (legalMoves.get(i) == hashed) {
+                            legalMoves.remove(i);
+                            break;
+                        }
                     }
                 }
 
@@ -95,14 +105,44 @@ void MoveOrder::generateMoves() {
         // If we just searched the hash move (or there is none), we need to find
         // where the quiet moves start in the list, and then score captures.
         case STAGE_HASH_MOVE:
-            findQuietStart();
             mgStage = STAGE_CAPTURES;
+            if (isInCheck)
+                findQuietStart();
+            else {
+                b->getPseudoLegalCaptures(legalMoves, color, true);
+                quietStart = legalMoves.size();
+            }
             scoreCaptures();
             break;
 
-        // After winnning captures, we score quiets
+        // After winning captures, the killers and counter moves are tried one
+        // at a time, since a cutoff from one of them saves generating and
+        // sorting the quiets. Evasions have all been generated already.
         case STAGE_CAPTURES:
+            if (isInCheck) {
+                mgStage = STAGE_QUIETS;
+                scoreQuiets();
+            }
+            else
+                mgStage = STAGE_KILLER_1;
+            break;
+
+        case STAGE_KILLER_1:
+            mgStage = STAGE_KILLER_2;
+            break;
+
+        case STAGE_KILLER_2:
+            mgStage = STAGE_COUNTER_MOVE;
+            break;
+
+        case STAGE_COUNTER_MOVE:
+            mgStage = STAGE_FOLLOWUP_MOVE;
+            break;
+
+        case STAGE_FOLLOWUP_MOVE:
             mgStage = STAGE_QUIETS;
+            quietStart = legalMoves.size();
+            b->getPseudoLegalQuiets(legalMoves, color);
             scoreQuiets();
             break;
 
@@ -150,6 +190,8 @@ void MoveOrder::generateMoves() {
 void MoveOrder::scoreCaptures() {
     for (unsigned int i = 0; i < quietStart; i++) {
         Move m = legalMoves.get(i);
+        if (m == hashed)
+            continue;
         int startSq = getStartSq(m);
         int endSq = getEndSq(m);
         int pieceID = b->getPieceOnSquare(color, startSq);
@@ -165,8 +207,10 @@ void MoveOrder::scoreCaptures() {
 void MoveOrder::scoreQuiets() {
     for (unsigned int i = quietStart; i < legalMoves.size(); i++) {
         Move m = legalMoves.get(i);
+        if (m == hashed || isRefutation(m))
+            continue;
 
-        // Score killers below even captures but above losing captures
+        // Score killer evasions below even captures but above losing captures
         if (m == searchParams->killers[ssi->ply][0])
             scores.add(ScoredMove(m, SCORE_QUEEN_PROMO - 1));
         else if (m == searchParams->killers[ssi->ply][1])
@@ -206,6 +250,11 @@ Move MoveOrder::nextMove() {
             return NULL_MOVE;
         else {
             generateMoves();
+            if (mgStage >= STAGE_KILLER_1 && mgStage <= STAGE_FOLLOWUP_MOVE) {
+                Move m = nextRefutation();
+                if (m != NULL_MOVE)
+                    return m;
+            }
         }
     }
 
@@ -233,6 +282,41 @@ Move MoveOrder::nextMove() {
     return scores.get(index++).m;
 }
 
+// Returns the killer or counter move for the current stage if it has not been
+// tried yet and is a quiet move that can be played in this position.
+Move MoveOrder::nextRefutation() {
+    Move m = NULL_MOVE;
+    if (mgStage == STAGE_KILLER_1)
+        m = searchParams->killers[ssi->ply][0];
+    else if (mgStage == STAGE_KILLER_2)
+        m = searchParams->killers[ssi->ply][1];
+    else if (mgStage == STAGE_COUNTER_MOVE && ssi->counterMove != nullptr)
+        m = *(ssi->counterMove);
+    else if (mgStage == STAGE_FOLLOWUP_MOVE && ssi->followupMove != nullptr)
+        m = *(ssi->followupMove);
+
+    if (m == NULL_MOVE || m == hashed || isRefutation(m)
+     || !b->isPseudoLegalQuiet(m, color))
+        return NULL_MOVE;
+
+    // The move is also put into the scored list, ahead of any delayed losing
+    // captures, so that the history updates treat it like any other move
+    refutations[numRefutations++] = m;
+    scores.add(ScoredMove(m, 0));
+    scores.swap(scoreSize, scores.size() - 1);
+    scoreSize++;
+    index++;
+    return m;
+}
+
+bool MoveOrder::isRefutation(Move m) const {
+    for (unsigned int i = 0; i < numRefutations; i++) {
+        if (refutations[i] == m)
+            return true;
+    }
+    return false;
+}
+
 // When a PV or cut move is found, the history of the best move in increased,
 // and the histories of all moves searched prior to the best move are reduced.
 void MoveOrder::updateHistories(Move bestMove) {
@@ -25,7 +25,9 @@
 #include "searchparams.h"
 
 enum MoveGenStage {
-    STAGE_NONE, STAGE_HASH_MOVE, STAGE_CAPTURES, STAGE_QUIETS,
+    STAGE_NONE, STAGE_HASH_MOVE, STAGE_CAPTURES,
+    STAGE_KILLER_1, STAGE_KILLER_2, STAGE_COUNTER_MOVE, STAGE_FOLLOWUP_MOVE,
+    STAGE_QUIETS,
     STAGE_QS_CAPTURES, STAGE_QS_PROMOTIONS, STAGE_QS_CHECKS, STAGE_QS_DONE
 };
 
@@ -55,7 +57,14 @@ struct MoveOrder {
     SearchStackInfo *ssi;
     MoveGenStage mgStage;
     Move hashed;
-    MoveList legalMoves;
+    // Evasions are generated by the caller, otherwise captures and quiets
+    // are generated here in stages
+    bool isInCheck;
+    MoveList &legalMoves;
+    // Killers and counter moves already returned, so that they are not
+    // searched again with the quiets
+    Move refutations[4];
+    unsigned int numRefutations;
     SearchArrayList<ScoredMove> scores;
     unsigned int scoreSize;
     unsigned int quietStart;
@@ -63,11 +72,12 @@ struct MoveOrder {
     int captureMargin;
 
     MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams,
-        SearchStackInfo *_ssi, Move _hashed, MoveList _legalMoves);
+        SearchStackInfo *_ssi, Move _hashed, bool _isInCheck, MoveList &_legalMoves);
     MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams,
-        SearchStackInfo *_ssi, Move _hashed, MoveList _legalMoves, int _captureMargin);
+        SearchStackInfo *_ssi, Move _hashed, MoveList &_legalMoves, int _captureMargin);
     // Overloaded constructor for quiescence search
-    MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams);
+    MoveOrder(Board *_b, int _color, int _depth, SearchParameters *_searchParams,
+        MoveList &_legalMoves);
 
     void generateMoves();
     Move nextMove();
@@ -78,6 +88,8 @@ private:
     void scoreCaptures();
     void scoreQuiets();
     void findQuietStart();
+    Move nextRefutation();
+    bool isRefutation(Move m) const;
 };
 
 #endif
\ No newline at end of file
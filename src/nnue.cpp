@@ -0,0 +1,343 @@
+/*
+    Laser, a UCI chess engine written in C++11.
+    Copyright 2015-2018 Jeffrey An and Michael An
+
+    Laser is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Laser is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Laser.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include "eval.h"
+#include "nnue.h"
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * Network file format, all values little-endian:
+ *   char[4] magic "LNUE", uint32 version,
+ *   uint32 inputs, uint32 L1, uint32 L2, uint32 L3 (must match this build),
+ *   int16 ftBiases[L1], int16 ftWeights[inputs][L1],
+ *   int32 l1Biases[L2], int8 l1Weights[L2][2*L1],
+ *   int32 l2Biases[L3], int8 l2Weights[L3][L2],
+ *   int32 outBias, int8 outWeights[L3]
+ * Accumulator values are scaled so that 1.0 = 127, hidden layer weights so
+ * that 1.0 = 64, and the output is divided by OUTPUT_SCALE to get internal
+ * evaluation units.
+ */
+constexpr char NNUE_MAGIC[4] = {'L', 'N', 'U', 'E'};
+constexpr uint32_t NNUE_VERSION = 1;
+constexpr int WEIGHT_SHIFT = 6;
+constexpr int OUTPUT_SCALE = 16;
+
+namespace {
+
+struct Network {
+    alignas(64) int16_t ftBiases[NNUE_L1];
+    alignas(64) int16_t ftWeights[NNUE_INPUTS][NNUE_L1];
+    alignas(64) int8_t l1Weights[NNUE_L2][2 * NNUE_L1];
+    alignas(64) int8_t l2Weights[NNUE_L3][NNUE_L2];
+    alignas(64) int8_t outWeights[NNUE_L3];
+    int32_t l1Biases[NNUE_L2];
+    int32_t l2Biases[NNUE_L3];
+    int32_t outBias;
+};
+
+Network *network = nullptr;
+
+// Each perspective sees the board from its own side, with its own pieces first
+inline int featureIndex(int perspective, int kingSq, int color, int piece, int sq) {
+    if (perspective == BLACK) {
+        kingSq ^= 56;
+        sq ^= 56;
+    }
+    return 640 * kingSq + 64 * (5 * (color != perspective) + piece) + sq;
+}
+
+// These loops are simple enough for the compiler to vectorize
+inline void addFeature(int16_t *acc, int feature) {
+    const int16_t *w = network->ftWeights[feature];
+    for (int i = 0; i < NNUE_L1; i++)
+        acc[i] += w[i];
+}
+
+inline void subFeature(int16_t *acc, int feature) {
+    const int16_t *w = network->ftWeights[feature];
+    for (int i = 0; i < NNUE_L1; i++)
+        acc[i] -= w[i];
+}
+
+// Computes output = biases + weights * input for a row-major int8 weight
+// matrix and inputs in [0, 127]. IN must be a multiple of 32.
+template <int IN, int OUT>
+void affine(const uint8_t *input, const int8_t *weights, const int32_t *biases,
+        int32_t *output) {
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi16(1);
+    for (int i = 0; i < OUT; i++) {
+        __m256i sum = _mm256_setzero_si256();
+        for (int j = 0; j < IN; j += 32) {
+            __m256i in = _mm256_loadu_si256((const __m256i *) (input + j));
+            __m256i w = _mm256_loadu_si256((const __m256i *) (weights + i * IN + j));
+            // 2 * 127 * 128 cannot saturate the int16 pair sums
+            __m256i prod = _mm256_maddubs_epi16(in, w);
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(prod, ones));
+        }
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+        output[i] = biases[i] + _mm_cvtsi128_si32(s);
+    }
+#elif defined(__SSE4_1__)
+    const __m128i ones = _mm_set1_epi16(1);
+    for (int i = 0; i < OUT; i++) {
+        __m128i sum = _mm_setzero_si128();
+        for (int j = 0; j < IN; j += 16) {
+            __m128i in = _mm_loadu_si128((const __m128i *) (input + j));
+            __m128i w = _mm_loadu_si128((const __m128i *) (weights + i * IN + j));
+            __m128i prod = _mm_maddubs_epi16(in, w);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(prod, ones));
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+        output[i] = biases[i] + _mm_cvtsi128_si32(sum);
+    }
+#elif defined(__ARM_NEON)
+    for (int i = 0; i < OUT; i++) {
+        int32x4_t sum = vdupq_n_s32(0);
+        for (int j = 0; j < IN; j += 16) {
+            // Inputs are at most 127, so they can be loaded as signed
+            int8x16_t in = vld1q_s8((const int8_t *) (input + j));
+            int8x16_t w = vld1q_s8(weights + i * IN + j);
+            int16x8_t prod = vmull_s8(vget_low_s8(in), vget_low_s8(w));
+            prod = vmlal_s8(prod, vget_high_s8(in), vget_high_s8(w));
+            sum = vpadalq_s16(sum, prod);
+        }
+        output[i] = biases[i] + vgetq_lane_s32(sum, 0) + vgetq_lane_s32(sum, 1)
+                  + vgetq_lane_s32(sum, 2) + vgetq_lane_s32(sum, 3);
+    }
+#else
+    for (int i = 0; i < OUT; i++) {
+        int32_t sum = biases[i];
+        for (int j = 0; j < IN; j++)
+            sum += weights[i * IN + j] * input[j];
+        output[i] = sum;
+    }
+#endif
+}
+
+// Clipped ReLU on a hidden layer output
+template <int SIZE>
+void activate(const int32_t *input, uint8_t *output) {
+    for (int i = 0; i < SIZE; i++)
+        output[i] = (uint8_t) std::max(0, std::min(127, input[i] >> WEIGHT_SHIFT));
+}
+
+template <typename T>
+bool readArray(std::ifstream &file, T *data, size_t count) {
+    file.read((char *) data, count * sizeof(T));
+    return (bool) file;
+}
+
+} // namespace
+
+
+//------------------------------Network loading---------------------------------
+bool loadNNUE(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    char magic[4];
+    uint32_t header[5];
+    if (!readArray(file, magic, 4) || !readArray(file, header, 5))
+        return false;
+    if (std::memcmp(magic, NNUE_MAGIC, 4) || header[0] != NNUE_VERSION
+     || header[1] != NNUE_INPUTS || header[2] != NNUE_L1
+     || header[3] != NNUE_L2 || header[4] != NNUE_L3)
+        return false;
+
+    Network *net = (Network *) alignedMalloc(64, sizeof(Network));
+    if (net == nullptr)
+        return false;
+    bool success = readArray(file, net->ftBiases, NNUE_L1)
+                && readArray(file, &net->ftWeights[0][0], NNUE_INPUTS * NNUE_L1)
+                && readArray(file, net->l1Biases, NNUE_L2)
+                && readArray(file, &net->l1Weights[0][0], NNUE_L2 * 2 * NNUE_L1)
+                && readArray(file, net->l2Biases, NNUE_L3)
+                && readArray(file, &net->l2Weights[0][0], NNUE_L3 * NNUE_L2)
+                && readArray(file, &net->outBias, 1)
+                && readArray(file, net->outWeights, NNUE_L3);
+    // The file must end exactly after the output layer
+    if (!success || file.peek() != std::ifstream::traits_type::eof()) {
+        alignedFree(net);
+        return false;
+    }
+
+    alignedFree(network);
+    network = net;
+    return true;
+}
+
+bool isNNUELoaded() {
+    return network != nullptr;
+}
+
+
+//----------------------------Accumulator stack---------------------------------
+NNUEAccumulatorStack::NNUEAccumulatorStack() {
+    stack = (NNUEAccumulator *) alignedMalloc(64, NNUE_STACK_SIZE * sizeof(NNUEAccumulator));
+    reset();
+}
+
+NNUEAccumulatorStack::~NNUEAccumulatorStack() {
+    alignedFree(stack);
+}
+
+void NNUEAccumulatorStack::reset() {
+    top = 0;
+    stack[0].computed[WHITE] = stack[0].computed[BLACK] = false;
+    stack[0].kingMoved[WHITE] = stack[0].kingMoved[BLACK] = false;
+    stack[0].dirtyCount = 0;
+}
+
+void NNUEAccumulatorStack::push(const Board &b, Move m, int color, const UndoInfo &undo) {
+    assert(top + 1 < NNUE_STACK_SIZE);
+    NNUEAccumulator &acc = stack[++top];
+    acc.computed[WHITE] = acc.computed[BLACK] = false;
+    acc.kingMoved[WHITE] = acc.kingMoved[BLACK] = false;
+    acc.dirtyCount = 0;
+
+    int startSq = getStartSq(m);
+    int endSq = getEndSq(m);
+    int piece = b.getPieceOnSquare(color, endSq);
+    // Kings are not features, but every feature of the king's own side
+    // depends on its square
+    if (piece == KINGS) {
+        acc.kingMoved[color] = true;
+        if (isCastle(m)) {
+            int rookStart = (endSq > startSq) ? startSq + 3 : startSq - 4;
+            int rookEnd = (endSq > startSq) ? startSq + 1 : startSq - 1;
+            acc.dirty[acc.dirtyCount++] = {(int8_t) color, ROOKS, (int8_t) rookStart, (int8_t) rookEnd};
+        }
+    }
+    else if (isPromotion(m)) {
+        acc.dirty[acc.dirtyCount++] = {(int8_t) color, PAWNS, (int8_t) startSq, -1};
+        acc.dirty[acc.dirtyCount++] = {(int8_t) color, (int8_t) piece, -1, (int8_t) endSq};
+    }
+    else
+        acc.dirty[acc.dirtyCount++] = {(int8_t) color, (int8_t) piece, (int8_t) startSq, (int8_t) endSq};
+
+    if (undo.capturedPiece != -1) {
+        int captureSq = isEP(m) ? ((color == WHITE) ? endSq - 8 : endSq + 8) : endSq;
+        acc.dirty[acc.dirtyCount++] = {(int8_t) (color ^ 1), (int8_t) undo.capturedPiece,
+                                       (int8_t) captureSq, -1};
+    }
+}
+
+void NNUEAccumulatorStack::pushNull() {
+    assert(top + 1 < NNUE_STACK_SIZE);
+    NNUEAccumulator &acc = stack[++top];
+    acc.computed[WHITE] = acc.computed[BLACK] = false;
+    acc.kingMoved[WHITE] = acc.kingMoved[BLACK] = false;
+    acc.dirtyCount = 0;
+}
+
+// Computes the accumulator at the top of the stack from scratch
+void NNUEAccumulatorStack::refresh(const Board &b, int perspective) {
+    int16_t *acc = stack[top].values[perspective];
+    std::memcpy(acc, network->ftBiases, sizeof(network->ftBiases));
+    int kingSq = b.getKingSq(perspective);
+    for (int color = WHITE; color <= BLACK; color++) {
+        for (int piece = PAWNS; piece <= QUEENS; piece++) {
+            uint64_t bb = b.getPieces(color, piece);
+            while (bb) {
+                int sq = bitScanForward(bb);
+                bb &= bb - 1;
+                addFeature(acc, featureIndex(perspective, kingSq, color, piece, sq));
+            }
+        }
+    }
+    stack[top].computed[perspective] = true;
+}
+
+// Computes the accumulator at index from the one below it
+void NNUEAccumulatorStack::update(int index, int perspective, int kingSq) {
+    NNUEAccumulator &acc = stack[index];
+    std::memcpy(acc.values[perspective], stack[index - 1].values[perspective],
+        sizeof(acc.values[perspective]));
+    for (int i = 0; i < acc.dirtyCount; i++) {
+        const DirtyPiece &d = acc.dirty[i];
+        if (d.from >= 0)
+            subFeature(acc.values[perspective], featureIndex(perspective, kingSq, d.color, d.piece, d.from));
+        if (d.to >= 0)
+            addFeature(acc.values[perspective], featureIndex(perspective, kingSq, d.color, d.piece, d.to));
+    }
+    acc.computed[perspective] = true;
+}
+
+int NNUEAccumulatorStack::evaluate(const Board &b) {
+    for (int perspective = WHITE; perspective <= BLACK; perspective++) {
+        if (stack[top].computed[perspective])
+            continue;
+        // Find the nearest computed ancestor. If the king has moved since
+        // then, an incremental update is impossible.
+        int i = top;
+        bool needsRefresh = false;
+        while (!stack[i].computed[perspective]) {
+            if (i == 0 || stack[i].kingMoved[perspective]) {
+                needsRefresh = true;
+                break;
+            }
+            i--;
+        }
+        if (needsRefresh)
+            refresh(b, perspective);
+        else {
+            int kingSq = b.getKingSq(perspective);
+            for (int j = i + 1; j <= top; j++)
+                update(j, perspective, kingSq);
+        }
+    }
+
+    int color = b.getPlayerToMove();
+    alignas(64) uint8_t transformed[2 * NNUE_L1];
+    const int16_t *us = stack[top].values[color];
+    const int16_t *them = stack[top].values[color ^ 1];
+    for (int i = 0; i < NNUE_L1; i++) {
+        transformed[i] = (uint8_t) std::max(0, std::min(127, (int) us[i]));
+        transformed[NNUE_L1 + i] = (uint8_t) std::max(0, std::min(127, (int) them[i]));
+    }
+
+    alignas(64) int32_t l1Out[NNUE_L2];
+    alignas(64) uint8_t l1Act[NNUE_L2];
+    affine<2 * NNUE_L1, NNUE_L2>(transformed, &network->l1Weights[0][0], network->l1Biases, l1Out);
+    activate<NNUE_L2>(l1Out, l1Act);
+
+    alignas(64) int32_t l2Out[NNUE_L3];
+    alignas(64) uint8_t l2Act[NNUE_L3];
+    affine<NNUE_L2, NNUE_L3>(l1Act, &network->l2Weights[0][0], network->l2Biases, l2Out);
+    activate<NNUE_L3>(l2Out, l2Act);
+
+    int32_t output;
+    affine<NNUE_L3, 1>(l2Act, network->outWeights, &network->outBias, &output);
+
+    // Keep network scores out of the tablebase and mate ranges
+    return std::max(-TB_WIN + 1, std::min(TB_WIN - 1, output / OUTPUT_SCALE));
+}
@@ -0,0 +1,94 @@
+/*
+    Laser, a UCI chess engine written in C++11.
+    Copyright 2015-2018 Jeffrey An and Michael An
+
+    Laser is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Laser is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Laser.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __NNUE_H__
+#define __NNUE_H__
+
+#include <string>
+#include "board.h"
+#include "common.h"
+
+/**
+ * An optional efficiently updatable neural network evaluation.
+ * Architecture: HalfKP features (king square x non-king piece x square, from
+ * each side's perspective) -> 2x256 int16 accumulator -> 32 -> 32 -> 1, with
+ * int8 weights and clipped ReLU activations in the hidden layers.
+ */
+constexpr int NNUE_INPUTS = 64 * 10 * 64;
+constexpr int NNUE_L1 = 256;
+constexpr int NNUE_L2 = 32;
+constexpr int NNUE_L3 = 32;
+
+// Enough entries for the maximum search depth plus quiescence captures
+constexpr int NNUE_STACK_SIZE = 256;
+static_assert(NNUE_STACK_SIZE > MAX_DEPTH + 1, "NNUE stack must hold the main search plies");
+
+// A piece that was moved, added (from = -1), or removed (to = -1) by a move
+struct DirtyPiece {
+    int8_t color;
+    int8_t piece;
+    int8_t from;
+    int8_t to;
+};
+
+struct NNUEAccumulator {
+    alignas(64) int16_t values[2][NNUE_L1];
+    bool computed[2];
+    // If the king of a perspective moved, the features of that perspective
+    // must be refreshed from scratch
+    bool kingMoved[2];
+    int dirtyCount;
+    DirtyPiece dirty[3];
+};
+
+/**
+ * @brief A per-ply stack of accumulators for one search thread. Pushing only
+ * records the pieces changed by a move; the accumulator values are computed
+ * lazily when a position is evaluated, from the nearest computed ancestor.
+ */
+class NNUEAccumulatorStack {
+private:
+    NNUEAccumulator *stack;
+    int top;
+
+    void refresh(const Board &b, int perspective);
+    void update(int index, int perspective, int kingSq);
+
+public:
+    NNUEAccumulatorStack();
+    ~NNUEAccumulatorStack();
+    NNUEAccumulatorStack(const NNUEAccumulatorStack &other) = delete;
+    NNUEAccumulatorStack& operator=(const NNUEAccumulatorStack &other) = delete;
+
+    // Starts a new stack with b as the current position
+    void reset();
+    // Records the move m by color, called with b already updated
+    void push(const Board &b, Move m, int color, const UndoInfo &undo);
+    void pushNull();
+    void pop() { top--; }
+
+    // Returns the evaluation of b from the side to move's perspective
+    int evaluate(const Board &b);
+};
+
+// Loads a network file. Returns false and keeps the previous network (if any)
+// if the file is missing or malformed.
+bool loadNNUE(const std::string &path);
+bool isNNUELoaded();
+
+#endif
@@ -0,0 +1,139 @@
+/*
+    Laser, a UCI chess engine written in C++11.
+    Copyright 2015-2018 Jeffrey An and Michael An
+
+    Laser is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Laser is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Laser.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdlib>
+#include <iostream>
+
+#include "output.h"
+
+// Info lines with a PV supersede queued lines for the same multipv slot, and
+// currmove lines supersede each other. Everything else is always written.
+static int getCoalescingKey(const std::string &line) {
+    if (line.compare(0, 5, "info ") != 0)
+        return -1;
+    if (line.find(" currmove ") != std::string::npos)
+        return 0;
+    if (line.find(" pv ") == std::string::npos)
+        return -1;
+    std::string::size_type multiPVPos = line.find(" multipv ");
+    if (multiPVPos == std::string::npos)
+        return 1;
+    return std::atoi(line.c_str() + multiPVPos + 9);
+}
+
+OutputWriter::OutputWriter()
+    : nextInfoTime(std::chrono::steady_clock::now()),
+      infoInterval(0),
+      alwaysQueued(0),
+      flushWaiters(0),
+      writing(false),
+      exiting(false) {
+    writerThread = std::thread(&OutputWriter::writerLoop, this);
+}
+
+OutputWriter::~OutputWriter() {
+    {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        exiting = true;
+    }
+    writeCV.notify_one();
+    writerThread.join();
+}
+
+void OutputWriter::write(const std::string &line) {
+    {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        lines.push_back({line, -1});
+        alwaysQueued++;
+    }
+    writeCV.notify_one();
+}
+
+void OutputWriter::writeInfo(const std::string &line) {
+    int key = getCoalescingKey(line);
+    if (key < 0) {
+        write(line);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        // Lines are never moved past a line that is always written
+        for (auto it = lines.rbegin(); it != lines.rend() && it->key != -1; ++it) {
+            if (it->key == key) {
+                it->text = line;
+                return;
+            }
+        }
+        lines.push_back({line, key});
+    }
+    writeCV.notify_one();
+}
+
+void OutputWriter::flush() {
+    std::unique_lock<std::mutex> lock(outputMutex);
+    flushWaiters++;
+    writeCV.notify_one();
+    emptyCV.wait(lock, [this] { return lines.empty() && !writing; });
+    flushWaiters--;
+}
+
+void OutputWriter::setInfoRate(int linesPerSecond) {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    infoInterval = std::chrono::microseconds(linesPerSecond > 0 ? 1000000 / linesPerSecond : 0);
+}
+
+void OutputWriter::writerLoop() {
+    std::unique_lock<std::mutex> lock(outputMutex);
+    while (true) {
+        bool isHeldBack = !lines.empty() && lines.front().key >= 0
+                       && alwaysQueued == 0 && flushWaiters == 0 && !exiting
+                       && std::chrono::steady_clock::now() < nextInfoTime;
+        if (lines.empty() || isHeldBack) {
+            // Flush once a batch of lines has been written, before waiting
+            if (writing) {
+                lock.unlock();
+                std::cout.flush();
+                lock.lock();
+                writing = false;
+                continue;
+            }
+            if (lines.empty()) {
+                emptyCV.notify_all();
+                if (exiting)
+                    return;
+                writeCV.wait(lock);
+            }
+            else
+                writeCV.wait_until(lock, nextInfoTime);
+            continue;
+        }
+
+        OutputLine line = std::move(lines.front());
+        lines.pop_front();
+        if (line.key < 0)
+            alwaysQueued--;
+        else
+            nextInfoTime = std::chrono::steady_clock::now() + infoInterval;
+        writing = true;
+
+        lock.unlock();
+        std::cout << line.text << '\n';
+        lock.lock();
+    }
+}
@@ -0,0 +1,81 @@
+/*
+    Laser, a UCI chess engine written in C++11.
+    Copyright 2015-2018 Jeffrey An and Michael An
+
+    Laser is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Laser is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Laser.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * Writes UCI output from a background thread, so that searching threads only
+ * queue lines and never block on a slow pipe to the GUI. Info lines are
+ * coalesced: a new line replaces a queued line for the same multipv slot (or
+ * the queued currmove line), so the queue stays bounded even when output
+ * cannot keep up. With a rate limit, info lines are held back to at most the
+ * given number per second. All other lines, including "info string" and
+ * bestmove, are always written, in order, and first release any info lines
+ * queued before them.
+ */
+class OutputWriter {
+public:
+    OutputWriter();
+    OutputWriter(const OutputWriter &other) = delete;
+    OutputWriter& operator=(const OutputWriter &other) = delete;
+    // Writes all queued lines before returning
+    ~OutputWriter();
+
+    // Queues a line that is always written
+    void write(const std::string &line);
+    // Queues an info line that may be coalesced with later ones
+    void writeInfo(const std::string &line);
+    // Blocks until every queued line has been written
+    void flush();
+    // Maximum info lines per second, or 0 for no limit
+    void setInfoRate(int linesPerSecond);
+
+private:
+    struct OutputLine {
+        std::string text;
+        // The coalescing key of info lines, or -1 for lines always written
+        int key;
+    };
+
+    std::deque<OutputLine> lines;
+    std::mutex outputMutex;
+    // Wakes the writer when lines are queued or it should exit
+    std::condition_variable writeCV;
+    // Signals flush() when the queue is empty
+    std::condition_variable emptyCV;
+    std::chrono::steady_clock::time_point nextInfoTime;
+    std::chrono::microseconds infoInterval;
+    int alwaysQueued;
+    // Number of threads waiting in flush(), which releases held back lines
+    int flushWaiters;
+    bool writing;
+    bool exiting;
+    std::thread writerThread;
+
+    void writerLoop();
+};
+
+#endif
@@ -0,0 +1,135 @@
+/*
+    Laser, a UCI chess engine written in C++11.
+    Copyright 2015-2018 Jeffrey An and Michael An
+
+    Laser is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Laser is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Laser.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "perft.h"
+
+namespace {
+
+// Each entry stores its key XORed with its count, so a torn write from
+// another thread fails validation instead of returning a wrong count.
+struct PerftEntry {
+    std::atomic<uint64_t> check;
+    std::atomic<uint64_t> count;
+};
+
+PerftEntry *perftTable = nullptr;
+uint64_t perftTableMask = 0;
+
+// Positions at different depths share the same Zobrist key
+inline uint64_t perftKey(const Board &b, int depth) {
+    return b.getZobristKey() ^ (0x9E3779B97F4A7C15ULL * (uint64_t) depth);
+}
+
+// At the last ply the moves do not need to be made, since every generated
+// move is legal
+uint64_t countLegalMoves(const Board &b, int color) {
+    MoveList moves;
+    b.getLegalMoves(moves, color);
+    return moves.size();
+}
+
+uint64_t perftHashed(Board &b, int color, int depth) {
+    if (depth == 0)
+        return 1;
+    if (depth == 1)
+        return countLegalMoves(b, color);
+
+    uint64_t key = perftKey(b, depth);
+    if (perftTable != nullptr) {
+        PerftEntry &entry = perftTable[key & perftTableMask];
+        uint64_t count = entry.count.load(std::memory_order_relaxed);
+        if ((entry.check.load(std::memory_order_relaxed) ^ count) == key)
+            return count;
+    }
+
+    uint64_t nodes = 0;
+    MoveList legalMoves;
+    b.getLegalMoves(legalMoves, color);
+    for (unsigned int i = 0; i < legalMoves.size(); i++) {
+        UndoInfo undo;
+        b.makeMove(legalMoves.get(i), color, undo);
+        nodes += perftHashed(b, color^1, depth-1);
+        b.unmakeMove(legalMoves.get(i), color, undo);
+    }
+
+    if (perftTable != nullptr) {
+        PerftEntry &entry = perftTable[key & perftTableMask];
+        entry.check.store(key ^ nodes, std::memory_order_relaxed);
+        entry.count.store(nodes, std::memory_order_relaxed);
+    }
+    return nodes;
+}
+
+} // namespace
+
+
+uint64_t parallelPerft(const Board &b, int depth, int threads, uint64_t hashMB, bool divide) {
+    if (depth <= 0)
+        return 1;
+
+    int color = b.getPlayerToMove();
+    MoveList rootMoves = b.getAllLegalMoves(color);
+
+    // Round the table down to a power of two number of entries
+    if (hashMB > 0 && depth > 2) {
+        uint64_t entries = 1;
+        while (2 * entries * sizeof(PerftEntry) <= (hashMB << 20))
+            entries *= 2;
+        perftTable = (PerftEntry *) alignedMalloc(64, entries * sizeof(PerftEntry));
+        if (perftTable != nullptr) {
+            perftTableMask = entries - 1;
+            for (uint64_t i = 0; i < entries; i++) {
+                perftTable[i].check.store(0, std::memory_order_relaxed);
+                perftTable[i].count.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Threads take the next unclaimed root move until none are left
+    std::vector<uint64_t> counts(rootMoves.size(), 0);
+    std::atomic<unsigned int> nextMove(0);
+    auto worker = [&]() {
+        for (unsigned int i = nextMove++; i < rootMoves.size(); i = nextMove++) {
+            Board copy = b.staticCopy();
+            copy.doMove(rootMoves.get(i), color);
+            counts[i] = perftHashed(copy, color^1, depth-1);
+        }
+    };
+
+    std::vector<std::thread> helpers;
+    for (int i = 1; i < threads; i++)
+        helpers.push_back(std::thread(worker));
+    worker();
+    for (unsigned int i = 0; i < helpers.size(); i++)
+        helpers[i].join();
+
+    alignedFree(perftTable);
+    perftTable = nullptr;
+
+    uint64_t nodes = 0;
+    for (unsigned int i = 0; i < rootMoves.size(); i++) {
+        if (divide)
+            std::cerr << moveToString(rootMoves.get(i)) << ": " << counts[i] << std::endl;
+        nodes += counts[i];
+    }
+    return nodes;
+}
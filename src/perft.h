@@ -0,0 +1,35 @@
+/*
+    Laser, a UCI chess engine written in C++11.
+    Copyright 2015-2018 Jeffrey An and Michael An
+
+    Laser is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Laser is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Laser.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PERFT_H__
+#define __PERFT_H__
+
+#include <cstdint>
+#include "board.h"
+
+constexpr uint64_t DEFAULT_PERFT_HASH_SIZE = 64;
+
+/*
+ * Counts the leaf nodes depth plies from b. Root moves are split over the
+ * given number of threads, subtree counts are cached in a shared table of
+ * hashMB megabytes (0 for none), and legal moves are bulk counted at the last
+ * ply. If divide is set, the count for each root move is printed.
+ */
+uint64_t parallelPerft(const Board &b, int depth, int threads, uint64_t hashMB, bool divide);
+
+#endif
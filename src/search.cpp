@@ -19,15 +19,19 @@
 #include <algorithm>
 #include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <mutex>
+#include <sstream>
 #include <thread>
 #include <vector>
 #include "eval.h"
 #include "hash.h"
 #include "search.h"
 #include "moveorder.h"
+#include "nnue.h"
 #include "searchparams.h"
 #include "timeman.h"
 #include "uci.h"
@@ -42,6 +46,12 @@ using std::endl;
 struct SearchStatistics {
     uint64_t nodes;
     uint64_t tbhits;
+    uint64_t hashProbes;
+    uint64_t hashHits;
+    // Nodes spent on each root move this search, indexed by start and end
+    // square, and their total. Used by the time management.
+    uint64_t rootMoveNodes[64][64];
+    uint64_t rootNodes;
 
     SearchStatistics() {
         reset();
@@ -50,6 +60,125 @@ struct SearchStatistics {
     void reset() {
         nodes = 0;
         tbhits = 0;
+        hashProbes = 0;
+        hashHits = 0;
+        std::memset(rootMoveNodes, 0, sizeof(rootMoveNodes));
+        rootNodes = 0;
+    }
+
+    // The fraction of the root nodes spent on a move
+    double getRootEffort(Move m) const {
+        return rootNodes ? (double) rootMoveNodes[getStartSq(m)][getEndSq(m)] / rootNodes : 0.0;
+    }
+};
+
+// Detailed per-thread search counters, only compiled in with USE_SEARCH_STATS.
+// Pruning counts are indexed by the depth the decision was made at.
+constexpr int STATS_DEPTHS = 16;
+constexpr int STATS_CUTOFF_INDICES = 8;
+
+struct SearchCounters {
+    uint64_t qsNodes;
+    uint64_t ttCutoffs[3];
+    uint64_t nullMovePrunes[STATS_DEPTHS];
+    uint64_t razorPrunes[STATS_DEPTHS];
+    uint64_t futilityPrunes[STATS_DEPTHS];
+    uint64_t lmpPrunes[STATS_DEPTHS];
+    uint64_t historyPrunes[STATS_DEPTHS];
+    uint64_t seePrunes[STATS_DEPTHS];
+    uint64_t lmrSearches;
+    uint64_t lmrResearches;
+    uint64_t singularTests;
+    uint64_t singularExtensions;
+    // Beta cutoffs by the index of the cutoff move, with the last bucket
+    // counting all later moves
+    uint64_t betaCutoffs[STATS_CUTOFF_INDICES];
+
+    SearchCounters() {
+        reset();
+    }
+
+    void reset() {
+        std::memset(static_cast<void*>(this), 0, sizeof(SearchCounters));
+    }
+
+    void add(const SearchCounters &other) {
+        const uint64_t *src = reinterpret_cast<const uint64_t *>(&other);
+        uint64_t *dst = reinterpret_cast<uint64_t *>(this);
+        for (unsigned int i = 0; i < sizeof(SearchCounters) / sizeof(uint64_t); i++)
+            dst[i] += src[i];
+    }
+};
+
+#ifdef USE_SEARCH_STATS
+#define STAT_INC(counter) (threadMemoryArray[threadID]->counters.counter++)
+#else
+#define STAT_INC(counter) ((void) 0)
+#endif
+
+inline int statsDepth(int depth) {
+    return std::max(0, std::min(depth, STATS_DEPTHS - 1));
+}
+
+// A small direct-mapped cache of WDL probe results, kept per thread so that
+// transpositions into the same tablebase position do not decompress the same
+// table block again. Only successful probes are stored.
+struct TBProbeCache {
+    static constexpr int SIZE = 4096;
+    uint64_t keys[SIZE];
+    int8_t values[SIZE];
+
+    TBProbeCache() {
+        clear();
+    }
+
+    void clear() {
+        for (int i = 0; i < SIZE; i++)
+            keys[i] = 0;
+    }
+
+    bool get(uint64_t key, int &value) const {
+        int index = (int) (key & (SIZE - 1));
+        if (keys[index] != key)
+            return false;
+        value = values[index];
+        return true;
+    }
+
+    void add(uint64_t key, int value) {
+        int index = (int) (key & (SIZE - 1));
+        keys[index] = key;
+        values[index] = (int8_t) value;
+    }
+};
+
+// A direct-mapped cache of static evaluations, so that positions reached again
+// through transpositions are not evaluated twice. This keeps the evaluations
+// of unsearched nodes out of the main hash table. Each entry packs the upper
+// half of the Zobrist key with the score.
+struct EvalCache {
+    static constexpr int SIZE = 32768;
+    uint64_t entries[SIZE];
+
+    EvalCache() {
+        clear();
+    }
+
+    void clear() {
+        for (int i = 0; i < SIZE; i++)
+            entries[i] = 0;
+    }
+
+    bool get(uint64_t key, int &eval) const {
+        uint64_t entry = entries[key & (SIZE - 1)];
+        if ((entry >> 32) != (key >> 32))
+            return false;
+        eval = (int32_t) (uint32_t) entry;
+        return true;
+    }
+
+    void add(uint64_t key, int eval) {
+        entries[key & (SIZE - 1)] = (key & 0xFFFFFFFF00000000ULL) | (uint32_t) eval;
     }
 };
 
@@ -67,10 +196,22 @@ struct SearchPV {
 struct ThreadMemory {
     SearchParameters searchParams;
     SearchStatistics searchStats;
+    // Each thread has its own evaluator and pawn hash table
+    Eval evaluator;
+    // Per-ply NNUE accumulators, kept in sync with make/unmake
+    NNUEAccumulatorStack accumulators;
+    // The transposition table this thread searches with. All threads share
+    // the main table except for independent batch analysis workers.
+    Hash *hashTable;
+    TBProbeCache tbCache;
+    EvalCache evalCache;
+#ifdef USE_SEARCH_STATS
+    SearchCounters counters;
+#endif
     SearchStackInfo ssInfo[129];
     TwoFoldStack twoFoldPositions;
 
-    ThreadMemory() {
+    ThreadMemory(Hash *table) : hashTable(table) {
         for (int i = 0; i < 129; i++)
             ssInfo[i].ply = i;
     }
@@ -78,6 +219,153 @@ struct ThreadMemory {
     ~ThreadMemory() = default;
 };
 
+// The arguments of the current search, shared with the helper threads
+struct SearchJob {
+    const Board *b;
+    TimeManagement *timeParams;
+    MoveList legalMoves;
+    int tbScore;
+    bool tbProbeSuccess;
+};
+
+// A simplified ABDADA table shared by all threads of a search. Moves of non-PV
+// nodes at or above ABDADA_MIN_DEPTH are marked while they are being
+// searched, and other threads reaching the same move at the same depth search
+// it last, in the hope that its result will be in the hash table by then.
+// Entries are tags of the child position and depth, and races only cost a
+// missed or unnecessary deferral.
+class DeferralTable {
+private:
+    static constexpr uint64_t SIZE = 1 << 15;
+    std::atomic<uint64_t> slots[SIZE];
+
+public:
+    DeferralTable() {
+        for (uint64_t i = 0; i < SIZE; i++)
+            slots[i].store(0, std::memory_order_relaxed);
+    }
+
+    static uint64_t tag(uint64_t childKey, int depth) {
+        return childKey ^ (0x9E3779B97F4A7C15ULL * (uint64_t) depth);
+    }
+
+    bool isSearching(uint64_t moveTag) const {
+        return slots[moveTag & (SIZE - 1)].load(std::memory_order_relaxed) == moveTag;
+    }
+
+    void mark(uint64_t moveTag) {
+        slots[moveTag & (SIZE - 1)].store(moveTag, std::memory_order_relaxed);
+    }
+
+    // Only clears the slot if another move has not taken it over
+    void unmark(uint64_t moveTag) {
+        std::atomic<uint64_t> &slot = slots[moveTag & (SIZE - 1)];
+        if (slot.load(std::memory_order_relaxed) == moveTag)
+            slot.store(0, std::memory_order_relaxed);
+    }
+};
+
+// Shared state of a parallel MultiPV search. Each iteration, all threads take
+// root moves from a common counter. A move is only searched to an exact score
+// if it can still enter the lines, otherwise it is scouted with a null window
+// at the worst line score found so far. Thread 0 starts each iteration and
+// waits for every thread to finish its moves before reporting the lines.
+class MultiPVSplit {
+public:
+    std::mutex splitMutex;
+    // Wakes the helpers when an iteration is started or the search ends
+    std::condition_variable startCV;
+    // Signals thread 0 when all threads are done with an iteration
+    std::condition_variable doneCV;
+    uint64_t iteration;
+    bool finished;
+    int threadsBusy;
+    int depth;
+    unsigned int numLines;
+    MoveList rootMoves;
+    unsigned int nextMove;
+    // Results of the current iteration, indexed like rootMoves
+    int scores[MAX_MOVES];
+    bool isExact[MAX_MOVES];
+    SearchPV lines[MAX_MOVES];
+    // After sortResults, the result index of each line from best to worst
+    unsigned int lineIndex[MAX_MOVES];
+
+    MultiPVSplit() : iteration(0), finished(false), threadsBusy(0), depth(0),
+        numLines(0), nextMove(0) {}
+
+    // Returns the score a move must beat to enter the lines, or -MATE_SCORE
+    // if fewer than numLines moves have an exact score. Requires the lock.
+    int lineBound() const {
+        int exactScores[MAX_MOVES];
+        unsigned int numExact = 0;
+        for (unsigned int i = 0; i < nextMove; i++) {
+            if (isExact[i])
+                exactScores[numExact++] = scores[i];
+        }
+        if (numExact < numLines)
+            return -MATE_SCORE;
+        std::nth_element(exactScores, exactScores + numLines - 1, exactScores + numExact,
+            std::greater<int>());
+        return exactScores[numLines - 1];
+    }
+
+    // Orders the root moves for the next iteration: moves with exact scores
+    // from best to worst, then the moves that failed low in their old order
+    void sortResults() {
+        unsigned int numExact = 0;
+        for (unsigned int i = 0; i < rootMoves.size(); i++) {
+            if (isExact[i])
+                lineIndex[numExact++] = i;
+        }
+        std::stable_sort(lineIndex, lineIndex + numExact, [this](unsigned int a, unsigned int b) {
+            return scores[a] > scores[b];
+        });
+        unsigned int n = numExact;
+        for (unsigned int i = 0; i < rootMoves.size(); i++) {
+            if (!isExact[i])
+                lineIndex[n++] = i;
+        }
+
+        MoveList sortedMoves;
+        for (unsigned int i = 0; i < n; i++)
+            sortedMoves.add(rootMoves.get(lineIndex[i]));
+        rootMoves = sortedMoves;
+    }
+};
+
+// Persistent helper threads for lazy SMP. Thread 0 searches in the calling
+// thread, while threads 1 to n-1 are created once and park on a condition
+// variable between searches, so that no threads are spawned on each go.
+class SearchThreadPool {
+private:
+    std::vector<std::thread> helpers;
+    std::mutex poolMutex;
+    // Wakes the helpers when a search is started or the pool is shut down
+    std::condition_variable startCV;
+    // Signals the caller when all helpers are ready or done searching
+    std::condition_variable doneCV;
+    uint64_t generation;
+    int helpersBusy;
+    bool exiting;
+    SearchJob job;
+    SearchContext *context;
+
+    void helperLoop(int threadID, bool pinThread);
+
+public:
+    SearchThreadPool(SearchContext *owner)
+        : generation(0), helpersBusy(0), exiting(false), context(owner) {}
+    SearchThreadPool(const SearchThreadPool &other) = delete;
+    SearchThreadPool& operator=(const SearchThreadPool &other) = delete;
+    ~SearchThreadPool() { stop(); }
+
+    void start(int numHelpers, bool pinThreads);
+    void stop();
+    void startSearch(const SearchJob &searchJob);
+    void waitForSearch();
+};
+
 //-------------------------------Search Constants-------------------------------
 constexpr int SMP_SKIP_DEPTHS[16] = {
     1, 2, 2, 4, 4, 3, 2, 5, 4, 3, 2, 6, 5, 4, 3, 2
@@ -85,6 +373,11 @@ constexpr int SMP_SKIP_DEPTHS[16] = {
 constexpr int SMP_SKIP_AMOUNT[16] = {
     1, 1, 1, 2, 2, 2, 1, 3, 2, 2, 1, 3, 3, 2, 2, 1
 };
+// Minimum depth of a node for its moves to be marked in the deferral table
+constexpr int ABDADA_MIN_DEPTH = 3;
+// Hashfull estimates scan part of the table, so they are only refreshed
+// after this many milliseconds
+constexpr uint64_t HASHFULL_INTERVAL = 100;
 
 // Razor margins indexed by depth. If static eval is far below alpha, use a
 // qsearch to confirm fail low and then return.
@@ -112,57 +405,195 @@ void initReductionTable() {
 
 
 //-----------------------------Global variables---------------------------------
-static Hash transpositionTable(DEFAULT_HASH_SIZE);
-static std::vector<ThreadMemory *> threadMemoryArray;
-
-// Variables for time management
-ChessTime startTime;
-uint64_t timeLimit;
-
-// Used to break out of the search thread if the stop command is given
-std::atomic<bool> isStop(true);
-// Additional stop signal to stop helper threads during SMP
-std::atomic<bool> stopSignal(true);
-
-// Dummy variables for lazy SMP since we don't care about these results
-int dummyBestIndex[MAX_THREADS-1];
-int dummyBestScore[MAX_THREADS-1];
-
-// Values for UCI options
-unsigned int multiPV;
-int numThreads;
-bool isPonderSearch = false;
-
 // Accessible from tbcore.c
 int TBlargest = 0;
-static int probeLimit = 0;
 
 
-// Search functions
-void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves,
-    int tbScore, bool tbProbeSuccess, int threadID);
-void getBestMoveAtDepth(const Board *b, const MoveList *legalMoves, int depth, int alpha, int beta,
-    int *bestMoveIndex, int *bestScore, unsigned int startMove, int threadID, SearchPV *pvLine);
-int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode, SearchStackInfo *ssi, SearchPV *pvLine);
-int quiescence(Board &b, int plies, int alpha, int beta, int threadID);
-int checkQuiescence(Board &b, int plies, int alpha, int beta, int threadID);
-
 // Search helpers
 int scoreMate(bool isInCheck, int plies);
 int adjustHashScore(int score, int plies);
 
 // Other utility functions
+inline Move nextSearchMove(MoveOrder &moveSorter, MoveList &deferredMoves, unsigned int &deferredIndex);
 Move nextMove(MoveList &moves, ScoreList &scores, unsigned int index);
-uint64_t getTBHits();
 void changePV(Move best, SearchPV *parent, SearchPV *child);
 std::string retrievePV(SearchPV *pvLine);
-int getSelectiveDepth();
 double getPercentage(uint64_t numerator, uint64_t denominator);
 
 
+SearchContext::SearchContext()
+    : transpositionTable(DEFAULT_HASH_SIZE),
+      threadPool(new SearchThreadPool(this)),
+      deferralTable(new DeferralTable()),
+      multiPVSplit(new MultiPVSplit()),
+      timeLimit(MAX_TIME),
+      nodeLimit(UINT64_MAX),
+      hashfull(-1),
+      hashfullTime(0),
+      timerExit(false),
+      isStop(true),
+      stopSignal(true),
+      isPonderSearch(false),
+      multiPV(DEFAULT_MULTI_PV),
+      numThreads(1),
+      useThreadAffinity(false),
+      useNNUE(false),
+      evalWithNNUE(false),
+      probeLimit(0),
+      useABDADA(false),
+      deferMoves(false),
+      useParallelMultiPV(false),
+      splitMultiPV(false),
+      searchStatsInfo(false) {
+    threadMemoryArray.push_back(new ThreadMemory(&transpositionTable));
+}
+
+SearchContext::~SearchContext() {
+    stopSearch();
+    delete threadPool;
+    delete deferralTable;
+    delete multiPVSplit;
+    for (unsigned int i = 0; i < threadMemoryArray.size(); i++)
+        delete threadMemoryArray[i];
+    for (unsigned int i = 0; i < analysisTables.size(); i++)
+        delete analysisTables[i];
+}
+
+// Sets up the root position, recording the game history on the two-fold stack
+void SearchContext::setPosition(const Board &b, const std::vector<Move> &moves) {
+    TwoFoldStack *twoFoldPositions = getTwoFoldStackPointer();
+    twoFoldPositions->clear();
+    rootBoard = b.staticCopy();
+
+    for (unsigned int i = 0; i < moves.size(); i++) {
+        Move m = moves[i];
+        int color = rootBoard.getPlayerToMove();
+
+        // Record positions on two fold stack.
+        twoFoldPositions->push(rootBoard.getZobristKey());
+        // The stack is cleared for captures, pawn moves, and castles, which are all
+        // irreversible
+        if (isCapture(m) || isCastle(m)
+         || rootBoard.getPieceOnSquare(color, getStartSq(m)) == PAWNS)
+            twoFoldPositions->clear();
+
+        rootBoard.doMove(m, color);
+    }
+
+    twoFoldPositions->setRootEnd();
+}
+
+void SearchContext::search(const TimeManagement &limits, const MoveList &searchMoves) {
+    waitForSearch();
+    searchLimits = limits;
+    rootMoveFilter = searchMoves;
+    isStop = false;
+    stopSignal = false;
+    getBestMoveThreader(&rootBoard, &searchLimits, &rootMoveFilter);
+    isStop = true;
+    stopSignal = true;
+}
+
+// Starts a search on a background thread and returns immediately
+void SearchContext::startSearch(const TimeManagement &limits, const MoveList &searchMoves) {
+    waitForSearch();
+    searchLimits = limits;
+    rootMoveFilter = searchMoves;
+    isStop = false;
+    stopSignal = false;
+    searchThread = std::thread(&SearchContext::getBestMoveThreader, this,
+        &rootBoard, &searchLimits, &rootMoveFilter);
+}
+
+// Ends a background search as soon as possible. The best move found so far
+// is still reported.
+void SearchContext::stopSearch() {
+    stopPonder();
+    isStop = true;
+    stopSignal = true;
+    waitForSearch();
+}
+
+void SearchContext::waitForSearch() {
+    if (searchThread.joinable())
+        searchThread.join();
+}
+
+void SearchContext::startPonder() {
+    isPonderSearch = true;
+}
+
+// On a ponderhit, the timer must check whether the time limit has passed
+void SearchContext::stopPonder() {
+    {
+        std::lock_guard<std::mutex> lock(timerMutex);
+        isPonderSearch = false;
+    }
+    timerCV.notify_all();
+}
+
+// Starts the timer thread for a search with a time limit. Must be called after
+// startTime and timeLimit are set.
+void SearchContext::startTimer() {
+    uint64_t timeSoFar = getTimeElapsed(startTime);
+    uint64_t remaining = (timeLimit > timeSoFar) ? timeLimit - timeSoFar : 0;
+    timerExit = false;
+    timerThread = std::thread(&SearchContext::timerLoop, this,
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(remaining));
+}
+
+void SearchContext::stopTimer() {
+    if (!timerThread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(timerMutex);
+        timerExit = true;
+    }
+    timerCV.notify_all();
+    timerThread.join();
+}
+
+void SearchContext::timerLoop(std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(timerMutex);
+    if (timerCV.wait_until(lock, deadline, [this] { return timerExit; }))
+        return;
+    // The time limit does not apply until a ponderhit
+    timerCV.wait(lock, [this] { return timerExit || !isPonderSearch; });
+    if (timerExit)
+        return;
+    isStop = true;
+    stopSignal = true;
+}
+
+void SearchContext::emitInfo(const std::string &info) {
+    if (callbacks.onInfo)
+        callbacks.onInfo(info);
+    else
+        cout << info << endl;
+}
+
+void SearchContext::emitBestMove(Move bestMove, Move ponder) {
+    if (callbacks.onBestMove)
+        callbacks.onBestMove(bestMove, ponder);
+    else
+        cout << bestMoveToString(bestMove, ponder) << endl;
+}
+
+std::string bestMoveToString(Move bestMove, Move ponder) {
+    if (bestMove == NULL_MOVE)
+        return "bestmove none";
+    if (ponder != NULL_MOVE)
+        return "bestmove " + moveToString(bestMove) + " ponder " + moveToString(ponder);
+    return "bestmove " + moveToString(bestMove);
+}
+
+
 // Spawns the appropriate number of getBestMove threads and cleans up the helpers
 // when the main thread is done.
-void getBestMoveThreader(const Board *b, TimeManagement *timeParams, MoveList *movesToSearch) {
+void SearchContext::getBestMoveThreader(const Board *b, TimeManagement *timeParams, MoveList *movesToSearch) {
+    if (useThreadAffinity)
+        pinToCPU(0);
+
     const int color = b->getPlayerToMove();
     MoveList legalMoves = b->getAllLegalMoves(color);
 
@@ -170,15 +601,28 @@ void getBestMoveThreader(const Board *b, TimeManagement *timeParams, MoveList *m
     if (legalMoves.size() <= 0) {
         stopSignal = true;
         isStop = true;
-        cout << "bestmove none" << endl;
+        emitBestMove(NULL_MOVE, NULL_MOVE);
         return;
     }
 
+    evalWithNNUE = isUsingNNUE();
+    // Deferring moves only helps when other threads are searching
+    deferMoves = useABDADA && numThreads > 1;
+    // Splitting the root moves only pays off with several lines and threads
+    splitMultiPV = useParallelMultiPV && multiPV > 1 && numThreads > 1;
+    if (splitMultiPV) {
+        multiPVSplit->iteration = 0;
+        multiPVSplit->finished = false;
+    }
+
     // Reset all search parameters (killers, plies, etc)
     for (int i = 0; i < numThreads; i++) {
         threadMemoryArray[i]->searchParams.reset();
         threadMemoryArray[i]->searchStats.reset();
         threadMemoryArray[i]->searchParams.selectiveDepth = 0;
+#ifdef USE_SEARCH_STATS
+        threadMemoryArray[i]->counters.reset();
+#endif
     }
 
     // Copy over the two-fold stack to use
@@ -194,7 +638,7 @@ void getBestMoveThreader(const Board *b, TimeManagement *timeParams, MoveList *m
     if (TBlargest && count(b->getAllPieces(WHITE) | b->getAllPieces(BLACK)) <= TBlargest) {
         ScoreList scores;
         // Try probing with DTZ tables first
-        int tbProbeResult = root_probe(b, legalMoves, scores, tbScore);
+        int tbProbeResult = root_probe(b, &threadMemoryArray[0]->twoFoldPositions, legalMoves, scores, tbScore);
         if (tbProbeResult) {
             // With DTZ table filtering, we have guaranteed that we will not
             // make a mistake so do not probe TBs in search
@@ -235,7 +679,9 @@ void getBestMoveThreader(const Board *b, TimeManagement *timeParams, MoveList *m
     timeLimit = (timeParams->searchMode == TIME) ? timeParams->maxAllotment
                                                  : (timeParams->searchMode == MOVETIME) ? timeParams->allotment
                                                                                         : MAX_TIME;
+    nodeLimit = (timeParams->searchMode == NODES) ? timeParams->nodeLimit : UINT64_MAX;
     startTime = ChessClock::now();
+    hashfull = -1;
 
     // Special case if there is only one legal move: use less search time,
     // only to get a rough PV/score
@@ -246,31 +692,34 @@ void getBestMoveThreader(const Board *b, TimeManagement *timeParams, MoveList *m
     // Increment hash table age
     transpositionTable.incrementAge();
 
+    if (timeLimit != MAX_TIME)
+        startTimer();
 
-    // Create threads for SMP if necessary
-    if (numThreads > 1) {
-        std::thread *threadPool = new std::thread[numThreads];
 
-        // Start and join all threads
-        for (int i = 0; i < numThreads; i++) {
-            threadPool[i] = std::thread(getBestMove, b, timeParams, legalMoves, tbScore, tbProbeSuccess, i);
-        }
-        for (int i = 0; i < numThreads; i++) {
-            threadPool[i].join();
-        }
+    // Wake the helper threads for SMP if necessary
+    if (numThreads > 1) {
+        threadPool->startSearch({b, timeParams, legalMoves, tbScore, tbProbeSuccess});
+        getBestMove(b, timeParams, legalMoves, tbScore, tbProbeSuccess, 0);
+        threadPool->waitForSearch();
 
         stopSignal = false;
-        delete[] threadPool;
     }
     // Otherwise, just search with one thread
     else {
         getBestMove(b, timeParams, legalMoves, tbScore, tbProbeSuccess, 0);
     }
+
+    stopTimer();
 }
 
 // Finds a best move for a position according to the given search parameters.
-void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves,
+void SearchContext::getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves,
         int tbScore, bool tbProbeSuccess, int threadID) {
+    if (splitMultiPV) {
+        getBestMoveSplit(b, timeParams, legalMoves, tbScore, tbProbeSuccess, threadID);
+        return;
+    }
+
     Move ponder = NULL_MOVE;
     Move bestMove = legalMoves.get(0);
     uint64_t timeSoFar;
@@ -281,6 +730,19 @@ void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves
     int prevScore = -INFTY;
     int pvStreak = 0;
     double timeChangeFactor = 1.0;
+    // Scales the time from how the root nodes are split between moves,
+    // recomputed each iteration rather than accumulated
+    double effortFactor = 1.0;
+
+    // A hash move for the root left by the previous search, usually the
+    // expected reply when the opponent played the predicted move
+    Move rootHashMove = NULL_MOVE;
+    if (threadID == 0) {
+        Board rootCopy = b->staticCopy();
+        HashEntry rootEntry;
+        if (threadMemoryArray[0]->hashTable->get(rootCopy, rootEntry))
+            rootHashMove = rootEntry.move;
+    }
 
     // Iterative deepening loop
     do {
@@ -329,16 +791,18 @@ void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves
                 // Fail low: no best move found
                 if (bestMoveIndex == -1 && !isStop) {
                     if (threadID == 0) {
-                        cout << "info depth " << rootDepth;
-                        cout << " seldepth " << getSelectiveDepth();
-                        cout << " score";
-                        cout << " cp " << (tbProbeSuccess ? (tbScore == 0 ? 0 : (bestScore/10 + tbScore)) : bestScore) * 100 / PIECE_VALUES[EG][PAWNS]
+                        std::ostringstream info;
+                        info << "info depth " << rootDepth;
+                        info << " seldepth " << getSelectiveDepth();
+                        info << " score";
+                        info << " cp " << (tbProbeSuccess ? (tbScore == 0 ? 0 : (bestScore/10 + tbScore)) : bestScore) * 100 / PIECE_VALUES[EG][PAWNS]
                              << " upperbound";
-                        cout << " time " << timeSoFar
+                        info << " time " << timeSoFar
                              << " nodes " << getNodes() << " nps " << nps
                              << " tbhits " << getTBHits()
-                             << " hashfull " << transpositionTable.estimateHashfull()
-                             << " pv " << retrievePV(&pvLine) << endl;
+                             << " hashfull " << getHashfull()
+                             << " pv " << retrievePV(&pvLine);
+                        emitInfo(info.str());
                     }
 
                     aspBeta = (aspAlpha + aspBeta) / 2;
@@ -351,16 +815,18 @@ void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves
                 // Fail high: best score is at least beta
                 else if (bestScore >= aspBeta) {
                     if (threadID == 0) {
-                        cout << "info depth " << rootDepth;
-                        cout << " seldepth " << getSelectiveDepth();
-                        cout << " score";
-                        cout << " cp " << (tbProbeSuccess ? (tbScore == 0 ? 0 : (bestScore/10 + tbScore)) : bestScore) * 100 / PIECE_VALUES[EG][PAWNS]
+                        std::ostringstream info;
+                        info << "info depth " << rootDepth;
+                        info << " seldepth " << getSelectiveDepth();
+                        info << " score";
+                        info << " cp " << (tbProbeSuccess ? (tbScore == 0 ? 0 : (bestScore/10 + tbScore)) : bestScore) * 100 / PIECE_VALUES[EG][PAWNS]
                              << " lowerbound";
-                        cout << " time " << timeSoFar
+                        info << " time " << timeSoFar
                              << " nodes " << getNodes() << " nps " << nps
                              << " tbhits " << getTBHits()
-                             << " hashfull " << transpositionTable.estimateHashfull()
-                             << " pv " << retrievePV(&pvLine) << endl;
+                             << " hashfull " << getHashfull()
+                             << " pv " << retrievePV(&pvLine);
+                        emitInfo(info.str());
                     }
 
                     aspAlpha = (aspAlpha + aspBeta) / 2;
@@ -393,13 +859,14 @@ void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves
             // If we broke out before getting any new results, end the search
             if (bestMoveIndex == -1) {
                 if (threadID == 0) {
-                    cout << "info depth " << rootDepth-1;
-                    cout << " seldepth " << getSelectiveDepth();
-                    cout << " time " << timeSoFar
+                    std::ostringstream info;
+                    info << "info depth " << rootDepth-1;
+                    info << " seldepth " << getSelectiveDepth();
+                    info << " time " << timeSoFar
                          << " nodes " << getNodes() << " nps " << nps
                          << " tbhits " << getTBHits()
-                         << " hashfull " << transpositionTable.estimateHashfull()
-                         << endl;
+                         << " hashfull " << getHashfull();
+                    emitInfo(info.str());
                 }
                 break;
             }
@@ -446,34 +913,41 @@ void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves
 
             // Output info using UCI protocol
             if (threadID == 0) {
-                cout << "info depth " << rootDepth;
-                cout << " seldepth " << getSelectiveDepth();
+                std::ostringstream info;
+                info << "info depth " << rootDepth;
+                info << " seldepth " << getSelectiveDepth();
                 if (multiPV > 1)
-                    cout << " multipv " << multiPVNum;
-                cout << " score";
+                    info << " multipv " << multiPVNum;
+                info << " score";
 
                 // Print score in mate or centipawns
                 if (bestScore >= MAX_PLY_MATE_SCORE)
                     // If it is our mate, it takes plies / 2 + 1 moves to mate since
                     // our move ends the game
-                    cout << " mate " << (MATE_SCORE - bestScore) / 2 + 1;
+                    info << " mate " << (MATE_SCORE - bestScore) / 2 + 1;
                 else if (bestScore <= -MAX_PLY_MATE_SCORE)
                     // If we are being mated, it takes plies / 2 moves since our
                     // opponent's move ends the game
-                    cout << " mate " << (-MATE_SCORE - bestScore) / 2;
+                    info << " mate " << (-MATE_SCORE - bestScore) / 2;
                 else
                     // Scale score into centipawns using our internal pawn value
-                    cout << " cp " << (tbProbeSuccess ? (tbScore == 0 ? 0 : (bestScore/10 + tbScore)) : bestScore) * 100 / PIECE_VALUES[EG][PAWNS];
+                    info << " cp " << (tbProbeSuccess ? (tbScore == 0 ? 0 : (bestScore/10 + tbScore)) : bestScore) * 100 / PIECE_VALUES[EG][PAWNS];
 
-                cout << " time " << timeSoFar
+                info << " time " << timeSoFar
                      << " nodes " << getNodes() << " nps " << nps
                      << " tbhits " << getTBHits()
-                     << " hashfull " << transpositionTable.estimateHashfull()
-                     << " pv " << retrievePV(&pvLine) << endl;
+                     << " hashfull " << getHashfull()
+                     << " pv " << retrievePV(&pvLine);
+                emitInfo(info.str());
             }
         }
         // End multiPV loop
 
+#ifdef USE_SEARCH_STATS
+        if (threadID == 0 && searchStatsInfo)
+            emitInfo(getSearchStatsSummary());
+#endif
+
         if (bestMove == prevBest) {
             pvStreak++;
             timeChangeFactor *= 0.92;
@@ -491,6 +965,22 @@ void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves
         else
             timeChangeFactor = 1.0;
 
+        // Node effort: a best move that takes most of the root nodes is
+        // unlikely to change, so use less time, and more when the effort is
+        // split. Stop early once such a move has been stable for a while.
+        if (threadID == 0 && timeParams->searchMode == TIME && multiPV == 1
+         && rootDepth >= EFFORT_MIN_DEPTH) {
+            double bestMoveEffort = threadMemoryArray[0]->searchStats.getRootEffort(bestMove);
+            effortFactor = effortTimeFactor(bestMoveEffort, bestMove == rootHashMove, bestScore - prevScore);
+
+            if (!isPonderSearch
+             && bestMoveEffort >= EFFORT_STOP_FRACTION
+             && pvStreak >= EFFORT_STOP_STREAK
+             && timeSoFar > timeParams->allotment * TIME_FACTOR * EFFORT_STOP_TIME
+             && abs(bestScore) < NEAR_MATE_SCORE)
+                break;
+        }
+
         // Easymove confirmation
         if (threadID == 0 && !isPonderSearch && timeParams->searchMode == TIME && multiPV == 1
          && pvStreak >= 8 + rootDepth / 5
@@ -521,9 +1011,10 @@ void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves
     // Conditions for iterative deepening loop
     while (!isStop
          && ((threadID != 0 && rootDepth <= MAX_DEPTH)
-          || ((((timeParams->searchMode == TIME && timeSoFar < (uint64_t) timeParams->allotment * TIME_FACTOR * timeChangeFactor)
+          || ((((timeParams->searchMode == TIME && timeSoFar < (uint64_t) timeParams->allotment * TIME_FACTOR * timeChangeFactor * effortFactor)
               || isPonderSearch) && rootDepth <= MAX_DEPTH)
            || (timeParams->searchMode == MOVETIME && timeSoFar < (uint64_t) timeParams->allotment && rootDepth <= MAX_DEPTH)
+           || (timeParams->searchMode == NODES && rootDepth <= MAX_DEPTH)
            || (timeParams->searchMode == DEPTH && rootDepth <= timeParams->allotment))));
 
     // When pondering, we must continue "searching" until given a stop or ponderhit command.
@@ -535,15 +1026,228 @@ void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves
         stopSignal = true;
         isStop = true;
 
-        if (ponder != NULL_MOVE)
-            cout << "bestmove " << moveToString(bestMove) << " ponder " << moveToString(ponder) << endl;
-        else
-            cout << "bestmove " << moveToString(bestMove) << endl;
+        emitBestMove(bestMove, ponder);
+    }
+}
+
+// Parallel MultiPV: instead of searching the lines one after another, the
+// threads split up the root moves of each iteration, which they all search to
+// the same depth. Thread 0 reports the lines and runs the time management.
+void SearchContext::getBestMoveSplit(const Board *b, TimeManagement *timeParams, MoveList legalMoves,
+        int tbScore, bool tbProbeSuccess, int threadID) {
+    MultiPVSplit &split = *multiPVSplit;
+
+    // Helpers search the moves of each iteration until the search ends
+    if (threadID != 0) {
+        uint64_t lastIteration = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(split.splitMutex);
+                split.startCV.wait(lock, [&] { return split.finished || split.iteration != lastIteration; });
+                if (split.finished)
+                    return;
+                lastIteration = split.iteration;
+            }
+            searchSplitMoves(b, threadID);
+        }
+    }
+
+    Move bestMove = legalMoves.get(0);
+    Move ponder = NULL_MOVE;
+    uint64_t timeSoFar;
+    int rootDepth = 1;
+    split.rootMoves = legalMoves;
+    split.numLines = std::min(multiPV, legalMoves.size());
+
+    // Iterative deepening loop
+    do {
+        {
+            std::lock_guard<std::mutex> lock(split.splitMutex);
+            split.depth = rootDepth;
+            split.nextMove = 0;
+            split.threadsBusy = numThreads;
+            split.iteration++;
+        }
+        split.startCV.notify_all();
+
+        searchSplitMoves(b, 0);
+        {
+            std::unique_lock<std::mutex> lock(split.splitMutex);
+            split.doneCV.wait(lock, [&] { return split.threadsBusy == 0; });
+        }
+
+        timeSoFar = getTimeElapsed(startTime);
+        uint64_t nps = 1000 * getNodes() / timeSoFar;
+
+        // An interrupted iteration is incomplete, so its results are dropped
+        if (isStop) {
+            std::ostringstream info;
+            info << "info depth " << rootDepth-1;
+            info << " seldepth " << getSelectiveDepth();
+            info << " time " << timeSoFar
+                 << " nodes " << getNodes() << " nps " << nps
+                 << " tbhits " << getTBHits()
+                 << " hashfull " << getHashfull();
+            emitInfo(info.str());
+            break;
+        }
+
+        split.sortResults();
+        bestMove = split.rootMoves.get(0);
+        SearchPV *bestLine = &split.lines[split.lineIndex[0]];
+        ponder = (bestLine->pvLength > 1) ? bestLine->pv[1] : NULL_MOVE;
+
+        // Output info using UCI protocol
+        for (unsigned int line = 0; line < split.numLines; line++) {
+            int score = split.scores[split.lineIndex[line]];
+            std::ostringstream info;
+            info << "info depth " << rootDepth;
+            info << " seldepth " << getSelectiveDepth();
+            info << " multipv " << line+1;
+            info << " score";
+            if (score >= MAX_PLY_MATE_SCORE)
+                info << " mate " << (MATE_SCORE - score) / 2 + 1;
+            else if (score <= -MAX_PLY_MATE_SCORE)
+                info << " mate " << (-MATE_SCORE - score) / 2;
+            else
+                info << " cp " << (tbProbeSuccess ? (tbScore == 0 ? 0 : (score/10 + tbScore)) : score) * 100 / PIECE_VALUES[EG][PAWNS];
+            info << " time " << timeSoFar
+                 << " nodes " << getNodes() << " nps " << nps
+                 << " tbhits " << getTBHits()
+                 << " hashfull " << getHashfull()
+                 << " pv " << retrievePV(&split.lines[split.lineIndex[line]]);
+            emitInfo(info.str());
+        }
+
+#ifdef USE_SEARCH_STATS
+        if (searchStatsInfo)
+            emitInfo(getSearchStatsSummary());
+#endif
+
+        rootDepth++;
+    }
+    // Conditions for iterative deepening loop
+    while (!isStop
+         && ((((timeParams->searchMode == TIME && timeSoFar < (uint64_t) timeParams->allotment * TIME_FACTOR)
+              || isPonderSearch) && rootDepth <= MAX_DEPTH)
+          || (timeParams->searchMode == MOVETIME && timeSoFar < (uint64_t) timeParams->allotment && rootDepth <= MAX_DEPTH)
+          || (timeParams->searchMode == NODES && rootDepth <= MAX_DEPTH)
+          || (timeParams->searchMode == DEPTH && rootDepth <= timeParams->allotment)));
+
+    {
+        std::lock_guard<std::mutex> lock(split.splitMutex);
+        split.finished = true;
+    }
+    split.startCV.notify_all();
+
+    // When pondering, we must continue "searching" until given a stop or ponderhit command.
+    while (isPonderSearch && !isStop)
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    stopSignal = true;
+    isStop = true;
+    emitBestMove(bestMove, ponder);
+}
+
+// Takes root moves of the current parallel MultiPV iteration until none are
+// left, and records their results
+void SearchContext::searchSplitMoves(const Board *b, int threadID) {
+    MultiPVSplit &split = *multiPVSplit;
+    threadMemoryArray[threadID]->searchParams.reset();
+
+    while (!stopSignal.load(std::memory_order_relaxed)) {
+        unsigned int index;
+        Move m;
+        int depth, bound;
+        {
+            std::lock_guard<std::mutex> lock(split.splitMutex);
+            if (split.nextMove >= split.rootMoves.size())
+                break;
+            index = split.nextMove++;
+            split.isExact[index] = false;
+            m = split.rootMoves.get(index);
+            depth = split.depth;
+            // The best moves of the last iteration always get exact scores
+            bound = (index < split.numLines) ? -MATE_SCORE : split.lineBound();
+        }
+
+        SearchPV line;
+        int score = searchRootMove(b, m, index + 1, depth, bound, MATE_SCORE, threadID, &line);
+        if (stopSignal.load(std::memory_order_relaxed))
+            break;
+
+        std::lock_guard<std::mutex> lock(split.splitMutex);
+        split.scores[index] = score;
+        split.isExact[index] = (score > bound);
+        split.lines[index] = line;
+    }
+
+    std::lock_guard<std::mutex> lock(split.splitMutex);
+    if (--split.threadsBusy == 0)
+        split.doneCV.notify_all();
+}
+
+// Searches a single root move. Unless alpha is -MATE_SCORE, the move is first
+// scouted with a null window at alpha, and only searched with (alpha, beta) if
+// the scout fails high.
+int SearchContext::searchRootMove(const Board *b, Move m, unsigned int moveNumber, int depth,
+        int alpha, int beta, int threadID, SearchPV *pvLine) {
+    SearchParameters *searchParams = &(threadMemoryArray[threadID]->searchParams);
+    SearchStatistics *searchStats = &(threadMemoryArray[threadID]->searchStats);
+    SearchStackInfo *ssi = &(threadMemoryArray[threadID]->ssInfo[0]);
+    SearchPV line;
+    int color = b->getPlayerToMove();
+
+    threadMemoryArray[threadID]->twoFoldPositions.push(b->getZobristKey());
+
+    Board copy = b->staticCopy();
+    copy.doMove(m, color);
+    searchStats->nodes++;
+    // Root moves are made by copy, so each one starts a new stack
+    threadMemoryArray[threadID]->accumulators.reset();
+
+    int startSq = getStartSq(m);
+    int endSq = getEndSq(m);
+    int pieceID = b->getPieceOnSquare(color, startSq);
+    (ssi+1)->counterMoveHistory = searchParams->counterMoveHistory[pieceID][endSq];
+    (ssi+1)->followupMoveHistory = nullptr;
+    (ssi+2)->followupMoveHistory = searchParams->followupMoveHistory[pieceID][endSq];
+    (ssi+1)->counterMove = &(searchParams->counterMoves[color][pieceID][endSq]);
+    (ssi+1)->followupMove = nullptr;
+    (ssi+2)->followupMove = &(searchParams->followupMoves[color][pieceID][endSq]);
+
+    bool isScout = (alpha != -MATE_SCORE);
+    // Root LMR, only for scout searches
+    int reduction = 0;
+    if (isScout && depth >= 3 && moveNumber > 1
+     && !isCapture(m) && !isPromotion(m)) {
+        reduction = lmrReductions[std::min(63, depth)][std::max(1U, std::min(63U, moveNumber))] - 1;
+        reduction = std::max(0, reduction);
+    }
+
+    // Check extensions
+    int extension = 0;
+    if (copy.isInCheck(color^1)
+     && b->isSEEAbove(color, m, 0)) {
+        extension++;
+    }
+
+    int score = alpha;
+    if (isScout) {
+        score = -PVS<false>(copy, depth-1+extension-reduction, -alpha-1, -alpha, threadID, true, ssi+1, &line);
+        if (reduction > 0 && score > alpha)
+            score = -PVS<false>(copy, depth-1+extension, -alpha-1, -alpha, threadID, true, ssi+1, &line);
     }
+    if (!isScout || score > alpha)
+        score = -PVS<true>(copy, depth-1+extension, -beta, -alpha, threadID, false, ssi+1, &line);
+
+    threadMemoryArray[threadID]->twoFoldPositions.pop();
+    changePV(m, pvLine, &line);
+    return score;
 }
 
 // Returns the index of the best move in legalMoves
-void getBestMoveAtDepth(const Board *b, const MoveList *legalMoves, int depth, int alpha,
+void SearchContext::getBestMoveAtDepth(const Board *b, const MoveList *legalMoves, int depth, int alpha,
         int beta, int *bestMoveIndex, int *bestScore, unsigned int startMove,
         int threadID, SearchPV *pvLine) {
     SearchParameters *searchParams = &(threadMemoryArray[threadID]->searchParams);
@@ -569,13 +1273,19 @@ void getBestMoveAtDepth(const Board *b, const MoveList *legalMoves, int depth, i
         // search have elapsed to avoid clutter
         uint64_t timeSoFar = getTimeElapsed(startTime);
         uint64_t nps = 1000 * getNodes() / timeSoFar;
-        if (threadID == 0 && timeSoFar > 5 * ONE_SECOND)
-            cout << "info depth " << depth << " currmove " << moveToString(m)
-                 << " currmovenumber " << i+1 << " nodes " << getNodes() << " nps " << nps << endl;
+        if (threadID == 0 && timeSoFar > 5 * ONE_SECOND) {
+            std::ostringstream info;
+            info << "info depth " << depth << " currmove " << moveToString(m)
+                 << " currmovenumber " << i+1 << " nodes " << getNodes() << " nps " << nps;
+            emitInfo(info.str());
+        }
 
         Board copy = b->staticCopy();
         copy.doMove(m, color);
+        uint64_t nodesBefore = searchStats->nodes;
         searchStats->nodes++;
+        // Root moves are made by copy, so each one starts a new stack
+        threadMemoryArray[threadID]->accumulators.reset();
 
         int startSq = getStartSq(m);
         int endSq = getEndSq(m);
@@ -583,6 +1293,9 @@ void getBestMoveAtDepth(const Board *b, const MoveList *legalMoves, int depth, i
         (ssi+1)->counterMoveHistory = searchParams->counterMoveHistory[pieceID][endSq];
         (ssi+1)->followupMoveHistory = nullptr;
         (ssi+2)->followupMoveHistory = searchParams->followupMoveHistory[pieceID][endSq];
+        (ssi+1)->counterMove = &(searchParams->counterMoves[color][pieceID][endSq]);
+        (ssi+1)->followupMove = nullptr;
+        (ssi+2)->followupMove = &(searchParams->followupMoves[color][pieceID][endSq]);
 
         // Root LMR
         unsigned int movesSearched = i - startMove + 1;
@@ -601,16 +1314,25 @@ void getBestMoveAtDepth(const Board *b, const MoveList *legalMoves, int depth, i
         }
 
         if (i != 0) {
-            score = -PVS(copy, depth-1+extension-reduction, -alpha-1, -alpha, threadID, true, ssi+1, &line);
+            score = -PVS<false>(copy, depth-1+extension-reduction, -alpha-1, -alpha, threadID, true, ssi+1, &line);
             if (reduction > 0 && score > alpha) {
-                score = -PVS(copy, depth-1+extension, -alpha-1, -alpha, threadID, true, ssi+1, &line);
+                score = -PVS<false>(copy, depth-1+extension, -alpha-1, -alpha, threadID, true, ssi+1, &line);
             }
             if (alpha < score && score < beta) {
-                score = -PVS(copy, depth-1+extension, -beta, -alpha, threadID, false, ssi+1, &line);
+                score = -PVS<true>(copy, depth-1+extension, -beta, -alpha, threadID, false, ssi+1, &line);
             }
         }
         else {
-            score = -PVS(copy, depth-1+extension, -beta, -alpha, threadID, false, ssi+1, &line);
+            score = -PVS<true>(copy, depth-1+extension, -beta, -alpha, threadID, false, ssi+1, &line);
+        }
+
+        // Record the effort spent on this move. Searches starting past the
+        // first move (later PV lines, easymove checks) do not say how the
+        // main search is split, so they are left out.
+        if (startMove == 0) {
+            uint64_t moveNodes = searchStats->nodes - nodesBefore;
+            searchStats->rootMoveNodes[startSq][endSq] += moveNodes;
+            searchStats->rootNodes += moveNodes;
         }
 
         // Stop condition. If stopping, return search results from incomplete
@@ -642,9 +1364,13 @@ void getBestMoveAtDepth(const Board *b, const MoveList *legalMoves, int depth, i
 //------------------------------------------------------------------------------
 //------------------------------Search functions--------------------------------
 //------------------------------------------------------------------------------
-// The standard implementation of a fail-soft PVS search.
-int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode, SearchStackInfo *ssi, SearchPV *pvLine) {
+// The standard implementation of a fail-soft PVS search. PV nodes are the ones
+// searched with an open (alpha, beta) window, and most pruning is skipped on
+// them. Node type is a template parameter so that its checks compile away.
+template <bool isPVNode>
+int SearchContext::PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode, SearchStackInfo *ssi, SearchPV *pvLine) {
     SearchParameters *searchParams = &(threadMemoryArray[threadID]->searchParams);
+    Hash &hashTable = *(threadMemoryArray[threadID]->hashTable);
     SearchStatistics *searchStats = &(threadMemoryArray[threadID]->searchStats);
     // Reset the PV line
     pvLine->pvLength = 0;
@@ -661,8 +1387,14 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
     // Draw check
     if (b.isDraw())
         return 0;
-    if (b.getFiftyMoveCounter() >= 2 && threadMemoryArray[threadID]->twoFoldPositions.find(b.getZobristKey()))
+    if (threadMemoryArray[threadID]->twoFoldPositions.find(b.getZobristKey(), b.getFiftyMoveCounter()))
         return 0;
+    // If we can force a repetition with our next move, the score is at least a draw
+    if (alpha < 0 && threadMemoryArray[threadID]->twoFoldPositions.hasUpcomingRepetition(b)) {
+        alpha = 0;
+        if (alpha >= beta)
+            return alpha;
+    }
 
 
     // Mate distance pruning
@@ -680,14 +1412,17 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
             return beta;
     }
 
+    // Mate distance pruning can close a PV window down to a null window
+    if (isPVNode && beta - alpha == 1)
+        return PVS<false>(b, depth, alpha, beta, threadID, isCutNode, ssi, pvLine);
 
-    // Check for a timeout
-    if (threadID == 0 && (searchStats->nodes & 1023) == 1023 && !isPonderSearch) {
-        uint64_t timeSoFar = getTimeElapsed(startTime);
-        if (timeSoFar > timeLimit) {
-            isStop = true;
-            stopSignal = true;
-        }
+
+    // Check for a node limit. Time limits are enforced by the timer thread.
+    if (threadID == 0 && nodeLimit != UINT64_MAX
+     && (searchStats->nodes & 1023) == 1023 && !isPonderSearch
+     && getNodes() >= nodeLimit) {
+        isStop = true;
+        stopSignal = true;
     }
     if (stopSignal.load(std::memory_order_relaxed))
         return 0;
@@ -695,9 +1430,6 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
 
     int prevAlpha = alpha;
     int color = b.getPlayerToMove();
-    // For PVS, the node is a PV node if beta - alpha != 1 (not a null window)
-    // We do not want to do most pruning techniques on PV nodes
-    bool isPVNode = (beta - alpha != 1);
     // Reset killers of children to keep them local to similar positions
     searchParams->killers[ssi->ply+1][0] = NULL_MOVE;
     searchParams->killers[ssi->ply+1][1] = NULL_MOVE;
@@ -711,12 +1443,15 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
     int hashDepth = 0;
     uint8_t nodeType = NO_NODE_INFO;
 
-    HashEntry *hashEntry = transpositionTable.get(b);
-    if (hashEntry != nullptr) {
-        hashScore = hashEntry->score;
-        nodeType = hashEntry->ageNodeType & 0x3;
-        hashDepth = hashEntry->depth;
-        hashed = hashEntry->move;
+    HashEntry hashEntry;
+    bool hashHit = hashTable.get(b, hashEntry);
+    searchStats->hashProbes++;
+    searchStats->hashHits += hashHit;
+    if (hashHit) {
+        hashScore = hashEntry.score;
+        nodeType = hashEntry.getNodeType();
+        hashDepth = hashEntry.depth;
+        hashed = hashEntry.move;
 
         // Count hashed tb hits
         if (nodeType == PV_NODE && hashed == NULL_MOVE)
@@ -739,6 +1474,7 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
                 if ((nodeType == ALL_NODE && hashScore <= alpha)
                  || (nodeType == CUT_NODE && hashScore >= beta)
                  || (nodeType == PV_NODE)) {
+                    STAT_INC(ttCutoffs[nodeType]);
                     return hashScore;
                 }
             }
@@ -752,8 +1488,14 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
      && count(b.getAllPieces(WHITE) | b.getAllPieces(BLACK)) <= probeLimit
      && b.getFiftyMoveCounter() == 0
      && !b.getAnyCanCastle()) {
-        int tbProbeResult;
-        int tbValue = probe_wdl(b, &tbProbeResult);
+        int tbProbeResult = 1;
+        int tbValue;
+        TBProbeCache &tbCache = threadMemoryArray[threadID]->tbCache;
+        if (!tbCache.get(b.getZobristKey(), tbValue)) {
+            tbValue = probe_wdl(b, &tbProbeResult);
+            if (tbProbeResult != 0)
+                tbCache.add(b.getZobristKey(), tbValue);
+        }
 
         // Probe was successful
         if (tbProbeResult != 0) {
@@ -765,7 +1507,7 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
 
             // Hash the TB result
             int tbDepth = std::min(depth+4, MAX_DEPTH);
-            transpositionTable.add(b, adjustHashScore(tbScore, ssi->ply), NULL_MOVE, INFTY, tbDepth, PV_NODE);
+            hashTable.add(b, adjustHashScore(tbScore, ssi->ply), NULL_MOVE, INFTY, tbDepth, PV_NODE);
 
             return tbScore;
         }
@@ -779,16 +1521,24 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
     // A static evaluation, used to make numerous pruning decisions
     int staticEval = INFTY;
     ssi->staticEval = INFTY;
+    // Lazy evaluations are only estimates, so they are not saved in the hash table
+    int hashEval = INFTY;
     if (!isInCheck) {
         // Check the hash entry for a saved evaluation
-        if (hashEntry != nullptr && hashEntry->eval != INFTY) {
-            ssi->staticEval = staticEval = hashEntry->eval;
+        if (hashHit && hashEntry.eval != INFTY) {
+            ssi->staticEval = staticEval = hashEval = hashEntry.eval;
         }
-        else {
-            Eval e;
-            ssi->staticEval = staticEval = (color == WHITE) ? e.evaluate(b) : -e.evaluate(b);
-            transpositionTable.add(b, -INFTY, NULL_MOVE, staticEval, -8, NO_NODE_INFO);
+        // Near the leaves, only reverse futility pruning and razoring need
+        // the eval when it is far outside the window
+        else if (!isPVNode && depth <= 2) {
+            bool isExact;
+            ssi->staticEval = staticEval = lazyEvaluation(b, color,
+                alpha - RAZOR_MARGIN, beta + 70 * depth, isExact, threadID);
+            if (isExact)
+                hashEval = staticEval;
         }
+        else
+            ssi->staticEval = staticEval = hashEval = staticEvaluation(b, color, threadID);
     }
 
     // Use the TT score as a better "static" eval, if available.
@@ -812,8 +1562,10 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
     if (!isPVNode && !isInCheck
      && depth <= 6
      && staticEval - 70 * depth >= beta
-     && b.getNonPawnMaterial(color))
+     && b.getNonPawnMaterial(color)) {
+        STAT_INC(futilityPrunes[statsDepth(depth)]);
         return staticEval;
+    }
 
 
     // Razoring
@@ -824,13 +1576,17 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
     if (!isPVNode && !isInCheck
      && depth <= 2 && staticEval <= alpha - RAZOR_MARGIN) {
         searchParams->ply = ssi->ply;
-        if (depth == 1)
+        if (depth == 1) {
+            STAT_INC(razorPrunes[depth]);
             return quiescence(b, 0, alpha, beta, threadID);
+        }
 
         int rWindow = alpha - RAZOR_MARGIN;
         int value = quiescence(b, 0, rWindow, rWindow+1, threadID);
-        if (value <= rWindow)
+        if (value <= rWindow) {
+            STAT_INC(razorPrunes[depth]);
             return value;
+        }
     }
 
 
@@ -847,21 +1603,34 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
         int reduction = 2 + (32 * depth + std::min(staticEval - beta, 384)) / 128;
 
         uint16_t epCaptureFile = b.getEPCaptureFile();
+        int prevNullStart = threadMemoryArray[threadID]->twoFoldPositions.pushNull(b.getZobristKey());
         b.doNullMove();
+        if (evalWithNNUE)
+            threadMemoryArray[threadID]->accumulators.pushNull();
         (ssi+1)->counterMoveHistory = nullptr;
         (ssi+2)->followupMoveHistory = nullptr;
-        int nullScore = -PVS(b, depth-1-reduction, -beta, -alpha, threadID, !isCutNode, ssi+1, &line);
+        (ssi+1)->counterMove = nullptr;
+        (ssi+2)->followupMove = nullptr;
+        int nullScore = -PVS<false>(b, depth-1-reduction, -beta, -alpha, threadID, !isCutNode, ssi+1, &line);
 
         // Undo the null move
         b.undoNullMove(epCaptureFile);
+        if (evalWithNNUE)
+            threadMemoryArray[threadID]->accumulators.pop();
+        threadMemoryArray[threadID]->twoFoldPositions.popNull(prevNullStart);
 
         if (nullScore >= beta) {
             if (depth >= 10) {
-                int verifyScore = PVS(b, depth-1-reduction, alpha, beta, threadID, false, ssi, &line);
-                if (verifyScore >= beta)
+                int verifyScore = PVS<false>(b, depth-1-reduction, alpha, beta, threadID, false, ssi, &line);
+                if (verifyScore >= beta) {
+                    STAT_INC(nullMovePrunes[statsDepth(depth)]);
                     return verifyScore;
+                }
+            }
+            else {
+                STAT_INC(nullMovePrunes[statsDepth(depth)]);
+                return nullScore;
             }
-            else return nullScore;
         }
 
         searchParams->killers[ssi->ply+1][0] = NULL_MOVE;
@@ -869,12 +1638,11 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
     }
 
 
-    // Create list of legal moves
+    // Evasions are generated up front, other moves are generated in stages
+    // by the move orderer
     MoveList legalMoves;
     if (isInCheck)
-        b.getPseudoLegalCheckEscapes(legalMoves, color);
-    else
-        b.getAllPseudoLegalMoves(legalMoves, color);
+        b.getLegalCheckEscapes(legalMoves, color);
 
 
     // ProbCut
@@ -887,23 +1655,31 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
      && abs(beta) < MAX_PLY_MATE_SCORE) {
         int probCutMargin = beta + 90;
         int probCutCount = 0;
-        MoveOrder moveSorter(&b, color, depth, searchParams, ssi, NULL_MOVE, legalMoves, probCutMargin - staticEval);
+        MoveList probCutMoves;
+        MoveOrder moveSorter(&b, color, depth, searchParams, ssi, NULL_MOVE, probCutMoves, probCutMargin - staticEval);
         moveSorter.generateMoves();
 
         for (Move m = moveSorter.nextMove(); m != NULL_MOVE && probCutCount < 3 && isCapture(m);
                   m = moveSorter.nextMove()) {
             probCutCount++;
-            Board copy = b.staticCopy();
             // Search every move except the hash move
             if (m == hashed)
                 continue;
-            if (!copy.doPseudoLegalMove(m, color))
-                continue;
 
-            (ssi+1)->counterMoveHistory = searchParams->counterMoveHistory[b.getPieceOnSquare(color, getStartSq(m))][getEndSq(m)];
-            (ssi+2)->followupMoveHistory = searchParams->followupMoveHistory[b.getPieceOnSquare(color, getStartSq(m))][getEndSq(m)];
+            int pcPieceID = b.getPieceOnSquare(color, getStartSq(m));
+            (ssi+1)->counterMoveHistory = searchParams->counterMoveHistory[pcPieceID][getEndSq(m)];
+            (ssi+2)->followupMoveHistory = searchParams->followupMoveHistory[pcPieceID][getEndSq(m)];
+            (ssi+1)->counterMove = &(searchParams->counterMoves[color][pcPieceID][getEndSq(m)]);
+            (ssi+2)->followupMove = &(searchParams->followupMoves[color][pcPieceID][getEndSq(m)]);
+
+            UndoInfo undo;
+            if (!makeSearchMove(b, m, color, undo, threadID))
+                continue;
 
-            int score = -PVS(copy, depth - depth/4 - 4, -probCutMargin, -probCutMargin+1, threadID, !isCutNode, ssi+1, &line);
+            threadMemoryArray[threadID]->twoFoldPositions.push(undo.zobristKey);
+            int score = -PVS<false>(b, depth - depth/4 - 4, -probCutMargin, -probCutMargin+1, threadID, !isCutNode, ssi+1, &line);
+            unmakeSearchMove(b, m, color, undo, threadID);
+            threadMemoryArray[threadID]->twoFoldPositions.pop();
 
             if (score >= probCutMargin)
                 return score;
@@ -919,20 +1695,20 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
      && ((isPVNode && depth >= 6)
       || (!isPVNode && depth >= 8))) {
         int iidDepth = isPVNode ? depth - depth/4 - 1 : (depth - 5) / 2;
-        PVS(b, iidDepth, alpha, beta, threadID, isCutNode, ssi, &line);
-
-        HashEntry *iidEntry = transpositionTable.get(b);
-        if (iidEntry != nullptr) {
-            hashScore = iidEntry->score;
-            nodeType = iidEntry->ageNodeType & 0x3;
-            hashDepth = iidEntry->depth;
-            hashed = iidEntry->move;
+        PVS<isPVNode>(b, iidDepth, alpha, beta, threadID, isCutNode, ssi, &line);
+
+        HashEntry iidEntry;
+        if (hashTable.get(b, iidEntry)) {
+            hashScore = iidEntry.score;
+            nodeType = iidEntry.getNodeType();
+            hashDepth = iidEntry.depth;
+            hashed = iidEntry.move;
         }
     }
 
 
     // Initialize the module for move ordering
-    MoveOrder moveSorter(&b, color, depth, searchParams, ssi, hashed, legalMoves);
+    MoveOrder moveSorter(&b, color, depth, searchParams, ssi, hashed, isInCheck, legalMoves);
     moveSorter.generateMoves();
 
     // Keeps track of the best move for storing into the TT
@@ -941,14 +1717,20 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
     unsigned int movesSearched = 0;
     int bestScore = -INFTY;
     int score = -INFTY;
+    // Moves that another thread is searching, to be searched at the end
+    MoveList deferredMoves;
+    unsigned int deferredIndex = 0;
 
 
     //----------------------------Main search loop------------------------------
     for (Move m = moveSorter.nextMove(); m != NULL_MOVE;
-              m = moveSorter.nextMove()) {
+              m = nextSearchMove(moveSorter, deferredMoves, deferredIndex)) {
+        // Deferred moves have already passed the pruning checks
+        bool isDeferredMove = deferredIndex > 0;
         bool isCheckMove = b.isCheckMove(color, m);
         // Conditions for whether to do futility and move count pruning
-        bool moveIsPrunable = !isCapture(m)
+        bool moveIsPrunable = !isDeferredMove
+                           && !isCapture(m)
                            && !isPromotion(m)
                            && m != hashed
                            && bestScore > -MAX_PLY_MATE_SCORE
@@ -975,8 +1757,10 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
         // q-searching it.
         if (moveIsPrunable
          && !isInCheck
-         && pruneDepth <= 6 && staticEval <= alpha - 115 - 90 * pruneDepth)
+         && pruneDepth <= 6 && staticEval <= alpha - 115 - 90 * pruneDepth) {
+            STAT_INC(futilityPrunes[statsDepth(depth)]);
             continue;
+        }
 
 
         // Move count based pruning / Late move pruning
@@ -986,38 +1770,61 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
         bool doMoveCountPruning = depth <= 12
                                && movesSearched > LMP_MOVE_COUNTS[evalImproving][depth] + (isPVNode ? depth : 0);
         if (moveIsPrunable
-         && doMoveCountPruning)
+         && doMoveCountPruning) {
+            STAT_INC(lmpPrunes[statsDepth(depth)]);
             continue;
+        }
 
 
         // Prune moves with low history
         if (moveIsPrunable
          && pruneDepth <= 2
          && ((ssi->counterMoveHistory != nullptr) ? ssi->counterMoveHistory[pieceID][endSq] : -1) < 0
-         && ((ssi->followupMoveHistory != nullptr) ? ssi->followupMoveHistory[pieceID][endSq] : -1) < 0)
+         && ((ssi->followupMoveHistory != nullptr) ? ssi->followupMoveHistory[pieceID][endSq] : -1) < 0) {
+            STAT_INC(historyPrunes[statsDepth(depth)]);
             continue;
+        }
 
 
         // Futility pruning using SEE
         if (moveIsPrunable
          && pruneDepth <= 6
-         && !b.isSEEAbove(color, m, -24 * pruneDepth * pruneDepth))
+         && !b.isSEEAbove(color, m, -24 * pruneDepth * pruneDepth)) {
+            STAT_INC(seePrunes[statsDepth(depth)]);
             continue;
+        }
 
-        if (!isPVNode
+        if (!isPVNode && !isDeferredMove
          && m != hashed
          && bestScore > -MAX_PLY_MATE_SCORE
          && depth <= 5
-         && !b.isSEEAbove(color, m, -100 * depth))
+         && !b.isSEEAbove(color, m, -100 * depth)) {
+            STAT_INC(seePrunes[statsDepth(depth)]);
             continue;
+        }
 
 
-        // Copy the board and do the move
-        Board copy = b.staticCopy();
-        // If we are searching the hash move, we must use to a special
-        // move generator for extra verification.
+        // Start loading the child's hash bucket while the move is made
+        uint64_t childKey = b.getZobristKeyAfter(m, color);
+        hashTable.prefetch(childKey);
+
+        // ABDADA: at non-PV nodes, search moves that another thread is busy
+        // with last. PV nodes keep their move order.
+        uint64_t moveTag = 0;
+        if (!isPVNode && deferMoves && depth >= ABDADA_MIN_DEPTH) {
+            moveTag = DeferralTable::tag(childKey, depth);
+            if (!isDeferredMove && movesSearched > 0 && m != hashed
+             && deferralTable->isSearching(moveTag)) {
+                deferredMoves.add(m);
+                continue;
+            }
+        }
+
+        // If we are searching the hash move, we must verify that it is
+        // pseudo-legal in this position. The move list is advanced before the
+        // move is made, since the board is searched in place.
         if (m == hashed) {
-            if (!copy.doHashMove(m, color)) {
+            if (!b.isPseudoLegal(m, color)) {
                 hashed = NULL_MOVE;
                 moveSorter.hashed = NULL_MOVE;
                 moveSorter.generateMoves();
@@ -1025,8 +1832,20 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
             }
             moveSorter.generateMoves();
         }
-        else if (!copy.doPseudoLegalMove(m, color))
+
+        // The SEE for check extensions must be done before the move is made
+        bool extendCheck = !doMoveCountPruning
+                        && isCheckMove
+                        && b.isSEEAbove(color, m, 0);
+
+        UndoInfo undo;
+        if (!makeSearchMove(b, m, color, undo, threadID)) {
+            if (m == hashed) {
+                hashed = NULL_MOVE;
+                moveSorter.hashed = NULL_MOVE;
+            }
             continue;
+        }
         searchStats->nodes++;
 
         movesSearched++;
@@ -1065,14 +1884,14 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
 
         int extension = 0;
         // Check extensions
-        if (!doMoveCountPruning
-         && isCheckMove
-         && b.isSEEAbove(color, m, 0)) {
+        if (extendCheck) {
             extension++;
         }
 
         // Record two-fold stack since we may do a search for singular extensions
-        threadMemoryArray[threadID]->twoFoldPositions.push(b.getZobristKey());
+        threadMemoryArray[threadID]->twoFoldPositions.push(undo.zobristKey);
+        if (moveTag)
+            deferralTable->mark(moveTag);
 
         // Singular extensions
         // If the TT move appears to be much better than all others, extend the move
@@ -1082,28 +1901,43 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
          && (nodeType == CUT_NODE || nodeType == PV_NODE)
          && hashDepth >= depth - 3) {
             bool isSingular = true;
+            STAT_INC(singularTests);
+            // The other moves are searched from this node, so take back the
+            // hash move for now
+            unmakeSearchMove(b, m, color, undo, threadID);
+
+            // The move orderer has not generated the quiets yet, so get a
+            // full list of moves here
+            MoveList seMoves;
+            if (isInCheck)
+                b.getLegalCheckEscapes(seMoves, color);
+            else
+                b.getAllPseudoLegalMoves(seMoves, color);
 
             // Do a reduced depth search with a lowered window for a fail low check
-            for (unsigned int i = 0; i < legalMoves.size(); i++) {
-                Move seMove = legalMoves.get(i);
-                Board seCopy = b.staticCopy();
+            for (unsigned int i = 0; i < seMoves.size(); i++) {
+                Move seMove = seMoves.get(i);
                 // Search every move except the hash move
                 if (seMove == hashed)
                     continue;
-                if (!seCopy.doPseudoLegalMove(seMove, color))
-                    continue;
 
-                (ssi+1)->counterMoveHistory = searchParams->counterMoveHistory
-                    [b.getPieceOnSquare(color, getStartSq(seMove))][getEndSq(seMove)];
-                (ssi+2)->followupMoveHistory = searchParams->followupMoveHistory
-                    [b.getPieceOnSquare(color, getStartSq(seMove))][getEndSq(seMove)];
+                int sePieceID = b.getPieceOnSquare(color, getStartSq(seMove));
+                (ssi+1)->counterMoveHistory = searchParams->counterMoveHistory[sePieceID][getEndSq(seMove)];
+                (ssi+2)->followupMoveHistory = searchParams->followupMoveHistory[sePieceID][getEndSq(seMove)];
+                (ssi+1)->counterMove = &(searchParams->counterMoves[color][sePieceID][getEndSq(seMove)]);
+                (ssi+2)->followupMove = &(searchParams->followupMoves[color][sePieceID][getEndSq(seMove)]);
+
+                UndoInfo seUndo;
+                if (!makeSearchMove(b, seMove, color, seUndo, threadID))
+                    continue;
 
                 // The window is lowered more for higher depths
                 int SEWindow = hashScore - depth;
                 // Do a reduced search for fail-low confirmation
                 int SEDepth = depth / 2 - 1;
 
-                score = -PVS(seCopy, SEDepth, -SEWindow - 1, -SEWindow, threadID, !isCutNode, ssi+1, &line);
+                score = -PVS<false>(b, SEDepth, -SEWindow - 1, -SEWindow, threadID, !isCutNode, ssi+1, &line);
+                unmakeSearchMove(b, seMove, color, seUndo, threadID);
 
                 // If a move did not fail low, no singular extension
                 if (score > SEWindow) {
@@ -1112,39 +1946,54 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
                 }
             }
 
+            b.makeMove(m, color, undo);
+            if (evalWithNNUE)
+                threadMemoryArray[threadID]->accumulators.push(b, m, color, undo);
+
             searchParams->killers[ssi->ply+1][0] = NULL_MOVE;
             searchParams->killers[ssi->ply+1][1] = NULL_MOVE;
 
             // If all moves other than the hash move failed low, we extend for
             // the singular move
-            if (isSingular)
+            if (isSingular) {
+                STAT_INC(singularExtensions);
                 extension++;
+            }
         }
 
 
         (ssi+1)->counterMoveHistory = searchParams->counterMoveHistory[pieceID][endSq];
         (ssi+2)->followupMoveHistory = searchParams->followupMoveHistory[pieceID][endSq];
+        (ssi+1)->counterMove = &(searchParams->counterMoves[color][pieceID][endSq]);
+        (ssi+2)->followupMove = &(searchParams->followupMoves[color][pieceID][endSq]);
 
         // Null-window search, with re-search if applicable
         if (movesSearched > 1) {
-            score = -PVS(copy, depth-1-reduction+extension, -alpha-1, -alpha, threadID, true, ssi+1, &line);
+            score = -PVS<false>(b, depth-1-reduction+extension, -alpha-1, -alpha, threadID, true, ssi+1, &line);
+            if (reduction > 0)
+                STAT_INC(lmrSearches);
 
             // LMR re-search if the reduced search did not fail low
             if (reduction > 0 && score > alpha) {
-                score = -PVS(copy, depth-1+extension, -alpha-1, -alpha, threadID, !isCutNode, ssi+1, &line);
+                STAT_INC(lmrResearches);
+                score = -PVS<false>(b, depth-1+extension, -alpha-1, -alpha, threadID, !isCutNode, ssi+1, &line);
             }
 
             // Re-search for a scout window at PV nodes
             if (alpha < score && score < beta) {
-                score = -PVS(copy, depth-1+extension, -beta, -alpha, threadID, false, ssi+1, &line);
+                score = -PVS<true>(b, depth-1+extension, -beta, -alpha, threadID, false, ssi+1, &line);
             }
         }
 
         // The first move is always searched at a normal depth
         else {
-            score = -PVS(copy, depth-1+extension, -beta, -alpha, threadID, (isPVNode ? false : !isCutNode), ssi+1, &line);
+            score = -PVS<isPVNode>(b, depth-1+extension, -beta, -alpha, threadID, (isPVNode ? false : !isCutNode), ssi+1, &line);
         }
 
+        unmakeSearchMove(b, m, color, undo, threadID);
+        if (moveTag)
+            deferralTable->unmark(moveTag);
+
         // Pop the position in case we return early from this search
         threadMemoryArray[threadID]->twoFoldPositions.pop();
 
@@ -1155,7 +2004,8 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
         // Beta cutoff
         if (score >= beta) {
             // Hash the cut move and score
-            transpositionTable.add(b, adjustHashScore(score, ssi->ply), m, ssi->staticEval, depth, CUT_NODE);
+            hashTable.add(b, adjustHashScore(score, ssi->ply), m, hashEval, depth, CUT_NODE);
+            STAT_INC(betaCutoffs[std::min(movesSearched, (unsigned int) STATS_CUTOFF_INDICES) - 1]);
 
             // Update killers and histories for quiet moves
             if (!isCapture(m)) {
@@ -1165,6 +2015,10 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
                         searchParams->killers[ssi->ply][0];
                     searchParams->killers[ssi->ply][0] = m;
                 }
+                if (ssi->counterMove != nullptr)
+                    *(ssi->counterMove) = m;
+                if (ssi->followupMove != nullptr)
+                    *(ssi->followupMove) = m;
                 moveSorter.updateHistories(m);
             }
             else
@@ -1194,7 +2048,7 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
 
     // Exact scores indicate a principal variation
     if (prevAlpha < alpha && alpha < beta) {
-        transpositionTable.add(b, adjustHashScore(alpha, ssi->ply), toHash, ssi->staticEval, depth, PV_NODE);
+        hashTable.add(b, adjustHashScore(alpha, ssi->ply), toHash, hashEval, depth, PV_NODE);
 
         // Update histories for quiet moves
         if (!isCapture(toHash))
@@ -1207,11 +2061,11 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
     else if (alpha <= prevAlpha) {
         // If we had a hash move, save it in case the node becomes a PV or cut node next time
         if (!isPVNode && hashed != NULL_MOVE) {
-            transpositionTable.add(b, adjustHashScore(bestScore, ssi->ply), hashed, ssi->staticEval, depth, ALL_NODE);
+            hashTable.add(b, adjustHashScore(bestScore, ssi->ply), hashed, hashEval, depth, ALL_NODE);
         }
         // Otherwise, just store no best move as expected
         else {
-            transpositionTable.add(b, adjustHashScore(bestScore, ssi->ply), NULL_MOVE, ssi->staticEval, depth, ALL_NODE);
+            hashTable.add(b, adjustHashScore(bestScore, ssi->ply), NULL_MOVE, hashEval, depth, ALL_NODE);
         }
     }
 
@@ -1226,8 +2080,9 @@ int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode,
  * spent here.
  * The search is a fail-soft PVS.
  */
-int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
+int SearchContext::quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
     SearchParameters *searchParams = &(threadMemoryArray[threadID]->searchParams);
+    Hash &hashTable = *(threadMemoryArray[threadID]->hashTable);
     SearchStatistics *searchStats = &(threadMemoryArray[threadID]->searchStats);
     int color = b.getPlayerToMove();
 
@@ -1238,8 +2093,13 @@ int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
     if (b.isInsufficientMaterial())
         return 0;
     // Check for repetition draws while we are still considering checks
-    if (b.getFiftyMoveCounter() >= 2 && threadMemoryArray[threadID]->twoFoldPositions.find(b.getZobristKey()))
+    if (threadMemoryArray[threadID]->twoFoldPositions.find(b.getZobristKey(), b.getFiftyMoveCounter()))
         return 0;
+    if (alpha < 0 && threadMemoryArray[threadID]->twoFoldPositions.hasUpcomingRepetition(b)) {
+        alpha = 0;
+        if (alpha >= beta)
+            return alpha;
+    }
 
     // Stop condition to help break out as quickly as possible
     if (stopSignal.load(std::memory_order_relaxed))
@@ -1247,10 +2107,13 @@ int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
 
     // Qsearch hash table probe
     int hashScore = -INFTY;
-    HashEntry *hashEntry = transpositionTable.get(b);
+    HashEntry hashEntry;
+    bool hashHit = hashTable.get(b, hashEntry);
+    searchStats->hashProbes++;
+    searchStats->hashHits += hashHit;
     uint8_t nodeType = NO_NODE_INFO;
-    if (hashEntry != nullptr) {
-        hashScore = hashEntry->score;
+    if (hashHit) {
+        hashScore = hashEntry.score;
 
         if (hashScore != -INFTY) {
             // Adjust the hash score to mate distance from root if necessary
@@ -1259,10 +2122,10 @@ int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
             else if (hashScore <= -MAX_PLY_MATE_SCORE)
                 hashScore += searchParams->ply + plies;
 
-            nodeType = hashEntry->ageNodeType & 0x3;
+            nodeType = hashEntry.getNodeType();
             // Only used a hashed score if the search depth was at least
             // the current depth
-            if (hashEntry->depth >= -plies) {
+            if (hashEntry.depth >= -plies) {
                 // Check for the correct node type and bounds
                 if ((nodeType == ALL_NODE && hashScore <= alpha)
                  || (nodeType == CUT_NODE && hashScore >= beta)
@@ -1277,19 +2140,15 @@ int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
     // we can simply stop the search here.
     int hashEval, staticEval;
     // Check the hash entry for a saved evaluation
-    if (hashEntry != nullptr) {
-        if (hashEntry->eval != INFTY) {
-            hashEval = staticEval = hashEntry->eval;
-        }
-        else {
-            Eval e;
-            hashEval = staticEval = (color == WHITE) ? e.evaluate(b) : -e.evaluate(b);
-        }
-    }
+    if (hashHit && hashEntry.eval != INFTY)
+        hashEval = staticEval = hashEntry.eval;
     else {
-        Eval e;
-        hashEval = staticEval = (color == WHITE) ? e.evaluate(b) : -e.evaluate(b);
-        transpositionTable.add(b, -INFTY, NULL_MOVE, hashEval, -8, NO_NODE_INFO);
+        // When the stand pat is far outside the window, a lazy eval is enough,
+        // but it is not saved in the hash table
+        bool isExact;
+        hashEval = staticEval = lazyEvaluation(b, color, alpha, beta, isExact, threadID);
+        if (!isExact)
+            hashEval = INFTY;
     }
 
     // Use the TT score as a better "static" eval, if available.
@@ -1311,7 +2170,8 @@ int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
 
 
     // Initialize the module for move ordering
-    MoveOrder moveSorter(&b, color, -plies, searchParams);
+    MoveList captures;
+    MoveOrder moveSorter(&b, color, -plies, searchParams, captures);
     moveSorter.generateMoves();
 
     for (Move m = moveSorter.nextMove(); m != NULL_MOVE;
@@ -1330,16 +2190,21 @@ int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
         if (!b.isSEEAbove(color, m, 0))
             continue;
 
-        Board copy = b.staticCopy();
-        if (!copy.doPseudoLegalMove(m, color))
+        hashTable.prefetch(b.getZobristKeyAfter(m, color));
+        UndoInfo undo;
+        if (!makeSearchMove(b, m, color, undo, threadID))
             continue;
 
         searchStats->nodes++;
-        int score = isCheckMove ? -checkQuiescence(copy, plies+1, -beta, -alpha, threadID)
-                                : -quiescence(copy, plies+1, -beta, -alpha, threadID);
+        STAT_INC(qsNodes);
+        threadMemoryArray[threadID]->twoFoldPositions.push(undo.zobristKey);
+        int score = isCheckMove ? -checkQuiescence(b, plies+1, -beta, -alpha, threadID)
+                                : -quiescence(b, plies+1, -beta, -alpha, threadID);
+        unmakeSearchMove(b, m, color, undo, threadID);
+        threadMemoryArray[threadID]->twoFoldPositions.pop();
 
         if (score >= beta) {
-            transpositionTable.add(b, adjustHashScore(score, searchParams->ply + plies), m, hashEval, -plies, CUT_NODE);
+            hashTable.add(b, adjustHashScore(score, searchParams->ply + plies), m, hashEval, -plies, CUT_NODE);
             return score;
         }
 
@@ -1357,15 +2222,16 @@ int quiescence(Board &b, int plies, int alpha, int beta, int threadID) {
  * When checks are considered in quiescence, the responses must include all moves,
  * not just captures, necessitating this function.
  */
-int checkQuiescence(Board &b, int plies, int alpha, int beta, int threadID) {
-    if (b.getFiftyMoveCounter() >= 2 && threadMemoryArray[threadID]->twoFoldPositions.find(b.getZobristKey()))
+int SearchContext::checkQuiescence(Board &b, int plies, int alpha, int beta, int threadID) {
+    if (threadMemoryArray[threadID]->twoFoldPositions.find(b.getZobristKey(), b.getFiftyMoveCounter()))
         return 0;
 
     SearchParameters *searchParams = &(threadMemoryArray[threadID]->searchParams);
+    Hash &hashTable = *(threadMemoryArray[threadID]->hashTable);
     SearchStatistics *searchStats = &(threadMemoryArray[threadID]->searchStats);
     int color = b.getPlayerToMove();
     MoveList legalMoves;
-    b.getPseudoLegalCheckEscapes(legalMoves, color);
+    b.getLegalCheckEscapes(legalMoves, color);
 
     int bestScore = -INFTY;
     int score = -INFTY;
@@ -1377,14 +2243,16 @@ int checkQuiescence(Board &b, int plies, int alpha, int beta, int threadID) {
          && !b.isSEEAbove(color, m, 0))
             continue;
 
-        Board copy = b.staticCopy();
-        if (!copy.doPseudoLegalMove(m, color))
-            continue;
+        hashTable.prefetch(b.getZobristKeyAfter(m, color));
+        UndoInfo undo;
+        makeLegalSearchMove(b, m, color, undo, threadID);
 
         searchStats->nodes++;
-        threadMemoryArray[threadID]->twoFoldPositions.push(b.getZobristKey());
+        STAT_INC(qsNodes);
+        threadMemoryArray[threadID]->twoFoldPositions.push(undo.zobristKey);
 
-        score = -quiescence(copy, plies+1, -beta, -alpha, threadID);
+        score = -quiescence(b, plies+1, -beta, -alpha, threadID);
+        unmakeSearchMove(b, m, color, undo, threadID);
 
         threadMemoryArray[threadID]->twoFoldPositions.pop();
 
@@ -1413,6 +2281,69 @@ int checkQuiescence(Board &b, int plies, int alpha, int beta, int threadID) {
 //-----------------------------Search Helpers-----------------------------------
 //------------------------------------------------------------------------------
 
+// Makes and unmakes moves in the search tree, keeping the NNUE accumulator
+// stack in sync with the board
+inline bool SearchContext::makeSearchMove(Board &b, Move m, int color, UndoInfo &undo, int threadID) {
+    if (!b.makePseudoLegalMove(m, color, undo))
+        return false;
+    if (evalWithNNUE)
+        threadMemoryArray[threadID]->accumulators.push(b, m, color, undo);
+    return true;
+}
+
+// For moves from a legal move generator, which need no check after the make
+inline void SearchContext::makeLegalSearchMove(Board &b, Move m, int color, UndoInfo &undo, int threadID) {
+    b.makeMove(m, color, undo);
+    if (evalWithNNUE)
+        threadMemoryArray[threadID]->accumulators.push(b, m, color, undo);
+}
+
+inline void SearchContext::unmakeSearchMove(Board &b, Move m, int color, const UndoInfo &undo, int threadID) {
+    b.unmakeMove(m, color, undo);
+    if (evalWithNNUE)
+        threadMemoryArray[threadID]->accumulators.pop();
+}
+
+// The static evaluation from the side to move's perspective, from the network
+// if one is enabled and the handcrafted evaluation otherwise
+inline int SearchContext::staticEvaluation(Board &b, int color, int threadID) {
+    EvalCache &evalCache = threadMemoryArray[threadID]->evalCache;
+    int eval;
+    if (evalCache.get(b.getZobristKey(), eval))
+        return eval;
+
+    if (evalWithNNUE)
+        eval = threadMemoryArray[threadID]->accumulators.evaluate(b);
+    else {
+        eval = threadMemoryArray[threadID]->evaluator.evaluate(b);
+        if (color == BLACK)
+            eval = -eval;
+    }
+    evalCache.add(b.getZobristKey(), eval);
+    return eval;
+}
+
+// A static evaluation that may skip its expensive terms when it is far outside
+// (alpha, beta), given from the side to move's perspective. Only the
+// handcrafted evaluation has a lazy mode, and only exact results are cached.
+inline int SearchContext::lazyEvaluation(Board &b, int color, int alpha, int beta, bool &isExact, int threadID) {
+    isExact = true;
+    if (evalWithNNUE)
+        return staticEvaluation(b, color, threadID);
+
+    EvalCache &evalCache = threadMemoryArray[threadID]->evalCache;
+    int eval;
+    if (evalCache.get(b.getZobristKey(), eval))
+        return eval;
+
+    Eval &evaluator = threadMemoryArray[threadID]->evaluator;
+    eval = (color == WHITE) ?  evaluator.evaluate(b, alpha, beta, isExact)
+                            : -evaluator.evaluate(b, -beta, -alpha, isExact);
+    if (isExact)
+        evalCache.add(b.getZobristKey(), eval);
+    return eval;
+}
+
 // Used to get a score when we have realized that we have no legal moves.
 int scoreMate(bool isInCheck, int plies) {
     // If we are in check, then it is a checkmate
@@ -1435,32 +2366,44 @@ int adjustHashScore(int score, int plies) {
 }
 
 
-// Pondering
-void startPonder() {
-    isPonderSearch = true;
-}
-
-void stopPonder() {
-    isPonderSearch = false;
-}
-
-
 //------------------------------------------------------------------------------
 //------------------------------Other functions---------------------------------
 //------------------------------------------------------------------------------
 
 // These functions help to communicate with uci.cpp
-void clearTables() {
-    transpositionTable.clear();
-    for (int i = 0; i < numThreads; i++)
+void SearchContext::clearTables() {
+    transpositionTable.clear(numThreads, useThreadAffinity);
+    for (int i = 0; i < numThreads; i++) {
         threadMemoryArray[i]->searchParams.resetHistoryTable();
+        threadMemoryArray[i]->tbCache.clear();
+        threadMemoryArray[i]->evalCache.clear();
+    }
+}
+
+// The cached evaluations depend on the evaluator, so they must be dropped when
+// it changes
+void SearchContext::clearEvalCache() {
+    for (int i = 0; i < numThreads; i++)
+        threadMemoryArray[i]->evalCache.clear();
+}
+
+void SearchContext::setHashSize(uint64_t MB) {
+    transpositionTable.setSize(MB, numThreads, useThreadAffinity);
 }
 
-void setHashSize(uint64_t MB) {
-    transpositionTable.setSize(MB);
+uint64_t SearchContext::getHashPageSize() {
+    return transpositionTable.getPageSize();
 }
 
-uint64_t getNodes() {
+bool SearchContext::saveHash(const std::string &path) {
+    return transpositionTable.save(path);
+}
+
+bool SearchContext::loadHash(const std::string &path) {
+    return transpositionTable.load(path);
+}
+
+uint64_t SearchContext::getNodes() {
     uint64_t total = 0;
     for (int i = 0; i < numThreads; i++) {
         total += threadMemoryArray[i]->searchStats.nodes;
@@ -1468,7 +2411,23 @@ uint64_t getNodes() {
     return total;
 }
 
-uint64_t getTBHits() {
+uint64_t SearchContext::getHashProbes() {
+    uint64_t total = 0;
+    for (int i = 0; i < numThreads; i++) {
+        total += threadMemoryArray[i]->searchStats.hashProbes;
+    }
+    return total;
+}
+
+uint64_t SearchContext::getHashHits() {
+    uint64_t total = 0;
+    for (int i = 0; i < numThreads; i++) {
+        total += threadMemoryArray[i]->searchStats.hashHits;
+    }
+    return total;
+}
+
+uint64_t SearchContext::getTBHits() {
     uint64_t total = 0;
     for (int i = 0; i < numThreads; i++) {
         total += threadMemoryArray[i]->searchStats.tbhits;
@@ -1476,29 +2435,303 @@ uint64_t getTBHits() {
     return total;
 }
 
-void setMultiPV(unsigned int n) {
+void SearchContext::setMultiPV(unsigned int n) {
     multiPV = n;
 }
 
-void setNumThreads(int n) {
-    numThreads = n;
+int SearchContext::getNumThreads() {
+    return numThreads;
+}
 
-    while ((int) threadMemoryArray.size() < n)
-        threadMemoryArray.push_back(new ThreadMemory());
-    while ((int) threadMemoryArray.size() > n) {
+// Recreates the helper threads, which allocate their own thread memory so
+// that it is local to the core they run on.
+void SearchContext::setNumThreads(int n) {
+    threadPool->stop();
+    while (threadMemoryArray.size() > 1) {
         delete threadMemoryArray.back();
         threadMemoryArray.pop_back();
     }
+
+    numThreads = n;
+    threadMemoryArray.resize(n, nullptr);
+    threadPool->start(n - 1, useThreadAffinity);
+}
+
+void SearchContext::setABDADA(bool enabled) {
+    useABDADA = enabled;
+}
+
+void SearchContext::setParallelMultiPV(bool enabled) {
+    useParallelMultiPV = enabled;
+}
+
+void SearchContext::setUseNNUE(bool enabled) {
+    if (enabled != useNNUE)
+        clearEvalCache();
+    useNNUE = enabled;
 }
 
-void initPerThreadMemory() {
-    threadMemoryArray.push_back(new ThreadMemory());
+bool SearchContext::isUsingNNUE() {
+    return useNNUE && isNNUELoaded();
 }
 
-TwoFoldStack *getTwoFoldStackPointer() {
+void SearchContext::setThreadAffinity(bool enabled) {
+    useThreadAffinity = enabled;
+    setNumThreads(numThreads);
+}
+
+TwoFoldStack *SearchContext::getTwoFoldStackPointer() {
     return &(threadMemoryArray[0]->twoFoldPositions);
 }
 
+// A table of the counters collected by all threads during the last search
+std::string SearchContext::getSearchStatsReport() {
+#ifdef USE_SEARCH_STATS
+    SearchCounters total;
+    for (int i = 0; i < numThreads; i++)
+        total.add(threadMemoryArray[i]->counters);
+    uint64_t nodes = getNodes();
+    uint64_t cutoffs = 0;
+    for (int i = 0; i < STATS_CUTOFF_INDICES; i++)
+        cutoffs += total.betaCutoffs[i];
+
+    std::ostringstream report;
+    report << "Nodes         : " << nodes << " (" << getPercentage(total.qsNodes, nodes) << "% qsearch)\n";
+    report << "TT hit rate   : " << getPercentage(getHashHits(), getHashProbes()) << "% of "
+           << getHashProbes() << " probes\n";
+    report << "TT cutoffs    : pv " << total.ttCutoffs[PV_NODE] << ", cut " << total.ttCutoffs[CUT_NODE]
+           << ", all " << total.ttCutoffs[ALL_NODE] << "\n";
+    report << "Beta cutoffs  : " << cutoffs << " (" << getPercentage(total.betaCutoffs[0], cutoffs)
+           << "% on the first move)\n";
+    report << "Cutoff index  :";
+    for (int i = 0; i < STATS_CUTOFF_INDICES; i++) {
+        report << " " << i+1 << (i == STATS_CUTOFF_INDICES - 1 ? "+ " : " ")
+               << getPercentage(total.betaCutoffs[i], cutoffs) << "%";
+    }
+    report << "\n";
+    report << "LMR re-search : " << getPercentage(total.lmrResearches, total.lmrSearches) << "% of "
+           << total.lmrSearches << " reduced searches\n";
+    report << "Singular ext. : " << total.singularExtensions << " of " << total.singularTests << " tests\n";
+
+    report << "Prunes by depth:\n";
+    report << "depth" << std::setw(11) << "null" << std::setw(11) << "razor" << std::setw(11) << "futility"
+           << std::setw(11) << "lmp" << std::setw(11) << "history" << std::setw(11) << "see" << "\n";
+    for (int d = 0; d < STATS_DEPTHS; d++) {
+        uint64_t row = total.nullMovePrunes[d] + total.razorPrunes[d] + total.futilityPrunes[d]
+                     + total.lmpPrunes[d] + total.historyPrunes[d] + total.seePrunes[d];
+        if (row == 0)
+            continue;
+        report << std::setw(5) << (d == STATS_DEPTHS - 1 ? "15+" : std::to_string(d))
+               << std::setw(11) << total.nullMovePrunes[d] << std::setw(11) << total.razorPrunes[d]
+               << std::setw(11) << total.futilityPrunes[d] << std::setw(11) << total.lmpPrunes[d]
+               << std::setw(11) << total.historyPrunes[d] << std::setw(11) << total.seePrunes[d] << "\n";
+    }
+    return report.str();
+#else
+    return "Search statistics are not compiled in, rebuild with STATS=true\n";
+#endif
+}
+
+// A one line version of the statistics for printing after each iteration
+std::string SearchContext::getSearchStatsSummary() {
+    std::ostringstream info;
+#ifdef USE_SEARCH_STATS
+    SearchCounters total;
+    for (int i = 0; i < numThreads; i++)
+        total.add(threadMemoryArray[i]->counters);
+    uint64_t cutoffs = 0;
+    for (int i = 0; i < STATS_CUTOFF_INDICES; i++)
+        cutoffs += total.betaCutoffs[i];
+
+    info << "info string stats tthit " << getPercentage(getHashHits(), getHashProbes())
+         << "% firstcutoff " << getPercentage(total.betaCutoffs[0], cutoffs)
+         << "% qsnodes " << getPercentage(total.qsNodes, getNodes())
+         << "% lmrresearch " << getPercentage(total.lmrResearches, total.lmrSearches)
+         << "% singular " << total.singularExtensions << "/" << total.singularTests;
+#endif
+    return info.str();
+}
+
+
+//------------------------------------------------------------------------------
+//--------------------------------Batch analysis--------------------------------
+//------------------------------------------------------------------------------
+// Sets up workers for independent single threaded searches. Worker i searches
+// with the memory of thread i+1, so the main thread's UCI output and time
+// checks never apply. With hashMB = 0 the workers share the main table.
+// The workers run on the caller's threads, so their memory is created here
+// without starting any pool helpers.
+void SearchContext::initAnalysisWorkers(int workers, uint64_t hashMB) {
+    threadPool->stop();
+    while (threadMemoryArray.size() > 1) {
+        delete threadMemoryArray.back();
+        threadMemoryArray.pop_back();
+    }
+
+    numThreads = workers + 1;
+    threadMemoryArray.resize(numThreads, nullptr);
+    for (int i = 1; i <= workers; i++) {
+        threadMemoryArray[i] = new ThreadMemory(&transpositionTable);
+        if (hashMB > 0) {
+            analysisTables.push_back(new Hash(hashMB));
+            threadMemoryArray[i]->hashTable = analysisTables.back();
+        }
+        threadMemoryArray[i]->searchParams.resetHistoryTable();
+    }
+
+    timeLimit = MAX_TIME;
+    nodeLimit = UINT64_MAX;
+    probeLimit = TBlargest;
+    evalWithNNUE = isUsingNNUE();
+    stopSignal = false;
+}
+
+void SearchContext::releaseAnalysisWorkers(int prevThreads) {
+    // Recreating the thread memory drops the pointers to the worker tables
+    setNumThreads(prevThreads);
+    for (unsigned int i = 0; i < analysisTables.size(); i++)
+        delete analysisTables[i];
+    analysisTables.clear();
+}
+
+// Searches b to a fixed depth on the calling thread
+void SearchContext::analyzePosition(const Board &b, int depth, int worker, AnalysisResult &result) {
+    int threadID = worker + 1;
+    ThreadMemory *memory = threadMemoryArray[threadID];
+    memory->searchParams.reset();
+    memory->searchParams.selectiveDepth = 0;
+    memory->searchStats.reset();
+    memory->twoFoldPositions.clear();
+    // There is no game history, so the root is the first position of the
+    // search tree
+    memory->twoFoldPositions.setRootEnd();
+    if (memory->hashTable != &transpositionTable)
+        memory->hashTable->incrementAge();
+
+    const int color = b.getPlayerToMove();
+    MoveList legalMoves = b.getAllLegalMoves(color);
+    result.bestMove = NULL_MOVE;
+    result.depth = 0;
+    result.pv = "";
+    if (legalMoves.size() == 0) {
+        result.score = b.isInCheck(color) ? -MATE_SCORE : 0;
+        result.nodes = 0;
+        return;
+    }
+
+    int bestScore = -INFTY;
+    for (int rootDepth = 1; rootDepth <= depth; rootDepth++) {
+        SearchPV pvLine;
+        int bestMoveIndex = -1;
+        int delta = 14 - std::min(rootDepth/4, 6) + abs(bestScore) / 25;
+        int aspAlpha = -MATE_SCORE;
+        int aspBeta = MATE_SCORE;
+        if (rootDepth >= 6 && abs(bestScore) < NEAR_MATE_SCORE) {
+            aspAlpha = bestScore - delta;
+            aspBeta = bestScore + delta;
+        }
+
+        // Aspiration loop, as in getBestMove()
+        while (true) {
+            memory->searchParams.reset();
+            pvLine.pvLength = 0;
+            getBestMoveAtDepth(&b, &legalMoves, rootDepth, aspAlpha, aspBeta,
+                &bestMoveIndex, &bestScore, 0, threadID, &pvLine);
+
+            if (bestMoveIndex == -1) {
+                aspBeta = (aspAlpha + aspBeta) / 2;
+                aspAlpha = bestScore - delta;
+                if (aspAlpha < -NEAR_MATE_SCORE)
+                    aspAlpha = -MATE_SCORE;
+            }
+            else if (bestScore >= aspBeta) {
+                aspAlpha = (aspAlpha + aspBeta) / 2;
+                aspBeta = bestScore + delta;
+                if (aspBeta > NEAR_MATE_SCORE)
+                    aspBeta = MATE_SCORE;
+                legalMoves.swap(0, bestMoveIndex);
+            }
+            else break;
+            delta = 3 * delta / 2;
+        }
+
+        legalMoves.swap(0, bestMoveIndex);
+        result.bestMove = legalMoves.get(0);
+        result.score = bestScore;
+        result.depth = rootDepth;
+        result.pv = retrievePV(&pvLine);
+    }
+    result.nodes = memory->searchStats.nodes;
+}
+
+
+//------------------------------------------------------------------------------
+//---------------------------------Thread pool----------------------------------
+//------------------------------------------------------------------------------
+
+void SearchThreadPool::start(int numHelpers, bool pinThreads) {
+    std::unique_lock<std::mutex> lock(poolMutex);
+    exiting = false;
+    helpersBusy = numHelpers;
+    for (int i = 1; i <= numHelpers; i++)
+        helpers.push_back(std::thread(&SearchThreadPool::helperLoop, this, i, pinThreads));
+    // Wait for every helper to set up its thread memory
+    doneCV.wait(lock, [this] { return helpersBusy == 0; });
+}
+
+void SearchThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        exiting = true;
+    }
+    startCV.notify_all();
+    for (unsigned int i = 0; i < helpers.size(); i++)
+        helpers[i].join();
+    helpers.clear();
+}
+
+void SearchThreadPool::startSearch(const SearchJob &searchJob) {
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        job = searchJob;
+        helpersBusy = (int) helpers.size();
+        generation++;
+    }
+    startCV.notify_all();
+}
+
+void SearchThreadPool::waitForSearch() {
+    std::unique_lock<std::mutex> lock(poolMutex);
+    doneCV.wait(lock, [this] { return helpersBusy == 0; });
+}
+
+void SearchThreadPool::helperLoop(int threadID, bool pinThread) {
+    if (pinThread)
+        pinToCPU(threadID);
+    context->threadMemoryArray[threadID] = new ThreadMemory(&context->transpositionTable);
+
+    std::unique_lock<std::mutex> lock(poolMutex);
+    uint64_t lastGeneration = generation;
+    if (--helpersBusy == 0)
+        doneCV.notify_all();
+
+    while (true) {
+        startCV.wait(lock, [&] { return exiting || generation != lastGeneration; });
+        if (exiting)
+            return;
+        lastGeneration = generation;
+        SearchJob searchJob = job;
+        lock.unlock();
+
+        context->getBestMove(searchJob.b, searchJob.timeParams, searchJob.legalMoves,
+            searchJob.tbScore, searchJob.tbProbeSuccess, threadID);
+
+        lock.lock();
+        if (--helpersBusy == 0)
+            doneCV.notify_all();
+    }
+}
+
 
 // Retrieves the next move with the highest score, starting from index using a
 // partial selection sort. This way, the entire list does not have to be sorted
@@ -1521,6 +2754,20 @@ Move nextMove(MoveList &moves, ScoreList &scores, unsigned int index) {
     return moves.get(index);
 }
 
+// Returns the next move for the main search loop. Once the move sorter runs
+// out, the moves that were deferred because another thread was searching them
+// are returned.
+inline Move nextSearchMove(MoveOrder &moveSorter, MoveList &deferredMoves, unsigned int &deferredIndex) {
+    if (deferredIndex == 0) {
+        Move m = moveSorter.nextMove();
+        if (m != NULL_MOVE)
+            return m;
+    }
+    if (deferredIndex < deferredMoves.size())
+        return deferredMoves.get(deferredIndex++);
+    return NULL_MOVE;
+}
+
 // Copies the new PV line when alpha is raised
 void changePV(Move best, SearchPV *parent, SearchPV *child) {
     parent->pv[0] = best;
@@ -1540,9 +2787,20 @@ std::string retrievePV(SearchPV *pvLine) {
     return pvStr;
 }
 
+// Returns the hashfull estimate for info output, refreshing it at most every
+// HASHFULL_INTERVAL ms
+int SearchContext::getHashfull() {
+    uint64_t timeSoFar = getTimeElapsed(startTime);
+    if (hashfull < 0 || timeSoFar >= hashfullTime + HASHFULL_INTERVAL) {
+        hashfull = transpositionTable.estimateHashfull();
+        hashfullTime = timeSoFar;
+    }
+    return hashfull;
+}
+
 // The selective depth in a parallel search is the max selective depth reached
 // by any of the threads
-int getSelectiveDepth() {
+int SearchContext::getSelectiveDepth() {
     int max = 0;
     for (int i = 0; i < numThreads; i++)
         if (threadMemoryArray[i]->searchParams.selectiveDepth > max)
@@ -19,8 +19,19 @@
 #ifndef __SEARCH_H__
 #define __SEARCH_H__
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "board.h"
 #include "common.h"
+#include "hash.h"
 #include "timeman.h"
 
 /*
@@ -33,42 +44,69 @@
  * only find the first repeat from the top of the stack since we have the
  * condition that the branch terminates immediately returning 0 if two-fold
  * repetition occurs in that branch.
+ * Only the last fiftyMoveCounter positions can repeat the current one, and of
+ * those only every other one has the same side to move, so the scans are
+ * bounded by the fifty move counter and step by two plies.
  */
 struct TwoFoldStack {
 public:
-    uint64_t keys[256];
+    std::vector<uint64_t> keys;
     int rootEnd;
     int length;
+    // Index of the first position after the last null move in the search.
+    // Repetitions are not counted through a null move.
+    int nullStart;
 
-    TwoFoldStack() {
+    TwoFoldStack() : keys(256) {
         rootEnd = 0;
         length = 0;
+        nullStart = 0;
     }
     ~TwoFoldStack() {}
 
+    // The game history in a long game can exceed the initial capacity
     void push(uint64_t pos) {
+        if (length == (int) keys.size())
+            keys.resize(2 * keys.size());
         keys[length] = pos;
         length++;
     }
 
     void pop() { length--; }
 
+    // Records the position before a null move. The returned boundary must be
+    // given back to popNull() when the null move is undone.
+    int pushNull(uint64_t pos) {
+        int prevNullStart = nullStart;
+        push(pos);
+        nullStart = length;
+        return prevNullStart;
+    }
+
+    void popNull(int prevNullStart) {
+        pop();
+        nullStart = prevNullStart;
+    }
+
     void clear() {
         rootEnd = 0;
         length = 0;
+        nullStart = 0;
     }
 
     void setRootEnd() { rootEnd = length - 1; }
 
-    bool find(uint64_t pos) {
-        for (int i = length-1; i >= 0; i--) {
+    bool find(uint64_t pos, int fiftyMoveCounter) const {
+        int end = std::max(length - fiftyMoveCounter, nullStart);
+        for (int i = length-2; i >= end; i -= 2) {
             if (keys[i] == pos) {
                 // If the repetition occurred in the actual game, search for a third repetition.
                 // This allows two-folds to terminate search only when the two-fold occurred entirely within the search tree.
                 if (i <= rootEnd) {
-                    for (int j = i-1; j >= 0; j--) {
+                    for (int j = i-2; j >= end; j -= 2) {
                         if (keys[j] == pos) return true;
                     }
+                    return false;
                 }
                 // The two-fold repetition occurred within the search tree, return true.
                 else return true;
@@ -76,6 +114,19 @@ public:
         }
         return false;
     }
+
+    // Returns true if the side to move has a reversible move back to a
+    // position earlier in the search tree, so that a repetition draw is one
+    // ply away. Only positions an odd number of plies back can be reached.
+    bool hasUpcomingRepetition(const Board &b) const {
+        int end = std::max(length - b.getFiftyMoveCounter(), std::max(nullStart, rootEnd + 1));
+        uint64_t pos = b.getZobristKey();
+        for (int i = length-3; i >= end; i -= 2) {
+            if (b.isReversibleMoveKey(pos ^ keys[i]))
+                return true;
+        }
+        return false;
+    }
 };
 
 /**
@@ -84,23 +135,193 @@ public:
 struct SearchStackInfo {
     int ply;
     int staticEval;
-    int **counterMoveHistory;
-    int **followupMoveHistory;
+    int16_t (*counterMoveHistory)[64];
+    int16_t (*followupMoveHistory)[64];
+    // The counter move and followup move slots for this node
+    Move *counterMove;
+    Move *followupMove;
 };
 
-void getBestMoveThreader(const Board *b, TimeManagement *timeParams, MoveList *movesToSearch);
-void clearTables();
-void setHashSize(uint64_t MB);
-uint64_t getNodes();
-void setMultiPV(unsigned int n);
-void setNumThreads(int n);
-void initPerThreadMemory();
-void initReductionTable();
-TwoFoldStack *getTwoFoldStackPointer();
+// The result of one batch analysis search
+struct AnalysisResult {
+    Move bestMove;
+    int score;
+    int depth;
+    uint64_t nodes;
+    std::string pv;
+};
+
+// Receives the output of a search. Info lines are complete UCI info strings
+// without the trailing newline. A best move of NULL_MOVE means that the root
+// position has no legal moves. Unset callbacks print UCI output to cout.
+struct SearchCallbacks {
+    std::function<void(const std::string &)> onInfo;
+    std::function<void(Move, Move)> onBestMove;
+};
+
+struct ThreadMemory;
+struct SearchPV;
+class SearchThreadPool;
+class DeferralTable;
+class MultiPVSplit;
+
+/*
+ * Holds all state of one engine instance: the transposition table, thread
+ * memory and helper threads, time and stop control, and option values.
+ * Several contexts can exist and search at the same time in one process.
+ * Evaluation parameters and tablebases are still process wide.
+ *
+ * The UCI loop is one client of this class. A minimal embedding is:
+ *   SearchContext engine;
+ *   engine.setPosition(fenToBoard(fen), moves);
+ *   engine.search(limits, MoveList());
+ * where search() blocks and startSearch() runs on a background thread that
+ * is ended with stopSearch() or waitForSearch().
+ */
+class SearchContext {
+public:
+    SearchContext();
+    SearchContext(const SearchContext &other) = delete;
+    SearchContext& operator=(const SearchContext &other) = delete;
+    ~SearchContext();
+
+    // Sets the root position to b followed by the given game moves, which
+    // are recorded for repetition detection
+    void setPosition(const Board &b, const std::vector<Move> &moves);
+    const Board &getBoard() const { return rootBoard; }
+
+    // Searches the root position with the given limits. If searchMoves is
+    // non-empty, only those root moves are searched.
+    void search(const TimeManagement &limits, const MoveList &searchMoves);
+    void startSearch(const TimeManagement &limits, const MoveList &searchMoves);
+    void stopSearch();
+    void waitForSearch();
+    bool isSearching() const { return !isStop; }
+    void setCallbacks(const SearchCallbacks &cb) { callbacks = cb; }
+
+    // Pondering
+    void startPonder();
+    void stopPonder();
+
+    // Options
+    void clearTables();
+    void clearEvalCache();
+    void setHashSize(uint64_t MB);
+    uint64_t getHashPageSize();
+    bool saveHash(const std::string &path);
+    bool loadHash(const std::string &path);
+    void setMultiPV(unsigned int n);
+    int getNumThreads();
+    void setNumThreads(int n);
+    void setThreadAffinity(bool enabled);
+    void setABDADA(bool enabled);
+    void setParallelMultiPV(bool enabled);
+    void setUseNNUE(bool enabled);
+    bool isUsingNNUE();
+
+    // Statistics of the last search
+    uint64_t getNodes();
+    uint64_t getHashProbes();
+    uint64_t getHashHits();
+    uint64_t getTBHits();
+    TwoFoldStack *getTwoFoldStackPointer();
+    // Detailed statistics, only collected in builds with USE_SEARCH_STATS
+    std::string getSearchStatsReport();
+    void setSearchStatsInfo(bool enabled) { searchStatsInfo = enabled; }
+
+    // Batch analysis
+    void initAnalysisWorkers(int workers, uint64_t hashMB);
+    void releaseAnalysisWorkers(int prevThreads);
+    void analyzePosition(const Board &b, int depth, int worker, AnalysisResult &result);
+
+private:
+    friend class SearchThreadPool;
+
+    Hash transpositionTable;
+    std::vector<ThreadMemory *> threadMemoryArray;
+    SearchThreadPool *threadPool;
+    DeferralTable *deferralTable;
+    MultiPVSplit *multiPVSplit;
+    std::vector<Hash *> analysisTables;
 
-// Pondering
-void startPonder();
-void stopPonder();
+    Board rootBoard;
+    TimeManagement searchLimits;
+    MoveList rootMoveFilter;
+    std::thread searchThread;
+    SearchCallbacks callbacks;
+
+    // Variables for time management
+    ChessTime startTime;
+    uint64_t timeLimit;
+    uint64_t nodeLimit;
+    // The last hashfull estimate, and the search time it was made at
+    int hashfull;
+    uint64_t hashfullTime;
+    // Sleeps until the time limit and then stops the search, so that the
+    // search itself never reads the clock between iterations
+    std::thread timerThread;
+    std::mutex timerMutex;
+    std::condition_variable timerCV;
+    bool timerExit;
+
+    // Used to break out of the search thread if the stop command is given
+    std::atomic<bool> isStop;
+    // Additional stop signal to stop helper threads during SMP
+    std::atomic<bool> stopSignal;
+    std::atomic<bool> isPonderSearch;
+
+    // Values for options
+    unsigned int multiPV;
+    int numThreads;
+    bool useThreadAffinity;
+    bool useNNUE;
+    // Whether the current search uses the network, fixed at the start of a search
+    bool evalWithNNUE;
+    int probeLimit;
+    bool useABDADA;
+    // Whether moves are deferred in the current search
+    bool deferMoves;
+    bool useParallelMultiPV;
+    // Whether the current search splits the root moves between threads
+    bool splitMultiPV;
+    // Whether to print a statistics summary after each iteration
+    bool searchStatsInfo;
+
+    // Search functions
+    void getBestMoveThreader(const Board *b, TimeManagement *timeParams, MoveList *movesToSearch);
+    void getBestMove(const Board *b, TimeManagement *timeParams, MoveList legalMoves,
+        int tbScore, bool tbProbeSuccess, int threadID);
+    void getBestMoveSplit(const Board *b, TimeManagement *timeParams, MoveList legalMoves,
+        int tbScore, bool tbProbeSuccess, int threadID);
+    void searchSplitMoves(const Board *b, int threadID);
+    int searchRootMove(const Board *b, Move m, unsigned int moveNumber, int depth, int alpha, int beta,
+        int threadID, SearchPV *pvLine);
+    void getBestMoveAtDepth(const Board *b, const MoveList *legalMoves, int depth, int alpha, int beta,
+        int *bestMoveIndex, int *bestScore, unsigned int startMove, int threadID, SearchPV *pvLine);
+    template <bool isPVNode>
+    int PVS(Board &b, int depth, int alpha, int beta, int threadID, bool isCutNode, SearchStackInfo *ssi, SearchPV *pvLine);
+    int quiescence(Board &b, int plies, int alpha, int beta, int threadID);
+    int checkQuiescence(Board &b, int plies, int alpha, int beta, int threadID);
+
+    // Search helpers
+    inline bool makeSearchMove(Board &b, Move m, int color, UndoInfo &undo, int threadID);
+    inline void makeLegalSearchMove(Board &b, Move m, int color, UndoInfo &undo, int threadID);
+    inline void unmakeSearchMove(Board &b, Move m, int color, const UndoInfo &undo, int threadID);
+    inline int staticEvaluation(Board &b, int color, int threadID);
+    inline int lazyEvaluation(Board &b, int color, int alpha, int beta, bool &isExact, int threadID);
+    int getSelectiveDepth();
+    int getHashfull();
+    void startTimer();
+    void stopTimer();
+    void timerLoop(std::chrono::steady_clock::time_point deadline);
+    std::string getSearchStatsSummary();
+    void emitInfo(const std::string &info);
+    void emitBestMove(Move bestMove, Move ponder);
+};
+
+void initReductionTable();
+// Formats the UCI bestmove line
+std::string bestMoveToString(Move bestMove, Move ponder);
 
 // Time constants
 constexpr uint64_t ONE_SECOND = 1000;
@@ -19,55 +19,42 @@
 #ifndef __SEARCHPARAMS_H__
 #define __SEARCHPARAMS_H__
 
+#include <cstring>
 #include "common.h"
 
+// Continuation history for one previous move, indexed by [piece][to square].
+// The history update rule keeps values within +/-448, so 16 bits suffice.
+typedef int16_t PieceToHistory[6][64];
+
 struct SearchParameters {
     int ply;
     int selectiveDepth;
     Move killers[MAX_DEPTH+1][2];
     int historyTable[2][6][64];
     int captureHistory[2][6][6][64];
-    int **counterMoveHistory[6][64];
-    int **followupMoveHistory[6][64];
+    // The last quiet move to cause a cutoff in reply to a move, and two plies
+    // after one of our own moves, indexed by [color][piece][to square] of
+    // that move
+    Move counterMoves[2][6][64];
+    Move followupMoves[2][6][64];
+    // Both continuation histories live in one cache-aligned block, indexed by
+    // the [piece][to square] of the previous move
+    PieceToHistory (*counterMoveHistory)[64];
+    PieceToHistory (*followupMoveHistory)[64];
 
     SearchParameters() {
-        for (int i = 0; i < 6; i++) {
-            for (int j = 0; j < 64; j++) {
-                counterMoveHistory[i][j] = new int *[6];
-                for (int k = 0; k < 6; k++) {
-                    counterMoveHistory[i][j][k] = new int[64];
-                }
-            }
-        }
-        for (int i = 0; i < 6; i++) {
-            for (int j = 0; j < 64; j++) {
-                followupMoveHistory[i][j] = new int *[6];
-                for (int k = 0; k < 6; k++) {
-                    followupMoveHistory[i][j][k] = new int[64];
-                }
-            }
-        }
+        counterMoveHistory = (PieceToHistory (*)[64])
+            alignedMalloc(64, 2 * 6 * 64 * sizeof(PieceToHistory));
+        followupMoveHistory = counterMoveHistory + 6;
         reset();
         resetHistoryTable();
     }
 
+    SearchParameters(const SearchParameters &other) = delete;
+    SearchParameters& operator=(const SearchParameters &other) = delete;
+
     ~SearchParameters() {
-        for (int i = 0; i < 6; i++) {
-            for (int j = 0; j < 64; j++) {
-                for (int k = 0; k < 6; k++) {
-                    delete[] counterMoveHistory[i][j][k];
-                }
-                delete[] counterMoveHistory[i][j];
-            }
-        }
-        for (int i = 0; i < 6; i++) {
-            for (int j = 0; j < 64; j++) {
-                for (int k = 0; k < 6; k++) {
-                    delete[] followupMoveHistory[i][j][k];
-                }
-                delete[] followupMoveHistory[i][j];
-            }
-        }
+        alignedFree(counterMoveHistory);
     }
 
     void reset() {
@@ -79,40 +66,12 @@ struct SearchParameters {
     }
 
     void resetHistoryTable() {
-        for (int i = 0; i < 2; i++) {
-            for (int j = 0; j < 6; j++) {
-                for (int k = 0; k < 64; k++)
-                    historyTable[i][j][k] = 0;
-            }
-        }
-
-        for (int i = 0; i < 2; i++) {
-            for (int j = 0; j < 6; j++) {
-                for (int k = 0; k < 6; k++) {
-                    for (int l = 0; l < 64; l++)
-                        captureHistory[i][j][k][l] = 0;
-                }
-            }
-        }
-
-        for (int i = 0; i < 6; i++) {
-            for (int j = 0; j < 64; j++) {
-                for (int k = 0; k < 6; k++) {
-                    for (int l = 0; l < 64; l++)
-                        counterMoveHistory[i][j][k][l] = 0;
-                }
-            }
-        }
-
-        for (int i = 0; i < 6; i++) {
-            for (int j = 0; j < 64; j++) {
-                for (int k = 0; k < 6; k++) {
-                    for (int l = 0; l < 64; l++)
-                        followupMoveHistory[i][j][k][l] = 0;
-                }
-            }
-        }
+        std::memset(historyTable, 0, sizeof(historyTable));
+        std::memset(captureHistory, 0, sizeof(captureHistory));
+        std::memset(counterMoves, 0, sizeof(counterMoves));
+        std::memset(followupMoves, 0, sizeof(followupMoves));
+        std::memset(counterMoveHistory, 0, 2 * 6 * 64 * sizeof(PieceToHistory));
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -53,6 +53,10 @@
 static LOCK_T TB_mutex;
 
 static int initialized = 0;
+// Map and page in every WDL table when the path is set instead of on the
+// first probe, so that searching threads never wait on TB_mutex or disk
+static int preload_tables = 0;
+static int num_preloaded = 0;
 static int num_paths = 0;
 static char *path_string = NULL;
 static char **paths = NULL;
@@ -112,12 +116,19 @@ static char *map_file(const char *name, const char *suffix, uint64 *mapping)
   struct stat statbuf;
   fstat(fd, &statbuf);
   *mapping = statbuf.st_size;
+  int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  if (preload_tables)
+    flags |= MAP_POPULATE;
+#endif
   char *data = (char *)mmap(NULL, statbuf.st_size, PROT_READ,
-			      MAP_SHARED, fd, 0);
+			      flags, fd, 0);
   if (data == (char *)(-1)) {
     printf("Could not mmap() %s.\n", name);
     exit(1);
   }
+  if (preload_tables)
+    madvise(data, statbuf.st_size, MADV_WILLNEED);
 #else
   DWORD size_low, size_high;
   size_low = GetFileSize(fd, &size_high);
@@ -172,6 +183,8 @@ static void add_to_hash(struct TBEntry *ptr, uint64 key)
 
 static char pchr[] = {'K', 'Q', 'R', 'B', 'N', 'P'};
 
+static int init_table_wdl(struct TBEntry *entry, char *str);
+
 static void init_tb(char *str)
 {
   FD fd;
@@ -255,9 +268,15 @@ static void init_tb(char *str)
   }
   add_to_hash(entry, key);
   if (key2 != key) add_to_hash(entry, key2);
+
+  // TB_mutex is not needed since no search is running while tables are added
+  if (preload_tables && init_table_wdl(entry, str)) {
+    STORE_READY(entry->ready);
+    num_preloaded++;
+  }
 }
 
-void init_tablebases(char *path)
+void init_tablebases(char *path, int preload)
 {
   char str[16];
   int i, j, k, l;
@@ -313,6 +332,8 @@ void init_tablebases(char *path)
 
   TBnum_piece = TBnum_pawn = 0;
   TBlargest = 0;
+  preload_tables = preload;
+  num_preloaded = 0;
 
   for (i = 0; i < (1 << TBHASHBITS); i++)
     for (j = 0; j < HSHMAX; j++) {
@@ -379,6 +400,8 @@ void init_tablebases(char *path)
 	}
 
   printf("Found %d tablebases.\n", TBnum_piece + TBnum_pawn);
+  if (preload_tables)
+    printf("Preloaded %d tablebases.\n", num_preloaded);
 }
 
 static const signed char offdiag[] = {
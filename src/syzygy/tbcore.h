@@ -46,6 +46,11 @@
 #define UNLOCK(x) ReleaseMutex(x)
 #endif
 
+// The ready flag of a table is read without holding TB_mutex, so it is
+// published with release/acquire ordering after the table is set up.
+#define LOAD_READY(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE_READY(x) __atomic_store_n(&(x), 1, __ATOMIC_RELEASE)
+
 #define WDLSUFFIX ".rtbw"
 #define DTZSUFFIX ".rtbz"
 #define WDLDIR "RTBWDIR"
@@ -121,7 +121,7 @@ static int probe_wdl_table(const Board &b, int *success) {
     }
 
     ptr = ptr2[i].ptr;
-    if (!ptr->ready) {
+    if (!LOAD_READY(ptr->ready)) {
         LOCK(TB_mutex);
         if (!ptr->ready) {
             char str[16];
@@ -132,9 +132,8 @@ static int probe_wdl_table(const Board &b, int *success) {
                 UNLOCK(TB_mutex);
                 return 0;
             }
-            // Memory barrier to ensure ptr->ready = 1 is not reordered.
-            __asm__ __volatile__ ("" ::: "memory");
-            ptr->ready = 1;
+            // The table must be fully set up before other threads see it as ready
+            STORE_READY(ptr->ready);
         }
         UNLOCK(TB_mutex);
     }
@@ -570,8 +569,7 @@ int probe_dtz(const Board &b, int *success) {
 
 // Check whether there has been at least one repetition of positions
 // since the last capture or pawn move.
-static int has_repeated() {
-    TwoFoldStack *tfp = getTwoFoldStackPointer();
+static int has_repeated(const TwoFoldStack *tfp) {
     if (tfp->length < 3)
         return false;
 
@@ -597,7 +595,7 @@ static int wdl_to_value[5] = {
 //
 // A return value of 0 indicates that not all probes were successful and that
 // no moves were filtered out.
-int root_probe(const Board *b, MoveList &rootMoves, ScoreList &scores, int &TBScore) {
+int root_probe(const Board *b, const TwoFoldStack *history, MoveList &rootMoves, ScoreList &scores, int &TBScore) {
     int success;
 
     int dtz = probe_dtz(*b, &success);
@@ -663,7 +661,7 @@ int root_probe(const Board *b, MoveList &rootMoves, ScoreList &scores, int &TBSc
         int max = best;
         // If the current phase has not seen repetitions, then try all moves
         // that stay safely within the 50-move budget, if there are any.
-        if (!has_repeated() && best + cnt50 <= 99)
+        if (!has_repeated(history) && best + cnt50 <= 99)
             max = 99 - cnt50;
         for (unsigned int i = 0; i < rootMoves.size(); i++) {
             int v = scores.get(i);
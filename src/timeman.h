@@ -19,10 +19,13 @@
 #ifndef __TIME_H__
 #define __TIME_H__
 
+#include <algorithm>
+#include <cstdint>
+
 // Search modes
 constexpr int TIME = 1;
 constexpr int DEPTH = 2;
-// constexpr int NODES = 3;
+constexpr int NODES = 3;
 constexpr int MOVETIME = 4;
 
 // Time management constants
@@ -34,11 +37,36 @@ constexpr double MAX_TIME_FACTOR = 5.0; // do not spend more than this multiple
 constexpr double ALLOTMENT_FACTORS[10] = {1.0, 0.99, 0.38, 0.28, 0.23, 0.20, 0.18, 0.16, 0.14, 0.12};
 constexpr double MAX_USAGE_FACTORS[10] = {1.0, 0.99, 0.74, 0.66, 0.62, 0.59, 0.56, 0.54, 0.52, 0.51};
 
+// Node effort time management, used from this depth on
+constexpr int EFFORT_MIN_DEPTH = 8;
+// The search stops early once the best move has taken at least this fraction
+// of the root nodes, has been best for this many iterations, and this fraction
+// of the soft time limit is used
+constexpr double EFFORT_STOP_FRACTION = 0.90;
+constexpr int EFFORT_STOP_STREAK = 6;
+constexpr double EFFORT_STOP_TIME = 0.4;
+
+// Returns a factor on the soft time limit from the fraction of root nodes spent
+// on the best move. Agreement with the hash move of the previous search and
+// the score change since the last iteration are optional inputs.
+inline double effortTimeFactor(double bestMoveEffort, bool hashMoveAgrees = false, int scoreTrend = 0) {
+    double factor = std::min(1.6, std::max(0.6, 2.0 * (1.0 - bestMoveEffort) + 0.5));
+    // A falling score needs more time to find a way out
+    if (scoreTrend < 0)
+        factor *= 1.0 + std::min(-scoreTrend, 100) / 400.0;
+    // The previous search already settled on this move
+    if (hashMoveAgrees)
+        factor *= 0.9;
+    return factor;
+}
+
 struct TimeManagement {
     int searchMode;
     int allotment;
     // Hard limit on time usage for this move, only for time-based searches
     int maxAllotment;
+    // Number of nodes to search, only for node-limited searches
+    uint64_t nodeLimit;
 };
 
 #endif
\ No newline at end of file
@@ -20,7 +20,10 @@
 #include <atomic>
 #include <cmath>
 #include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <vector>
 #include <thread>
@@ -30,6 +33,9 @@
 #include "bbinit.h"
 #include "board.h"
 #include "eval.h"
+#include "nnue.h"
+#include "output.h"
+#include "perft.h"
 #include "search.h"
 #include "timeman.h"
 #include "uci.h"
@@ -42,68 +48,104 @@ using std::string;
 
 constexpr char STARTPOS[] = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
-void setPosition(string &input, std::vector<string> &inputVector, Board &board);
+void setPosition(SearchContext &engine, string &input, std::vector<string> &inputVector, Board &board);
 std::vector<string> split(const string &s, char d);
 Move stringToMove(const string &moveStr, Board &b, bool &reversible);
 string boardToString(Board &board);
 bool equalsIgnoreCase(const std::string &s1, const std::string &s2);
 void stringToLowerCase(std::string &s);
-void clearAll(Board &board);
+void clearAll(SearchContext &engine, Board &board);
+void loadTablebases(const string &path, bool preload);
 uint64_t perft(Board &b, int color, int depth, uint64_t &captures);
-void runBenchmark(Board &b, int depth);
+void runPerft(SearchContext &engine, Board &b, const std::vector<string> &args, bool divide);
+void runAnalysis(SearchContext &engine, const std::vector<string> &args);
+void runBenchmark(SearchContext &engine, Board &b, const std::vector<string> &args);
 
 
 static int BUFFER_TIME = DEFAULT_BUFFER_TIME;
+static string syzygyPath;
+static bool syzygyPreload = false;
 MoveList movesToSearch;
 TimeManagement timeParams;
-// Declared in search.cpp
-extern std::atomic<bool> isStop;
-extern std::atomic<bool> stopSignal;
+// All search output and the replies that follow it go through this writer
+static OutputWriter uciOutput;
+// Time from entering main to being ready for input, in microseconds
+static uint64_t startupTime = 0;
 
 
 int main(int argc, char **argv) {
-    initMagicTables(2563762638929852183ULL);
+    auto startupStart = ChessClock::now();
+    initMagicTables();
     initEvalTables();
     initDistances();
     initZobristTable();
     initInBetweenTable();
-    initPerThreadMemory();
+    initCuckooTables();
     initReductionTable();
 
-    setMultiPV(DEFAULT_MULTI_PV);
-    setNumThreads(DEFAULT_THREADS);
+    SearchContext engine;
+    engine.setMultiPV(DEFAULT_MULTI_PV);
+    engine.setNumThreads(DEFAULT_THREADS);
+    SearchCallbacks callbacks;
+    callbacks.onInfo = [](const string &info) { uciOutput.writeInfo(info); };
+    callbacks.onBestMove = [](Move bestMove, Move ponder) {
+        uciOutput.write(bestMoveToString(bestMove, ponder));
+    };
+    engine.setCallbacks(callbacks);
+    startupTime = std::chrono::duration_cast<std::chrono::microseconds>(
+        ChessClock::now() - startupStart).count();
 
     string input;
+    // File paths in options are case sensitive
+    string originalInput;
     std::vector<string> inputVector;
     string name = "Laser";
     string version = "1.8 beta";
     string author = "Jeffrey An and Michael An";
-    std::thread searchThread;
 
     Board board = fenToBoard(STARTPOS);
 
     cout << name << " " << version << " by " << author << endl;
 
-    // Run benchmark from command line with given depth
+    // Run benchmark from command line with the given arguments
     if (argc > 1 && strcmp(argv[1], "bench") == 0) {
-        runBenchmark(board, argc > 2 ? atoi(argv[2]) : 0);
+        runBenchmark(engine, board, std::vector<string>(argv + 2, argv + argc));
+        return 0;
+    }
+    // Batch analysis of an EPD file, parallelized across positions
+    if (argc > 1 && strcmp(argv[1], "analyze") == 0) {
+        runAnalysis(engine, std::vector<string>(argv + 2, argv + argc));
+        return 0;
+    }
+    // Also allow perft runs for movegen regression tests
+    if (argc > 2 && (strcmp(argv[1], "perft") == 0 || strcmp(argv[1], "divide") == 0)) {
+        runPerft(engine, board, std::vector<string>(argv + 2, argv + argc), strcmp(argv[1], "divide") == 0);
         return 0;
     }
 
     while (getline(std::cin, input)) {
+        originalInput = input;
         stringToLowerCase(input);
         inputVector = split(input, ' ');
         std::cin.clear();
 
         // Ignore all input other than "stop", "quit", and "ponderhit" while running a search.
-        if (!isStop && input != "stop" && input != "quit" && input != "ponderhit")
+        if (engine.isSearching() && input != "stop" && input != "quit" && input != "ponderhit")
             continue;
+        // Replies must come after the output of the last search
+        if (!engine.isSearching())
+            uciOutput.flush();
 
         if (input == "uci") {
             cout << "id name " << name << " " << version << endl;
             cout << "id author " << author << endl;
             cout << "option name Threads type spin default " << DEFAULT_THREADS
                  << " min " << MIN_THREADS << " max " << MAX_THREADS << endl;
+            cout << "option name ThreadAffinity type check default false" << endl;
+            cout << "option name ABDADA type check default false" << endl;
+            cout << "option name ParallelMultiPV type check default false" << endl;
+            cout << "option name InfoRate type spin default " << DEFAULT_INFO_RATE
+                 << " min " << MIN_INFO_RATE << " max " << MAX_INFO_RATE << endl;
             cout << "option name Hash type spin default " << DEFAULT_HASH_SIZE
                  << " min " << MIN_HASH_SIZE << " max " << MAX_HASH_SIZE << endl;
             cout << "option name Ponder type check default false" << endl;
@@ -112,20 +154,26 @@ int main(int argc, char **argv) {
             cout << "option name BufferTime type spin default " << DEFAULT_BUFFER_TIME
                  << " min " << MIN_BUFFER_TIME << " max " << MAX_BUFFER_TIME << endl;
             cout << "option name SyzygyPath type string default <empty>" << endl;
+            cout << "option name SyzygyPreload type check default false" << endl;
+            cout << "option name UseNNUE type check default false" << endl;
+            cout << "option name EvalFile type string default <empty>" << endl;
             cout << "option name ScaleMaterial type spin default " << DEFAULT_EVAL_SCALE
                  << " min " << MIN_EVAL_SCALE << " max " << MAX_EVAL_SCALE << endl;
             cout << "option name ScaleKingSafety type spin default " << DEFAULT_EVAL_SCALE
                  << " min " << MIN_EVAL_SCALE << " max " << MAX_EVAL_SCALE << endl;
+#ifdef USE_SEARCH_STATS
+            cout << "option name SearchStats type check default false" << endl;
+#endif
             cout << "uciok" << endl;
         }
         else if (input == "isready") cout << "readyok" << endl;
-        else if (input == "ucinewgame") clearAll(board);
-        else if (input.substr(0, 8) == "position") setPosition(input, inputVector, board);
-        else if (input.substr(0, 2) == "go" && isStop) {
+        else if (input == "ucinewgame") clearAll(engine, board);
+        else if (input.substr(0, 8) == "position") setPosition(engine, input, inputVector, board);
+        else if (input.substr(0, 2) == "go" && !engine.isSearching()) {
             std::vector<string>::iterator it;
 
             if (input.find("ponder") != string::npos)
-                startPonder();
+                engine.startPonder();
 
             if (input.find("searchmoves") != string::npos) {
                 movesToSearch.clear();
@@ -152,6 +200,12 @@ int main(int argc, char **argv) {
                 it++;
                 timeParams.allotment = std::min(MAX_DEPTH, std::stoi(*it));
             }
+            else if (input.find("nodes") != string::npos && inputVector.size() > 2) {
+                timeParams.searchMode = NODES;
+                it = find(inputVector.begin(), inputVector.end(), "nodes");
+                it++;
+                timeParams.nodeLimit = std::stoull(*it);
+            }
             else if (input.find("infinite") != string::npos) {
                 timeParams.searchMode = DEPTH;
                 timeParams.allotment = MAX_DEPTH;
@@ -204,26 +258,17 @@ int main(int argc, char **argv) {
                 }
             }
 
-            isStop = false;
-            stopSignal = false;
-            if (searchThread.joinable()) searchThread.join();
-            searchThread = std::thread(getBestMoveThreader, &board, &timeParams, &movesToSearch);
+            engine.startSearch(timeParams, movesToSearch);
         }
         else if (input == "ponderhit") {
-            stopPonder();
+            engine.stopPonder();
         }
 
         else if (input == "stop") {
-            stopPonder();
-            isStop = true;
-            stopSignal = true;
-            if (searchThread.joinable()) searchThread.join();
+            engine.stopSearch();
         }
         else if (input == "quit") {
-            stopPonder();
-            isStop = true;
-            stopSignal = true;
-            if (searchThread.joinable()) searchThread.join();
+            engine.stopSearch();
             break;
         }
         else if (input.substr(0, 9) == "setoption" && inputVector.size() >= 5) {
@@ -237,7 +282,24 @@ int main(int argc, char **argv) {
                         threads = MIN_THREADS;
                     if (threads > MAX_THREADS)
                         threads = MAX_THREADS;
-                    setNumThreads(threads);
+                    engine.setNumThreads(threads);
+                }
+                else if (inputVector.at(2) == "threadaffinity") {
+                    engine.setThreadAffinity(inputVector.at(4) == "true");
+                }
+                else if (inputVector.at(2) == "abdada") {
+                    engine.setABDADA(inputVector.at(4) == "true");
+                }
+                else if (inputVector.at(2) == "parallelmultipv") {
+                    engine.setParallelMultiPV(inputVector.at(4) == "true");
+                }
+                else if (inputVector.at(2) == "inforate") {
+                    int rate = std::stoi(inputVector.at(4));
+                    if (rate < MIN_INFO_RATE)
+                        rate = MIN_INFO_RATE;
+                    if (rate > MAX_INFO_RATE)
+                        rate = MAX_INFO_RATE;
+                    uciOutput.setInfoRate(rate);
                 }
                 else if (inputVector.at(2) == "hash") {
                     uint64_t MB = std::stoull(inputVector.at(4));
@@ -245,7 +307,14 @@ int main(int argc, char **argv) {
                         MB = MIN_HASH_SIZE;
                     if (MB > MAX_HASH_SIZE)
                         MB = MAX_HASH_SIZE;
-                    setHashSize(MB);
+                    engine.setHashSize(MB);
+                    uint64_t pageSize = engine.getHashPageSize();
+                    cout << "info string Hash table uses ";
+                    if (pageSize >= (1ULL << 20))
+                        cout << (pageSize >> 20) << " MB";
+                    else
+                        cout << (pageSize >> 10) << " KB";
+                    cout << " pages" << endl;
                 }
                 else if (inputVector.at(2) == "ponder") {
                     // do nothing
@@ -256,7 +325,7 @@ int main(int argc, char **argv) {
                         multiPV = MIN_MULTI_PV;
                     if (multiPV > MAX_MULTI_PV)
                         multiPV = MAX_MULTI_PV;
-                    setMultiPV((unsigned int) multiPV);
+                    engine.setMultiPV((unsigned int) multiPV);
                 }
                 else if (inputVector.at(2) == "buffertime") {
                     BUFFER_TIME = std::stoi(inputVector.at(4));
@@ -270,10 +339,36 @@ int main(int argc, char **argv) {
                     for (unsigned int i = 5; i < inputVector.size(); i++) {
                         path += string(" ") + inputVector.at(i);
                     }
-                    char *c_path = (char *) malloc(path.length() + 1);
-                    std::strcpy(c_path, path.c_str());
-                    init_tablebases(c_path);
-                    free(c_path);
+                    syzygyPath = path;
+                    loadTablebases(syzygyPath, syzygyPreload);
+                }
+                else if (inputVector.at(2) == "syzygypreload") {
+                    syzygyPreload = (inputVector.at(4) == "true");
+                    // Reload so that the tables are mapped with the new setting
+                    if (!syzygyPath.empty())
+                        loadTablebases(syzygyPath, syzygyPreload);
+                }
+                else if (inputVector.at(2) == "usennue") {
+                    engine.setUseNNUE(inputVector.at(4) == "true");
+                    if (inputVector.at(4) == "true" && !isNNUELoaded())
+                        cout << "info string No network loaded, using the handcrafted evaluation" << endl;
+                }
+                else if (inputVector.at(2) == "evalfile") {
+                    std::vector<string> originalVector = split(originalInput, ' ');
+                    string path = originalVector.at(4);
+                    for (unsigned int i = 5; i < originalVector.size(); i++) {
+                        path += string(" ") + originalVector.at(i);
+                    }
+                    bool loaded = loadNNUE(path);
+                    // Even a failed load changes which evaluator is in use
+                    engine.clearEvalCache();
+                    if (loaded)
+                        cout << "info string Loaded network " << path << endl;
+                    else
+                        cout << "info string Failed to load network " << path << endl;
+                }
+                else if (inputVector.at(2) == "searchstats") {
+                    engine.setSearchStatsInfo(inputVector.at(4) == "true");
                 }
                 else if (inputVector.at(2) == "scalematerial") {
                     int scale = std::stoi(inputVector.at(4));
@@ -282,6 +377,7 @@ int main(int argc, char **argv) {
                     if (scale > MAX_EVAL_SCALE)
                         scale = MAX_EVAL_SCALE;
                     setMaterialScale(scale);
+                    engine.clearEvalCache();
                 }
                 else if (inputVector.at(2) == "scalekingsafety") {
                     int scale = std::stoi(inputVector.at(4));
@@ -290,6 +386,7 @@ int main(int argc, char **argv) {
                     if (scale > MAX_EVAL_SCALE)
                         scale = MAX_EVAL_SCALE;
                     setKingSafetyScale(scale);
+                    engine.clearEvalCache();
                 }
                 else
                     cout << "info string Invalid option." << endl;
@@ -298,6 +395,11 @@ int main(int argc, char **argv) {
 
         //----------------------------Non-UCI Commands--------------------------
         else if (input == "board") cerr << boardToString(board);
+        else if ((input.substr(0, 5) == "perft" && inputVector.size() > 2)
+              || (input.substr(0, 6) == "divide" && inputVector.size() >= 2)) {
+            runPerft(engine, board, std::vector<string>(inputVector.begin() + 1, inputVector.end()),
+                input.substr(0, 6) == "divide");
+        }
         else if (input.substr(0, 5) == "perft" && inputVector.size() == 2) {
             int depth = std::stoi(inputVector.at(1));
 
@@ -313,16 +415,38 @@ int main(int argc, char **argv) {
             cerr << "Time: " << time << endl;
             cerr << "Nodes/second: " << 1000 * nodes / time << endl;
         }
+        else if ((input.substr(0, 8) == "savehash" || input.substr(0, 8) == "loadhash")
+              && inputVector.size() >= 2) {
+            // Keep the case of the file path
+            string path = originalInput.substr(originalInput.find(' ') + 1);
+            if (input.substr(0, 8) == "savehash") {
+                if (engine.saveHash(path))
+                    cout << "info string Saved hash table to " << path << endl;
+                else
+                    cout << "info string Failed to save hash table to " << path << endl;
+            }
+            else {
+                if (engine.loadHash(path))
+                    cout << "info string Loaded hash table from " << path << endl;
+                else
+                    cout << "info string Failed to load hash table from " << path << endl;
+            }
+        }
         else if (input.substr(0, 5) == "bench") {
-            int depth = 0;
-            if (inputVector.size() == 2)
-                depth = std::stoi(inputVector.at(1));
-            runBenchmark(board, depth);
+            // Keep the case of the EPD file path
+            std::vector<string> originalVector = split(originalInput, ' ');
+            runBenchmark(engine, board, std::vector<string>(originalVector.begin() + 1, originalVector.end()));
         }
 
+        else if (input == "stats") cout << engine.getSearchStatsReport();
         else if (input == "eval") {
             Eval e;
             e.evaluate<true>(board);
+            if (isNNUELoaded()) {
+                NNUEAccumulatorStack accumulators;
+                cout << "NNUE evaluation: " << accumulators.evaluate(board)
+                     << " (side to move)" << endl;
+            }
         }
 
         // According to UCI protocol, inputs that do not make sense are ignored
@@ -331,7 +455,7 @@ int main(int argc, char **argv) {
     return 0;
 }
 
-void setPosition(string &input, std::vector<string> &inputVector, Board &board) {
+void setPosition(SearchContext &engine, string &input, std::vector<string> &inputVector, Board &board) {
     string pos;
 
     if (input.find("startpos") != string::npos)
@@ -351,9 +475,9 @@ void setPosition(string &input, std::vector<string> &inputVector, Board &board)
         }
     }
 
-    board = fenToBoard(pos);
-    TwoFoldStack *twoFoldPositions = getTwoFoldStackPointer();
-    twoFoldPositions->clear();
+    Board startBoard = fenToBoard(pos);
+    board = startBoard.staticCopy();
+    std::vector<Move> moves;
 
     size_t moveListStart = input.find("moves");
     if (moveListStart != string::npos) {
@@ -367,20 +491,13 @@ void setPosition(string &input, std::vector<string> &inputVector, Board &board)
             while (is >> moveStr) {
                 bool reversible;
                 Move m = stringToMove(moveStr, board, reversible);
-
-                // Record positions on two fold stack.
-                twoFoldPositions->push(board.getZobristKey());
-                // The stack is cleared for captures, pawn moves, and castles, which are all
-                // irreversible
-                if (!reversible)
-                    twoFoldPositions->clear();
-
+                moves.push_back(m);
                 board.doMove(m, board.getPlayerToMove());
             }
         }
     }
 
-    twoFoldPositions->setRootEnd();
+    engine.setPosition(startBoard, moves);
 }
 
 // Splits a string s with delimiter d.
@@ -561,9 +678,18 @@ void stringToLowerCase(std::string &s) {
     }
 }
 
-void clearAll(Board &board) {
-    clearTables();
+// Sets up the Syzygy tables found in path, optionally mapping them right away
+void loadTablebases(const string &path, bool preload) {
+    char *c_path = (char *) malloc(path.length() + 1);
+    std::strcpy(c_path, path.c_str());
+    init_tablebases(c_path, preload);
+    free(c_path);
+}
+
+void clearAll(SearchContext &engine, Board &board) {
+    engine.clearTables();
     board = fenToBoard(STARTPOS);
+    engine.setPosition(board, std::vector<Move>());
 }
 
 /*
@@ -589,21 +715,154 @@ uint64_t perft(Board &b, int color, int depth, uint64_t &captures) {
     MoveList pl;
     b.getAllPseudoLegalMoves(pl, color);
     for (unsigned int i = 0; i < pl.size(); i++) {
-        Board copy = b.staticCopy();
-        if (!copy.doPseudoLegalMove(pl.get(i), color))
+        UndoInfo undo;
+        if (!b.makePseudoLegalMove(pl.get(i), color, undo))
             continue;
 
         if (isCapture(pl.get(i)))
             captures++;
 
-        nodes += perft(copy, color^1, depth-1, captures);
+        nodes += perft(b, color^1, depth-1, captures);
+        b.unmakeMove(pl.get(i), color, undo);
     }
 
     return nodes;
 }
 
-void runBenchmark(Board &b, int depth) {
-    const std::vector<string> benchPositions = {
+/*
+ * Runs the parallel hashed perft. Arguments are the depth followed by any of
+ * the key/value pairs threads <t>, hash <MB>.
+ */
+void runPerft(SearchContext &engine, Board &b, const std::vector<string> &args, bool divide) {
+    int depth = std::stoi(args.at(0));
+    int threads = engine.getNumThreads();
+    uint64_t hashMB = DEFAULT_PERFT_HASH_SIZE;
+    for (unsigned int i = 1; i + 1 < args.size(); i += 2) {
+        if (args.at(i) == "threads")
+            threads = std::max(MIN_THREADS, std::min(MAX_THREADS, std::stoi(args.at(i+1))));
+        else if (args.at(i) == "hash")
+            hashMB = std::min(MAX_HASH_SIZE, (uint64_t) std::stoull(args.at(i+1)));
+    }
+
+    auto startTime = ChessClock::now();
+    uint64_t nodes = parallelPerft(b, depth, threads, hashMB, divide);
+    uint64_t time = getTimeElapsed(startTime);
+
+    cerr << "Nodes: " << nodes << endl;
+    cerr << "Time: " << time << endl;
+    cerr << "Nodes/second: " << 1000 * nodes / time << endl;
+}
+
+/*
+ * Analyzes every position of an EPD file (or stdin for "-") with independent
+ * single threaded searches:
+ *   laser analyze <file> [--depth <d>] [--workers <n>] [--hash <MB per worker>]
+ * Results are written as EPD lines in the order the searches finish, with the
+ * input line number in c0. A hash size of 0 shares the main table.
+ */
+void runAnalysis(SearchContext &engine, const std::vector<string> &args) {
+    string epdFile;
+    int depth = 12;
+    int workers = std::max(1, (int) std::thread::hardware_concurrency());
+    uint64_t hashMB = DEFAULT_HASH_SIZE;
+    for (unsigned int i = 0; i < args.size(); i++) {
+        if (args.at(i) == "--depth" && i + 1 < args.size())
+            depth = std::stoi(args.at(++i));
+        else if (args.at(i) == "--workers" && i + 1 < args.size())
+            workers = std::stoi(args.at(++i));
+        else if (args.at(i) == "--hash" && i + 1 < args.size())
+            hashMB = std::stoull(args.at(++i));
+        else
+            epdFile = args.at(i);
+    }
+    depth = std::max(1, std::min(MAX_DEPTH, depth));
+    // One thread memory is kept for the UCI main thread
+    workers = std::max(MIN_THREADS, std::min(MAX_THREADS - 1, workers));
+    hashMB = std::min(MAX_HASH_SIZE, hashMB);
+
+    std::ifstream file;
+    if (epdFile != "-") {
+        file.open(epdFile);
+        if (!file) {
+            cerr << "Could not open " << epdFile << endl;
+            return;
+        }
+    }
+    std::istream &in = (epdFile == "-") ? std::cin : file;
+
+    int prevThreads = engine.getNumThreads();
+    engine.initAnalysisWorkers(workers, hashMB);
+
+    std::mutex inputMutex, outputMutex;
+    uint64_t linesRead = 0, positions = 0, totalNodes = 0;
+    auto startTime = ChessClock::now();
+
+    // Each worker takes the next line of input when it finishes a search
+    auto worker = [&](int workerID) {
+        string line;
+        while (true) {
+            uint64_t lineNumber;
+            {
+                std::lock_guard<std::mutex> lock(inputMutex);
+                if (!getline(in, line))
+                    return;
+                lineNumber = ++linesRead;
+            }
+
+            std::vector<string> fields = split(line, ' ');
+            if (fields.size() < 4 || fields.at(0)[0] == '#')
+                continue;
+            string fen = fields.at(0) + " " + fields.at(1) + " " + fields.at(2) + " " + fields.at(3);
+            Board b = fenToBoard(fen);
+            AnalysisResult result;
+            engine.analyzePosition(b, depth, workerID, result);
+
+            std::stringstream out;
+            out << fen << " bm " << (result.bestMove == NULL_MOVE ? "none" : moveToString(result.bestMove));
+            if (result.score >= MAX_PLY_MATE_SCORE)
+                out << "; dm " << (MATE_SCORE - result.score) / 2 + 1;
+            else if (result.score <= -MAX_PLY_MATE_SCORE)
+                out << "; dm " << (-MATE_SCORE - result.score) / 2;
+            else
+                out << "; ce " << result.score * 100 / PIECE_VALUES[EG][PAWNS];
+            out << "; acd " << result.depth << "; acn " << result.nodes;
+            if (!result.pv.empty())
+                out << "; pv " << result.pv;
+            out << "; c0 \"" << lineNumber << "\";";
+
+            std::lock_guard<std::mutex> lock(outputMutex);
+            cout << out.str() << endl;
+            positions++;
+            totalNodes += result.nodes;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < workers; i++)
+        threads.push_back(std::thread(worker, i));
+    worker(0);
+    for (unsigned int i = 0; i < threads.size(); i++)
+        threads[i].join();
+
+    uint64_t time = getTimeElapsed(startTime);
+    engine.releaseAnalysisWorkers(prevThreads);
+
+    cerr << "Positions: " << positions << endl;
+    cerr << "Time: " << time << " ms" << endl;
+    cerr << "Nodes: " << totalNodes << endl;
+    cerr << "Nodes/second: " << 1000 * totalNodes / time << endl;
+    cerr << "Positions/second: " << 1000.0 * positions / time << endl;
+}
+
+/*
+ * Runs a fixed set of searches to measure speed and scaling. Arguments are
+ * an optional leading depth followed by any of the key/value pairs
+ *   depth <d>, nodes <n>, threads <t>, runs <r>, file <epd>
+ * With a thread count t, every power of two below t and t itself are
+ * benchmarked so that the SMP speedup can be computed from the 1 thread run.
+ */
+void runBenchmark(SearchContext &engine, Board &b, const std::vector<string> &args) {
+    std::vector<string> benchPositions = {
         "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -",
         "r2q4/pp1k1pp1/2p1r1np/5p2/2N5/1P5Q/5PPP/3RR1K1 b - -",
         "5k2/1qr2pp1/2Np1n1r/QB2p3/2R4p/3PPRPb/PP2P2P/6K1 w - -",
@@ -621,31 +880,149 @@ void runBenchmark(Board &b, int depth) {
         "8/2b3p1/4knNp/2p4P/1pPp1P2/1P1P1BPK/8/8 w - -"
     };
 
-    auto startTime = ChessClock::now();
-    uint64_t totalNodes = 0;
-    movesToSearch.clear();
-    timeParams.searchMode = DEPTH;
-    // Set a default when the given depth is 0.
-    timeParams.allotment = depth ? depth : 13;
+    int depth = 13;
+    uint64_t nodes = 0;
+    int threads = engine.getNumThreads();
+    int runs = 1;
+    string epdFile;
+
+    unsigned int argIndex = 0;
+    if (args.size() > 0 && std::isdigit((unsigned char) args.at(0)[0]))
+        depth = std::stoi(args.at(argIndex++));
+    for (; argIndex + 1 < args.size(); argIndex += 2) {
+        string key = args.at(argIndex);
+        stringToLowerCase(key);
+        const string &value = args.at(argIndex+1);
+        if (key == "depth")
+            depth = std::stoi(value);
+        else if (key == "nodes")
+            nodes = std::stoull(value);
+        else if (key == "threads")
+            threads = std::stoi(value);
+        else if (key == "runs")
+            runs = std::stoi(value);
+        else if (key == "file")
+            epdFile = value;
+    }
+    // A depth of 0 uses the default
+    if (depth <= 0)
+        depth = 13;
+    depth = std::min(depth, MAX_DEPTH);
+    threads = std::max(MIN_THREADS, std::min(MAX_THREADS, threads));
+    runs = std::max(1, runs);
+
+    // EPD lines start with the four FEN fields, followed by optional operations
+    if (!epdFile.empty()) {
+        std::ifstream file(epdFile);
+        if (!file) {
+            cerr << "Could not open " << epdFile << endl;
+            return;
+        }
+        benchPositions.clear();
+        string line;
+        while (getline(file, line)) {
+            std::vector<string> fields = split(line, ' ');
+            if (fields.size() < 4 || fields.at(0)[0] == '#')
+                continue;
+            benchPositions.push_back(fields.at(0) + " " + fields.at(1) + " "
+                + fields.at(2) + " " + fields.at(3));
+        }
+        if (benchPositions.empty()) {
+            cerr << "No positions found in " << epdFile << endl;
+            return;
+        }
+    }
 
-    for (unsigned int i = 0; i < benchPositions.size(); i++) {
-        clearAll(b);
-        b = fenToBoard(benchPositions.at(i));
+    std::vector<int> threadCounts;
+    for (int t = 1; t < threads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(threads);
 
-        isStop = false;
-        stopSignal = false;
-        getBestMoveThreader(&b, &timeParams, &movesToSearch);
-        isStop = true;
-        stopSignal = true;
+    movesToSearch.clear();
+    timeParams.searchMode = nodes ? NODES : DEPTH;
+    timeParams.allotment = depth;
+    timeParams.nodeLimit = nodes;
+    int prevThreads = engine.getNumThreads();
+
+    std::stringstream json;
+    json << std::fixed << std::setprecision(4);
+    json << "{\"positions\":" << benchPositions.size() << ",\"depth\":" << depth
+         << ",\"nodes\":" << nodes << ",\"runs\":" << runs
+         << ",\"startup_ms\":" << startupTime / 1000.0 << ",\"results\":[";
+    double baseTime = 0, baseNPS = 0;
+
+    cerr << std::fixed << std::setprecision(2);
+    cerr << "Startup time  : " << startupTime / 1000.0 << " ms" << endl;
+    cerr.unsetf(std::ios::floatfield);
+
+    for (unsigned int t = 0; t < threadCounts.size(); t++) {
+        engine.setNumThreads(threadCounts.at(t));
+        std::vector<double> runTimes, runNPS;
+        uint64_t totalNodes = 0, hashProbes = 0, hashHits = 0;
+
+        for (int run = 0; run < runs; run++) {
+            uint64_t runTime = 0, runNodes = 0;
+            for (unsigned int i = 0; i < benchPositions.size(); i++) {
+                clearAll(engine, b);
+                b = fenToBoard(benchPositions.at(i));
+                engine.setPosition(b, std::vector<Move>());
+
+                auto startTime = ChessClock::now();
+                engine.search(timeParams, movesToSearch);
+                runTime += getTimeElapsed(startTime);
+
+                runNodes += engine.getNodes();
+                hashProbes += engine.getHashProbes();
+                hashHits += engine.getHashHits();
+            }
+            runTimes.push_back((double) runTime);
+            runNPS.push_back(1000.0 * runNodes / runTime);
+            totalNodes += runNodes;
+            if (runs > 1)
+                cerr << "Run " << run+1 << "/" << runs << ": " << runTime << " ms, "
+                     << runNodes << " nodes, " << (uint64_t) runNPS.back() << " nps" << endl;
+        }
 
-        totalNodes += getNodes();
-    }
+        double meanTime = 0, meanNPS = 0, sdNPS = 0;
+        for (int run = 0; run < runs; run++) {
+            meanTime += runTimes.at(run) / runs;
+            meanNPS += runNPS.at(run) / runs;
+        }
+        for (int run = 0; run < runs; run++)
+            sdNPS += (runNPS.at(run) - meanNPS) * (runNPS.at(run) - meanNPS);
+        sdNPS = (runs > 1) ? std::sqrt(sdNPS / (runs - 1)) : 0;
+        double hitRate = hashProbes ? 100.0 * hashHits / hashProbes : 0;
+        if (t == 0) {
+            baseTime = meanTime;
+            baseNPS = meanNPS;
+        }
 
-    uint64_t time = getTimeElapsed(startTime);
+        cerr << "Threads: " << threadCounts.at(t) << endl;
+        cerr << "Time  : " << (uint64_t) meanTime << " ms" << endl;
+        cerr << "Nodes : " << totalNodes / runs << endl;
+        cerr << "NPS   : " << (uint64_t) meanNPS << endl;
+        cerr << std::fixed << std::setprecision(2);
+        if (runs > 1)
+            cerr << "NPS SD: " << (uint64_t) sdNPS << " (" << 100.0 * sdNPS / meanNPS << "%)" << endl;
+        cerr << "Time/position : " << meanTime / benchPositions.size() << " ms" << endl;
+        cerr << "TT hit rate   : " << hitRate << "%" << endl;
+        if (t > 0)
+            cerr << "Speedup       : " << baseTime / meanTime << "x time to depth, "
+                 << meanNPS / baseNPS << "x NPS" << endl;
+        cerr.unsetf(std::ios::floatfield);
+
+        json << (t ? "," : "") << "{\"threads\":" << threadCounts.at(t)
+             << ",\"time_ms\":" << meanTime << ",\"nodes\":" << totalNodes / runs
+             << ",\"nps_mean\":" << meanNPS << ",\"nps_stddev\":" << sdNPS
+             << ",\"tt_hit_rate\":" << hitRate / 100
+             << ",\"speedup\":" << baseTime / meanTime
+             << ",\"nps_speedup\":" << meanNPS / baseNPS << "}";
+    }
+    json << "]}";
 
-    clearAll(b);
+    engine.setNumThreads(prevThreads);
+    clearAll(engine, b);
 
-    cerr << "Time  : " << time << " ms" << endl;
-    cerr << "Nodes : " << totalNodes << endl;
-    cerr << "NPS   : " << 1000 * totalNodes / time << endl;
+    uciOutput.flush();
+    cout << json.str() << endl;
 }
@@ -34,6 +34,10 @@ constexpr int MAX_THREADS = 128;
 constexpr int DEFAULT_BUFFER_TIME = 300;
 constexpr int MIN_BUFFER_TIME = 0;
 constexpr int MAX_BUFFER_TIME = 5000;
+// Maximum info lines per second, 0 for no limit
+constexpr int DEFAULT_INFO_RATE = 0;
+constexpr int MIN_INFO_RATE = 0;
+constexpr int MAX_INFO_RATE = 1000;
 constexpr int DEFAULT_EVAL_SCALE = 100;
 constexpr int MIN_EVAL_SCALE = 0;
 constexpr int MAX_EVAL_SCALE = 500;